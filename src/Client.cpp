@@ -6,6 +6,10 @@
 //
 
 #include "Client.h"
+#include "JsonDelta.h"
+#include "JsonExceptions.h"
+#include "JsonScanner.h"
+#include "Log.h"
 
 //#define REPORT_LOW_LEVEL
 
@@ -17,38 +21,117 @@ using namespace std;
 using namespace json_spirit;
 using namespace WebSocket;
 
+namespace {
+
+// Shared by the calls of one callAll()
+struct CallJoin
+{
+    explicit CallJoin(size_t count) : results(count), remaining(count), bFailed(false) { }
+
+    mutex joinMutex;
+    Array results;
+    size_t remaining;
+    bool bFailed;
+    Value error;
+    promise<Array> joined;
+};
+
+void completeJoin(std::shared_ptr<CallJoin> join, size_t index, const Value& value, bool bError)
+{
+    unique_lock<mutex> lock(join->joinMutex);
+    if (bError && !join->bFailed)
+    {
+        join->bFailed = true;
+        join->error = value;
+    }
+    else if (!bError)
+    {
+        join->results[index] = value;
+    }
+    if (--join->remaining > 0) return;
+
+    if (join->bFailed)  { join->joined.set_exception(make_exception_ptr(RpcError(join->error))); }
+    else                { join->joined.set_value(join->results); }
+}
+
+// Slices come from a scan that already validated them
+Value parseSlice(const JsonRpc::JsonScanner& scanner, const JsonRpc::JsonScanner::slice_t& slice)
+{
+    Value value;
+    read_string(scanner.text(slice), value);
+    return value;
+}
+
+// Rough serialized size of a cached result, counted without serializing it: the text of strings and keys
+// plus a few bytes per token
+size_t estimateJsonSize(const Value& value)
+{
+    size_t size = 2;
+    switch (value.type())
+    {
+    case str_type:
+        return value.get_str().size() + 2;
+    case obj_type:
+        for (auto& pair: value.get_obj()) { size += pair.name_.size() + 4 + estimateJsonSize(pair.value_); }
+        return size;
+    case array_type:
+        for (auto& element: value.get_array()) { size += estimateJsonSize(element) + 1; }
+        return size;
+    default:
+        return 8;
+    }
+}
+
+#if !defined(USE_TLS)
+std::string rpcErrorMessage(const Value& error)
+{
+    if (error.type() == obj_type)
+    {
+        const Value& message = find_value(error.get_obj(), "message");
+        if (message.type() == str_type) return message.get_str();
+    }
+    return write_string<Value>(error, false);
+}
+#endif
+
+}
+
+// Shared by both client variants, so only built once
+#if !defined(USE_TLS)
+RpcError::RpcError(const Value& error) : std::runtime_error(rpcErrorMessage(error)), m_error(error)
+{
+}
+
+void RpcError::fulfill(std::shared_ptr<promise<Value>> result, const Value& value)
+{
+    result->set_value(value);
+}
+
+void RpcError::fail(std::shared_ptr<promise<Value>> result, const Value& error)
+{
+    result->set_exception(make_exception_ptr(RpcError(error)));
+}
+#endif
+
 /// Public Methods
 #if defined(USE_TLS)
 ClientTls::ClientTls(const string& event_field, const string& data_field)
 #else
 ClientNoTls::ClientNoTls(const string& event_field, const string& data_field)
 #endif
-    : result_field("result"), error_field("error"), id_field("id"), bReturnFullResponse(false)
+    : result_field("result"), error_field("error"), id_field("id"), bReturnFullResponse(false), epoch(std::chrono::steady_clock::now()), call_timeout(0), result_cache(DEFAULT_CLIENT_CACHE_BUDGET)
 {
-    bConnected = false;
-    sequence = 0;
-
-    this->event_field = event_field;
-    this->data_field = data_field;
-
-#if defined(REPORT_LOW_LEVEL)
-    client.set_access_channels(websocketpp::log::alevel::all);
-    client.set_error_channels(websocketpp::log::elevel::all);
-#else
-    client.clear_access_channels(websocketpp::log::alevel::all);
-    client.clear_error_channels(websocketpp::log::elevel::all);
-#endif
-
-    client.init_asio();
+    init(event_field, data_field, NULL);
+}
 
 #if defined(USE_TLS)
-    on_tls_init = nullptr;
-    client.set_tls_init_handler(bind(&Client::onTlsInit, this, ::_1));
+ClientTls::ClientTls(boost::asio::io_service& io_service, const string& event_field, const string& data_field)
+#else
+ClientNoTls::ClientNoTls(boost::asio::io_service& io_service, const string& event_field, const string& data_field)
 #endif
-    client.set_open_handler(bind(&Client::onOpen, this, ::_1));
-    client.set_close_handler(bind(&Client::onClose, this, ::_1));
-    client.set_fail_handler(bind(&Client::onFail, this, ::_1));
-    client.set_message_handler(bind(&Client::onMessage, this, ::_1, ::_2));
+    : result_field("result"), error_field("error"), id_field("id"), bReturnFullResponse(false), epoch(std::chrono::steady_clock::now()), call_timeout(0), result_cache(DEFAULT_CLIENT_CACHE_BUDGET)
+{
+    init(event_field, data_field, &io_service);
 }
 
 #if defined(USE_TLS)
@@ -58,6 +141,11 @@ ClientNoTls::~ClientNoTls()
 #endif
 {
     stop();
+    if (!bExternalIoService) return;
+
+    // The io_service outlives this client: wait until nothing it still has queued refers to it
+    unique_lock<mutex> lock(handlerMutex);
+    while (pending_handlers > 0) { handlerCondition.wait(lock); }
 }
 
 #if defined(USE_TLS)
@@ -66,28 +154,9 @@ void ClientTls::start(const string& serverUrl, OpenHandler on_open, CloseHandler
 void ClientNoTls::start(const string& serverUrl, OpenHandler on_open, CloseHandler on_close, LogHandler on_log, ErrorHandler on_error)
 #endif
 {
-    {
-        if (bConnected) throw runtime_error("Already connected.");
-        unique_lock<mutex> lock(connectionMutex);
-        if (bConnected) throw runtime_error("Already connected.");
+    if (bExternalIoService) throw runtime_error("Client runs on an external io_service - use connect().");
 
-        error_code_t error_code;
-        pConnection = client.get_connection(serverUrl, error_code);
-        if (error_code)
-        {
-    #if defined(REPORT_LOW_LEVEL)
-            client.get_alog().write(websocketpp::log::alevel::app, error_code.message());
-    #endif
-            throw runtime_error(error_code.message());
-        }
-
-        sequence = 0; 
-        this->on_open = on_open;
-        this->on_close = on_close;
-        this->on_log = on_log;
-        this->on_error = on_error;
-        client.connect(pConnection);
-    }
+    connect(serverUrl, on_open, on_close, on_log, on_error);
 
     client.run();
 
@@ -98,14 +167,57 @@ void ClientNoTls::start(const string& serverUrl, OpenHandler on_open, CloseHandl
     }
 }
 
+#if defined(USE_TLS)
+void ClientTls::connect(const string& serverUrl, OpenHandler on_open, CloseHandler on_close, LogHandler on_log, ErrorHandler on_error)
+#else
+void ClientNoTls::connect(const string& serverUrl, OpenHandler on_open, CloseHandler on_close, LogHandler on_log, ErrorHandler on_error)
+#endif
+{
+    if (bConnected) throw runtime_error("Already connected.");
+    unique_lock<mutex> lock(connectionMutex);
+    if (bConnected) throw runtime_error("Already connected.");
+
+    this->serverUrl = serverUrl;
+    this->on_open = on_open;
+    this->on_close = on_close;
+    this->on_log = on_log;
+    this->on_error = on_error;
+    bStopping = false;
+    reconnect_attempts = 0;
+    doConnect();
+}
+
+#if defined(USE_TLS)
+void ClientTls::doConnect()
+#else
+void ClientNoTls::doConnect()
+#endif
+{
+    // Must be called with connectionMutex held
+    error_code_t error_code;
+    pConnection = client.get_connection(serverUrl, error_code);
+    if (error_code)
+    {
+#if defined(REPORT_LOW_LEVEL)
+        client.get_alog().write(websocketpp::log::alevel::app, error_code.message());
+#endif
+        throw runtime_error(error_code.message());
+    }
+
+    delta_documents.clear();
+    beginHandler();
+    client.connect(pConnection);
+}
+
 #if defined(USE_TLS)
 void ClientTls::stop()
 #else
 void ClientNoTls::stop()
 #endif
 {
-    if (!bConnected) return;
     unique_lock<mutex> lock(connectionMutex);
+    bStopping = true;
+    if (reconnect_timer) { reconnect_timer->cancel(); }
     if (!bConnected) return;
 
     pConnection->close(websocketpp::close::status::going_away, "");
@@ -119,19 +231,19 @@ void ClientNoTls::send(const Object& cmd, ResultCallback resultCallback, ErrorCa
 #endif
 {
     if (!bConnected) throw runtime_error("Not connected.");
-    unique_lock<mutex> lock(connectionMutex);
-    if (!bConnected) throw runtime_error("Not connected.");
 
+    // Serialized on the calling thread; only the io thread touches the connection
+    uint64_t id = sequence++;
     Object seqCmd(cmd);
-    seqCmd.push_back(Pair(id_field, sequence));
-    if (resultCallback || errorCallback)
+    seqCmd.push_back(Pair(id_field, id));
+    queued_send_t item = { id, resultCallback || errorCallback, write_string<Value>(seqCmd, false) };
+    if (item.bTracked)
     {
-        callback_map[sequence] = CallbackPair(resultCallback, errorCallback);
+        const Value& method = find_value(cmd, "method");
+        addPendingCall(id, CallbackPair(resultCallback, errorCallback), call_timeout, (method.type() == str_type) ? method.get_str() : string(), item.json);
     }
-    sequence++;
-    string cmdStr = write_string<Value>(seqCmd, false);
-    if (on_log) on_log(string("Sending command: ") + cmdStr);
-    pConnection->send(cmdStr);
+    if (on_log && WS_LOG_ENABLED(trace)) on_log(string("Sending command: ") + item.json);
+    enqueueSend(item);
 }
 
 #if defined(USE_TLS)
@@ -141,19 +253,92 @@ void ClientNoTls::send(const JsonRpc::Request& request, ResultCallback resultCal
 #endif
 {
     if (!bConnected) throw runtime_error("Not connected.");
-    unique_lock<mutex> lock(connectionMutex);
-    if (!bConnected) throw runtime_error("Not connected.");
+    if (!cached_methods.empty() && (resultCallback || errorCallback) && sendCached(request, resultCallback, errorCallback)) return;
+    doSendRequest(request, resultCallback, errorCallback);
+}
+
+#if defined(USE_TLS)
+void ClientTls::setCachedMethod(const string& method, unsigned int ttl, const vector<string>& invalidatingEvents)
+#else
+void ClientNoTls::setCachedMethod(const string& method, unsigned int ttl, const vector<string>& invalidatingEvents)
+#endif
+{
+    unique_lock<mutex> lock(cacheMutex);
+    cached_methods[method].ttl = ttl;
+    for (auto& event: invalidatingEvents) { event_invalidations.insert(make_pair(event, method)); }
+}
+
+#if defined(USE_TLS)
+void ClientTls::invalidateCache(const string& method)
+#else
+void ClientNoTls::invalidateCache(const string& method)
+#endif
+{
+    unique_lock<mutex> lock(cacheMutex);
+    auto it = cached_methods.find(method);
+    if (it == cached_methods.end()) return;
+    it->second.generation++;
+    result_cache.eraseTag(method);
+}
 
+#if defined(USE_TLS)
+void ClientTls::doSendRequest(const JsonRpc::Request& request, ResultCallback resultCallback, ErrorCallback errorCallback)
+#else
+void ClientNoTls::doSendRequest(const JsonRpc::Request& request, ResultCallback resultCallback, ErrorCallback errorCallback)
+#endif
+{
+    uint64_t id = sequence++;
     JsonRpc::Request seqRequest(request);
-    seqRequest.setId((uint64_t)sequence);
-    if (resultCallback || errorCallback)
+    seqRequest.setId(id);
+    queued_send_t item = { id, resultCallback || errorCallback, seqRequest.getJson() };
+    if (item.bTracked)
+    {
+        addPendingCall(id, CallbackPair(resultCallback, errorCallback), request.getTimeout() ? request.getTimeout() : call_timeout, request.getMethod(), item.json);
+    }
+    if (on_log && WS_LOG_ENABLED(trace)) on_log(string("Sending command: ") + item.json);
+    enqueueSend(item);
+}
+
+#if defined(USE_TLS)
+future<Value> ClientTls::call(const JsonRpc::Request& request)
+#else
+future<Value> ClientNoTls::call(const JsonRpc::Request& request)
+#endif
+{
+    std::shared_ptr<promise<Value>> result(new promise<Value>());
+    future<Value> f = result->get_future();
+    send(request, bind(&RpcError::fulfill, result, ::_1), bind(&RpcError::fail, result, ::_1));
+    return f;
+}
+
+#if defined(USE_TLS)
+future<Value> ClientTls::call(const string& method, const Array& params)
+#else
+future<Value> ClientNoTls::call(const string& method, const Array& params)
+#endif
+{
+    return call(JsonRpc::Request(method, params));
+}
+
+#if defined(USE_TLS)
+future<Array> ClientTls::callAll(const vector<JsonRpc::Request>& requests)
+#else
+future<Array> ClientNoTls::callAll(const vector<JsonRpc::Request>& requests)
+#endif
+{
+    std::shared_ptr<CallJoin> join(new CallJoin(requests.size()));
+    future<Array> f = join->joined.get_future();
+    if (requests.empty())
+    {
+        join->joined.set_value(Array());
+        return f;
+    }
+
+    for (size_t i = 0; i < requests.size(); i++)
     {
-        callback_map[sequence] = CallbackPair(resultCallback, errorCallback);
+        send(requests[i], bind(&completeJoin, join, i, ::_1, false), bind(&completeJoin, join, i, ::_1, true));
     }
-    sequence++;
-    string cmdStr = seqRequest.getJson();
-    if (on_log) on_log(string("Sending command: ") + cmdStr);
-    pConnection->send(cmdStr);
+    return f;
 }
 
 #if defined(USE_TLS)
@@ -161,12 +346,124 @@ ClientTls& ClientTls::on(const string& eventType, EventHandler handler)
 #else
 ClientNoTls& ClientNoTls::on(const string& eventType, EventHandler handler)
 #endif
+{
+    // Copy on write, so dispatch only holds the lock to take a reference
+    unique_lock<mutex> lock(handlerMapMutex);
+    std::shared_ptr<EventHandlerMap> handlers(new EventHandlerMap(*event_handlers));
+    (*handlers)[eventType].assign(1, std::make_pair(next_handler_id++, handler));
+    event_handlers = handlers;
+    return *this;
+}
+
+#if defined(USE_TLS)
+EventHandlerId ClientTls::addHandler(const string& eventType, EventHandler handler)
+#else
+EventHandlerId ClientNoTls::addHandler(const string& eventType, EventHandler handler)
+#endif
+{
+    unique_lock<mutex> lock(handlerMapMutex);
+    std::shared_ptr<EventHandlerMap> handlers(new EventHandlerMap(*event_handlers));
+    EventHandlerId id = next_handler_id++;
+    (*handlers)[eventType].push_back(std::make_pair(id, handler));
+    event_handlers = handlers;
+    return id;
+}
+
+#if defined(USE_TLS)
+ClientTls& ClientTls::removeHandler(const string& eventType, EventHandlerId id)
+#else
+ClientNoTls& ClientNoTls::removeHandler(const string& eventType, EventHandlerId id)
+#endif
+{
+    unique_lock<mutex> lock(handlerMapMutex);
+    auto it = event_handlers->find(eventType);
+    if (it == event_handlers->end()) return *this;
+
+    std::shared_ptr<EventHandlerMap> handlers(new EventHandlerMap(*event_handlers));
+    auto& typeHandlers = (*handlers)[eventType];
+    for (auto handler = typeHandlers.begin(); handler != typeHandlers.end(); ++handler)
+    {
+        if (handler->first == id) { typeHandlers.erase(handler); break; }
+    }
+    if (typeHandlers.empty()) { handlers->erase(eventType); }
+    event_handlers = handlers;
+    return *this;
+}
+
+#if defined(USE_TLS)
+ClientTls& ClientTls::off(const string& eventType)
+#else
+ClientNoTls& ClientNoTls::off(const string& eventType)
+#endif
 {
     unique_lock<mutex> lock(handlerMapMutex);
-    event_handler_map[eventType] = handler;
+    std::shared_ptr<EventHandlerMap> handlers(new EventHandlerMap(*event_handlers));
+    handlers->erase(eventType);
+    event_handlers = handlers;
     return *this;
 }
 
+#if defined(USE_TLS)
+void ClientTls::setEventWorkers(size_t count)
+#else
+void ClientNoTls::setEventWorkers(size_t count)
+#endif
+{
+    if (count)  { event_workers.reset(new IoServicePool(count)); }
+    else        { event_workers.reset(); }
+}
+
+#if defined(USE_TLS)
+void ClientTls::init(const string& event_field, const string& data_field, boost::asio::io_service* io_service)
+#else
+void ClientNoTls::init(const string& event_field, const string& data_field, boost::asio::io_service* io_service)
+#endif
+{
+    bConnected = false;
+    bExternalIoService = (io_service != NULL);
+    pending_handlers = 0;
+    bAutoReconnect = false;
+    bStopping = false;
+    reconnect_min_delay = DEFAULT_RECONNECT_MIN_DELAY;
+    reconnect_max_delay = DEFAULT_RECONNECT_MAX_DELAY;
+    reconnect_attempts = 0;
+    jitter_rng.seed(std::random_device()());
+    batch_window = -1;
+    batch_max_calls = DEFAULT_BATCH_MAX_CALLS;
+    batch_max_bytes = DEFAULT_BATCH_MAX_BYTES;
+    batch_format = BATCH_ARRAY;
+    batch_bytes = 0;
+    bBatchFlushScheduled = false;
+    bBatchesConfirmed = false;
+    bDrainScheduled = false;
+    event_handlers.reset(new EventHandlerMap());
+    next_handler_id = 0;
+    sequence = 0;
+
+    this->event_field = event_field;
+    this->data_field = data_field;
+
+#if defined(REPORT_LOW_LEVEL)
+    client.set_access_channels(websocketpp::log::alevel::all);
+    client.set_error_channels(websocketpp::log::elevel::all);
+#else
+    client.clear_access_channels(websocketpp::log::alevel::all);
+    client.clear_error_channels(websocketpp::log::elevel::all);
+#endif
+
+    if (io_service)     { client.init_asio(io_service); }
+    else                { client.init_asio(); }
+
+#if defined(USE_TLS)
+    on_tls_init = nullptr;
+    client.set_tls_init_handler(bind(&Client::onTlsInit, this, ::_1));
+#endif
+    client.set_open_handler(bind(&Client::onOpen, this, ::_1));
+    client.set_close_handler(bind(&Client::onClose, this, ::_1));
+    client.set_fail_handler(bind(&Client::onFail, this, ::_1));
+    client.set_message_handler(bind(&Client::onMessage, this, ::_1, ::_2));
+}
+
 /// Protected Methods
 #if defined(USE_TLS)
 context_ptr ClientTls::onTlsInit(connection_hdl_t hdl)
@@ -182,8 +479,26 @@ void ClientTls::onOpen(connection_hdl_t hdl)
 void ClientNoTls::onOpen(connection_hdl_t hdl)
 #endif
 {
-    bConnected = true;
-    if (on_log) on_log("Connection opened.");
+    {
+        unique_lock<mutex> lock(connectionMutex);
+        if (bStopping)
+        {
+            // Stopped while connecting
+            error_code_t error_code;
+            pConnection->close(websocketpp::close::status::going_away, "", error_code);
+            return;
+        }
+        bConnected = true;
+        connected_since = std::chrono::steady_clock::now();
+    }
+
+    // Bring the wheel up to date so timeouts of the first calls are measured from now
+    timer_wheel.advance(getTicks());
+    wheel_timer.reset(new boost::asio::deadline_timer(client.get_io_service(), boost::posix_time::milliseconds(CLIENT_TIMER_TICK_MS)));
+    beginHandler();
+    wheel_timer->async_wait(bind(&Client::onWheelTick, this, ::_1));
+    if (on_log && WS_LOG_ENABLED(info)) on_log("Connection opened.");
+    resumeSession();
     if (on_open) on_open();
 }
 
@@ -193,8 +508,11 @@ void ClientTls::onClose(connection_hdl_t hdl)
 void ClientNoTls::onClose(connection_hdl_t hdl)
 #endif
 {
+    handler_scope_t scope(*this);
     bConnected = false;
-    if (on_log) on_log("Connection closed.");
+    if (wheel_timer) { wheel_timer->cancel(); }
+    onDisconnect();
+    if (on_log && WS_LOG_ENABLED(info)) on_log("Connection closed.");
     if (on_close) on_close();
 }
 
@@ -204,7 +522,10 @@ void ClientTls::onFail(connection_hdl_t hdl)
 void ClientNoTls::onFail(connection_hdl_t hdl)
 #endif
 {
+    handler_scope_t scope(*this);
     bConnected = false;
+    if (wheel_timer) { wheel_timer->cancel(); }
+    onDisconnect();
     if (on_error)
     {
         string error("Connection failed - ");
@@ -218,56 +539,33 @@ void ClientTls::onMessage(connection_hdl_t hdl, message_ptr_t msg)
 void ClientNoTls::onMessage(connection_hdl_t hdl, message_ptr_t msg)
 #endif
 {
-    string json = msg->get_payload();
+    const string& json = msg->get_payload();
 
     try
     {
-        if (on_log)
-        {
-            stringstream ss;
-            ss << "Received message from server: " << json;
-            on_log(ss.str());
-        }
-
-        Value value;
-        read_string(json, value);
-        const Object& obj = value.get_obj();
-        const Value& id = find_value(obj, id_field);
-
-        const Value& result = find_value(obj, result_field);
-        if (result.type() != null_type && id.type() == int_type)
-        {
-            if (bReturnFullResponse)    { onResult(obj, id.get_uint64());    }
-            else                        { onResult(result, id.get_uint64()); }
-            return;
-        }
-
-        const Value& error = find_value(obj, error_field);
-        if (error.type() != null_type && id.type() == int_type)
-        {
-            if (bReturnFullResponse)    { onError(obj, id.get_uint64());     }
-            else                        { onError(error, id.get_uint64());   }
-            return;
-        }
+        if (on_log && WS_LOG_ENABLED(trace)) on_log(string("Received message from server: ") + json);
 
-        const Value& event = find_value(obj, event_field);
-        if (event.type() == str_type)
+        JsonRpc::JsonScanner scanner(json);
+        JsonRpc::JsonScanner::slice_t root = scanner.root();
+        if (scanner.type(root) == '[')
         {
-            auto it = event_handler_map.find(event.get_str());
-            if (it != event_handler_map.end())
+            // Batch response: each element answers one of the batched calls
+            if (!bBatchesConfirmed)
             {
-                if (!data_field.empty())
-                {
-                    const Value& data = find_value(obj, data_field);
-                    it->second(data);
-                }
-                else
+                unique_lock<mutex> lock(connectionMutex);
+                bBatchesConfirmed = true;
+                unconfirmed_batches.clear();
+            }
+            for (auto& element: scanner.elements(root))
+            {
+                if (scanner.type(element) != '{' || !onServerObject(scanner, element))
                 {
-                    it->second(obj);
+                    if (on_error) on_error(string("Invalid server message in batch: ") + scanner.text(element));
                 }
             }
             return;
         }
+        if (scanner.type(root) == '{' && onServerObject(scanner, root)) return;
 
         if (on_error)
         {
@@ -288,70 +586,783 @@ void ClientNoTls::onMessage(connection_hdl_t hdl, message_ptr_t msg)
 }
 
 #if defined(USE_TLS)
-void ClientTls::onResult(const Value& result, uint64_t id)
+bool ClientTls::onServerObject(const JsonRpc::JsonScanner& scanner, const JsonRpc::JsonScanner::slice_t& slice)
 #else
-void ClientNoTls::onResult(const Value& result, uint64_t id)
+bool ClientNoTls::onServerObject(const JsonRpc::JsonScanner& scanner, const JsonRpc::JsonScanner::slice_t& slice)
 #endif
 {
-    if (on_log)
+    // One pass over the members finds the routing fields; only the values needed are parsed
+    const JsonRpc::JsonScanner::slice_t* id = NULL;
+    const JsonRpc::JsonScanner::slice_t* result = NULL;
+    const JsonRpc::JsonScanner::slice_t* error = NULL;
+    const JsonRpc::JsonScanner::slice_t* event = NULL;
+    const JsonRpc::JsonScanner::slice_t* delta = NULL;
+    const JsonRpc::JsonScanner::slice_t* data = NULL;
+    JsonRpc::JsonScanner::members_t members = scanner.members(slice);
+    for (auto& member: members)
     {
-        string json = write_string<Value>(result, true);
-        stringstream ss;
-        ss << "Received result for id " << id << ": " << json;
-        on_log(ss.str());
+        const JsonRpc::JsonScanner::slice_t** field = NULL;
+        if (member.first == id_field)                       { field = &id; }
+        else if (member.first == result_field)              { field = &result; }
+        else if (member.first == error_field)               { field = &error; }
+        else if (member.first == event_field)               { field = &event; }
+        else if (member.first == JsonRpc::DELTA_FIELD)      { field = &delta; }
+        else if (member.first == data_field)                { field = &data; }
+        if (field && !*field && scanner.type(member.second) != 'n') { *field = &member.second; }
     }
 
-    try
+    Value idValue;
+    if (id && (result || error)) { idValue = parseSlice(scanner, *id); }
+    if (idValue.type() == int_type)
     {
-        auto it = callback_map.find(id);
-        if (it != callback_map.end() && it->second.first)
-        {
-            it->second.first(result);
-            callback_map.erase(id);
-        }
+        Value value = parseSlice(scanner, bReturnFullResponse ? slice : (result ? *result : *error));
+        if (result) { onResult(value, idValue.get_uint64()); }
+        else        { onError(value, idValue.get_uint64()); }
+        return true;
     }
-    catch (const exception& e)
+    if (error && idValue.is_null() && !bBatchesConfirmed)
     {
-        if (on_error)
+        // A server that can't read batch arrays answers each with one error and no id, in the order they were
+        // sent. The calls of the array it rejected would otherwise never be answered, so they fail with it.
+        std::vector<uint64_t> ids;
         {
-            stringstream ss;
-            ss << "Server result parse error for id " << id << ": " << e.what();
-            on_error(ss.str());
+            unique_lock<mutex> lock(connectionMutex);
+            if (!unconfirmed_batches.empty())
+            {
+                ids.swap(unconfirmed_batches.front());
+                unconfirmed_batches.pop_front();
+            }
+        }
+        if (!ids.empty())
+        {
+            Value value = parseSlice(scanner, bReturnFullResponse ? slice : *error);
+            for (auto id: ids) { onError(value, id); }
+            return true;
         }
     }
-}
 
-#if defined(USE_TLS)
-void ClientTls::onError(const Value& error, uint64_t id)
-#else
-void ClientNoTls::onError(const Value& error, uint64_t id)
-#endif
-{
-    if (on_log)
+    if (!event || scanner.type(*event) != '"') return false;
+    string eventType = parseSlice(scanner, *event).get_str();
+
+    if (!event_invalidations.empty())
     {
-        string json = write_string<Value>(error, true);
-        stringstream ss;
-        ss << "Received error for id " << id << ": " << json;
-        on_log(ss.str());
+        auto range = event_invalidations.equal_range(eventType);
+        for (auto it = range.first; it != range.second; ++it) { invalidateCache(it->second); }
     }
 
-    try
+    // Delta state is kept even for events nobody is listening to yet
+    Value doc;
+    bool bDelta = delta && scanner.type(*delta) == '{';
+    if (bDelta && !resolveDelta(parseSlice(scanner, *delta).get_obj(), doc)) return true;
+
+    std::shared_ptr<const EventHandlerMap> handlers;
     {
-        auto it = callback_map.find(id);
-        if (it != callback_map.end() && it->second.second)
-        {
-            it->second.second(error);
-            callback_map.erase(id);
-        }
+        unique_lock<mutex> lock(handlerMapMutex);
+        handlers = event_handlers;
     }
-    catch (const exception& e)
+    if (!handlers->count(eventType)) return true;
+
+    if (!bDelta)
     {
-        if (on_error)
-        {
-            stringstream ss;
-            ss << "Server error parse error for id " << id << ": " << e.what();
-            on_error(ss.str());
-        }
+        if (data_field.empty()) { doc = parseSlice(scanner, slice); }
+        else if (data)          { doc = parseSlice(scanner, *data); }
+    }
+    else if (data_field.empty())
+    {
+        // Handlers of whole messages see a delta channel message as the full message the channel would send
+        doc = JsonRpc::expandDelta(parseSlice(scanner, slice).get_obj(), doc);
+    }
+
+    if (event_workers)
+    {
+        // Every event of a type goes to the same worker, so handlers see them in order
+        event_workers->get(std::hash<string>()(eventType)).post(bind(&Client::onEventWork, this, handlers, eventType, doc));
+        return true;
+    }
+    runEventHandlers(*handlers, eventType, doc);
+    return true;
+}
+
+#if defined(USE_TLS)
+void ClientTls::runEventHandlers(const EventHandlerMap& handlers, const string& eventType, const Value& data)
+#else
+void ClientNoTls::runEventHandlers(const EventHandlerMap& handlers, const string& eventType, const Value& data)
+#endif
+{
+    auto it = handlers.find(eventType);
+    if (it == handlers.end()) return;
+    for (auto& handler: it->second) { handler.second(data); }
+}
+
+#if defined(USE_TLS)
+void ClientTls::onEventWork(std::shared_ptr<const EventHandlerMap> handlers, const string& eventType, const Value& data)
+#else
+void ClientNoTls::onEventWork(std::shared_ptr<const EventHandlerMap> handlers, const string& eventType, const Value& data)
+#endif
+{
+    try
+    {
+        runEventHandlers(*handlers, eventType, data);
+    }
+    catch (const exception& e)
+    {
+        if (on_error) on_error(string("Event handler error for ") + eventType + " - " + e.what());
+    }
+}
+
+#if defined(USE_TLS)
+void ClientTls::onResult(const Value& result, uint64_t id)
+#else
+void ClientNoTls::onResult(const Value& result, uint64_t id)
+#endif
+{
+    // The payload itself was logged on arrival
+    if (on_log && WS_LOG_ENABLED(debug))
+    {
+        stringstream ss;
+        ss << "Received result for id " << id;
+        on_log(ss.str());
     }
-}
 
+    try
+    {
+        PendingCall call;
+        if (!pending_calls.take(id, call)) return;
+        if (call.timer) { timer_wheel.cancel(call.timer); }
+        if (call.callbacks.first) { call.callbacks.first(result); }
+    }
+    catch (const exception& e)
+    {
+        if (on_error)
+        {
+            stringstream ss;
+            ss << "Server result parse error for id " << id << ": " << e.what();
+            on_error(ss.str());
+        }
+    }
+}
+
+#if defined(USE_TLS)
+void ClientTls::onError(const Value& error, uint64_t id)
+#else
+void ClientNoTls::onError(const Value& error, uint64_t id)
+#endif
+{
+    if (on_log && WS_LOG_ENABLED(debug))
+    {
+        stringstream ss;
+        ss << "Received error for id " << id;
+        on_log(ss.str());
+    }
+
+    try
+    {
+        PendingCall call;
+        if (!pending_calls.take(id, call)) return;
+        if (call.timer) { timer_wheel.cancel(call.timer); }
+        if (call.callbacks.second) { call.callbacks.second(error); }
+    }
+    catch (const exception& e)
+    {
+        if (on_error)
+        {
+            stringstream ss;
+            ss << "Server error parse error for id " << id << ": " << e.what();
+            on_error(ss.str());
+        }
+    }
+}
+
+
+#if defined(USE_TLS)
+bool ClientTls::resolveDelta(const Object& delta, Value& doc)
+#else
+bool ClientNoTls::resolveDelta(const Object& delta, Value& doc)
+#endif
+{
+    const Value& channel = find_value(delta, "channel");
+    const Value& version = find_value(delta, "version");
+    if (channel.type() != str_type || version.type() != int_type) throw runtime_error("Invalid delta.");
+
+    DeltaDocument& entry = delta_documents[channel.get_str()];
+    const Value& patch = find_value(delta, "patch");
+    if (patch.type() != array_type)
+    {
+        // Snapshot
+        entry.first = version.get_uint64();
+        entry.second = find_value(delta, "data");
+        doc = entry.second;
+        return true;
+    }
+
+    try
+    {
+        const Value& base = find_value(delta, "base");
+        if (base.type() != int_type || base.get_uint64() != entry.first) throw runtime_error("Delta base version mismatch.");
+        JsonRpc::applyPatch(entry.second, patch.get_array());
+    }
+    catch (const exception& e)
+    {
+        delta_documents.erase(channel.get_str());
+        if (on_log && WS_LOG_ENABLED(info))
+        {
+            stringstream ss;
+            ss << "Resyncing channel " << channel.get_str() << " - " << e.what();
+            on_log(ss.str());
+        }
+        send(JsonRpc::Request(JsonRpc::DELTA_RESYNC_METHOD, Array(1, channel)));
+        return false;
+    }
+
+    entry.first = version.get_uint64();
+    doc = entry.second;
+    return true;
+}
+
+#if defined(USE_TLS)
+void ClientTls::addPendingCall(uint64_t id, const CallbackPair& callbacks, uint64_t timeout, const string& method, const string& json)
+#else
+void ClientNoTls::addPendingCall(uint64_t id, const CallbackPair& callbacks, uint64_t timeout, const string& method, const string& json)
+#endif
+{
+    PendingCall call;
+    call.callbacks = callbacks;
+    call.timeout = timeout;
+    if (!idempotent_methods.empty() && idempotent_methods.count(method)) { call.json = json; }
+    if (timeout) { call.timer = timer_wheel.schedule(timeout / CLIENT_TIMER_TICK_MS + 1, bind(&Client::onCallTimeout, this, id)); }
+    pending_calls.insert(id, call);
+}
+
+#if defined(USE_TLS)
+void ClientTls::failCall(uint64_t id, const CallbackPair& callbacks, const stdutils::custom_error& e)
+#else
+void ClientNoTls::failCall(uint64_t id, const CallbackPair& callbacks, const stdutils::custom_error& e)
+#endif
+{
+    if (!callbacks.second) return;
+
+    JsonRpc::Response response;
+    response.setError(e, id);
+    try
+    {
+        if (bReturnFullResponse)
+        {
+            Object obj;
+            obj.push_back(Pair(result_field, Value()));
+            obj.push_back(Pair(error_field, response.getError()));
+            obj.push_back(Pair(id_field, id));
+            callbacks.second(obj);
+        }
+        else
+        {
+            callbacks.second(response.getError());
+        }
+    }
+    catch (const exception& ex)
+    {
+        if (on_error)
+        {
+            stringstream ss;
+            ss << "Error callback failed for id " << id << ": " << ex.what();
+            on_error(ss.str());
+        }
+    }
+}
+
+#if defined(USE_TLS)
+void ClientTls::failAllCalls(const stdutils::custom_error& e)
+#else
+void ClientNoTls::failAllCalls(const stdutils::custom_error& e)
+#endif
+{
+    auto calls = pending_calls.takeAll();
+    calls.insert(calls.end(), replay_calls.begin(), replay_calls.end());
+    replay_calls.clear();
+    for (auto& call: calls)
+    {
+        if (call.second.timer) { timer_wheel.cancel(call.second.timer); }
+        failCall(call.first, call.second.callbacks, e);
+    }
+}
+
+#if defined(USE_TLS)
+void ClientTls::setAutoReconnect(bool bEnabled, unsigned int minDelay, unsigned int maxDelay)
+#else
+void ClientNoTls::setAutoReconnect(bool bEnabled, unsigned int minDelay, unsigned int maxDelay)
+#endif
+{
+    bAutoReconnect = bEnabled;
+    reconnect_min_delay = minDelay ? minDelay : 1;
+    reconnect_max_delay = std::max(maxDelay, reconnect_min_delay);
+}
+
+#if defined(USE_TLS)
+void ClientTls::addSubscription(const string& method, const Array& params)
+#else
+void ClientNoTls::addSubscription(const string& method, const Array& params)
+#endif
+{
+    unique_lock<mutex> lock(connectionMutex);
+    std::pair<string, Array> subscription(method, params);
+    if (std::find(subscriptions.begin(), subscriptions.end(), subscription) != subscriptions.end()) return;
+    subscriptions.push_back(subscription);
+}
+
+#if defined(USE_TLS)
+void ClientTls::removeSubscription(const string& method, const Array& params)
+#else
+void ClientNoTls::removeSubscription(const string& method, const Array& params)
+#endif
+{
+    unique_lock<mutex> lock(connectionMutex);
+    subscriptions.erase(std::remove(subscriptions.begin(), subscriptions.end(), std::make_pair(method, params)), subscriptions.end());
+}
+
+#if defined(USE_TLS)
+void ClientTls::setIdempotentMethod(const string& method, bool bIdempotent)
+#else
+void ClientNoTls::setIdempotentMethod(const string& method, bool bIdempotent)
+#endif
+{
+    if (bIdempotent)    { idempotent_methods.insert(method); }
+    else                { idempotent_methods.erase(method); }
+}
+
+#if defined(USE_TLS)
+bool ClientTls::sendCached(const JsonRpc::Request& request, ResultCallback resultCallback, ErrorCallback errorCallback)
+#else
+bool ClientNoTls::sendCached(const JsonRpc::Request& request, ResultCallback resultCallback, ErrorCallback errorCallback)
+#endif
+{
+    // Returns true if the call was answered from the cache or joined an identical call in flight
+    std::shared_ptr<cache_flight_t> flight;
+    string key;
+    {
+        unique_lock<mutex> lock(cacheMutex);
+        auto cachedIt = cached_methods.find(request.getMethod());
+        if (cachedIt == cached_methods.end()) return false;
+
+        key = request.getKey();
+        Value result;
+        if (result_cache.get(key, result))
+        {
+            // Answered on the io thread like any other reply
+            if (resultCallback) { client.get_io_service().post(bind(resultCallback, result)); }
+            return true;
+        }
+
+        auto flightIt = cache_flights.find(key);
+        if (flightIt != cache_flights.end())
+        {
+            flightIt->second->waiters.push_back(CallbackPair(resultCallback, errorCallback));
+            return true;
+        }
+
+        flight.reset(new cache_flight_t());
+        flight->method = request.getMethod();
+        flight->generation = cachedIt->second.generation;
+        flight->waiters.push_back(CallbackPair(resultCallback, errorCallback));
+        cache_flights[key] = flight;
+    }
+
+    try
+    {
+        doSendRequest(request, bind(&Client::onCachedResult, this, key, flight, ::_1), bind(&Client::onCachedError, this, key, flight, ::_1));
+    }
+    catch (...)
+    {
+        unique_lock<mutex> lock(cacheMutex);
+        cache_flights.erase(key);
+        throw;
+    }
+    return true;
+}
+
+#if defined(USE_TLS)
+void ClientTls::onCachedResult(const string& key, std::shared_ptr<cache_flight_t> flight, const Value& result)
+#else
+void ClientNoTls::onCachedResult(const string& key, std::shared_ptr<cache_flight_t> flight, const Value& result)
+#endif
+{
+    std::vector<CallbackPair> waiters;
+    size_t size = key.size() + estimateJsonSize(result);
+    {
+        // Checked under the lock so a concurrent invalidation can't be undone by a stale result
+        unique_lock<mutex> lock(cacheMutex);
+        auto flightIt = cache_flights.find(key);
+        if (flightIt != cache_flights.end() && flightIt->second == flight) { cache_flights.erase(flightIt); }
+        waiters.swap(flight->waiters);
+
+        auto cachedIt = cached_methods.find(flight->method);
+        if (cachedIt != cached_methods.end() && cachedIt->second.generation == flight->generation)
+        {
+            result_cache.put(key, result, size, cachedIt->second.ttl, flight->method);
+        }
+    }
+    for (auto& waiter: waiters)
+    {
+        if (waiter.first) { waiter.first(result); }
+    }
+}
+
+#if defined(USE_TLS)
+void ClientTls::onCachedError(const string& key, std::shared_ptr<cache_flight_t> flight, const Value& error)
+#else
+void ClientNoTls::onCachedError(const string& key, std::shared_ptr<cache_flight_t> flight, const Value& error)
+#endif
+{
+    std::vector<CallbackPair> waiters;
+    {
+        unique_lock<mutex> lock(cacheMutex);
+        auto flightIt = cache_flights.find(key);
+        if (flightIt != cache_flights.end() && flightIt->second == flight) { cache_flights.erase(flightIt); }
+        waiters.swap(flight->waiters);
+    }
+    for (auto& waiter: waiters)
+    {
+        if (waiter.second) { waiter.second(error); }
+    }
+}
+
+#if defined(USE_TLS)
+void ClientTls::setBatching(int window, size_t maxCalls, size_t maxBytes, BatchFormat format)
+#else
+void ClientNoTls::setBatching(int window, size_t maxCalls, size_t maxBytes, BatchFormat format)
+#endif
+{
+    unique_lock<mutex> lock(connectionMutex);
+    if (bConnected) { flushBatch(); }
+    batch_window = window;
+    batch_max_calls = maxCalls ? maxCalls : 1;
+    batch_max_bytes = maxBytes;
+    batch_format = format;
+}
+
+#if defined(USE_TLS)
+void ClientTls::doSend(uint64_t id, const string& json)
+#else
+void ClientNoTls::doSend(uint64_t id, const string& json)
+#endif
+{
+    // Must be called with connectionMutex held
+    if (batch_window < 0)
+    {
+        pConnection->send(json);
+        return;
+    }
+
+    batch_calls.push_back(make_pair(id, json));
+    batch_bytes += json.size() + 1;
+    if (batch_calls.size() >= batch_max_calls || batch_bytes >= batch_max_bytes)
+    {
+        flushBatch();
+        return;
+    }
+    if (bBatchFlushScheduled) return;
+
+    bBatchFlushScheduled = true;
+    beginHandler();
+    if (batch_window == 0)
+    {
+        client.get_io_service().post(bind(&Client::onBatchTimer, this, boost::system::error_code()));
+        return;
+    }
+    batch_timer.reset(new boost::asio::deadline_timer(client.get_io_service(), boost::posix_time::milliseconds(batch_window)));
+    batch_timer->async_wait(bind(&Client::onBatchTimer, this, ::_1));
+}
+
+#if defined(USE_TLS)
+void ClientTls::flushBatch()
+#else
+void ClientNoTls::flushBatch()
+#endif
+{
+    // Must be called with connectionMutex held
+    if (batch_calls.empty()) return;
+
+    if (batch_calls.size() == 1)
+    {
+        pConnection->send(batch_calls.front().second);
+    }
+    else
+    {
+        string frame;
+        frame.reserve(batch_bytes + 1);
+        if (batch_format == BATCH_ARRAY) { frame += '['; }
+        for (size_t i = 0; i < batch_calls.size(); i++)
+        {
+            if (i > 0) { frame += (batch_format == BATCH_ARRAY) ? ',' : '\n'; }
+            frame += batch_calls[i].second;
+        }
+        if (batch_format == BATCH_ARRAY) { frame += ']'; }
+        pConnection->send(frame);
+
+        // Until the server answers an array, an error without an id may be its rejection of one
+        if (batch_format == BATCH_ARRAY && !bBatchesConfirmed)
+        {
+            unconfirmed_batches.push_back(std::vector<uint64_t>());
+            for (auto& call: batch_calls) { unconfirmed_batches.back().push_back(call.first); }
+        }
+    }
+    batch_calls.clear();
+    batch_bytes = 0;
+}
+
+#if defined(USE_TLS)
+void ClientTls::onBatchTimer(const boost::system::error_code& ec)
+#else
+void ClientNoTls::onBatchTimer(const boost::system::error_code& ec)
+#endif
+{
+    handler_scope_t scope(*this);
+    if (ec) return;
+    unique_lock<mutex> lock(connectionMutex);
+    bBatchFlushScheduled = false;
+    if (bConnected) { flushBatch(); }
+}
+
+#if defined(USE_TLS)
+void ClientTls::onDisconnect()
+#else
+void ClientNoTls::onDisconnect()
+#endif
+{
+    // The next connection may reach another server, so nothing cached over this one is trusted. Bumping the
+    // generations also keeps answers to calls sent before the drop out of the cache.
+    {
+        unique_lock<mutex> lock(cacheMutex);
+        result_cache.clear();
+        for (auto& method: cached_methods) { method.second.generation++; }
+    }
+
+    unique_lock<mutex> lock(connectionMutex);
+
+    // Batched calls that never went out are failed or replayed along with the rest. The next connection may
+    // reach a different server, so array support is checked again.
+    batch_calls.clear();
+    batch_bytes = 0;
+    unconfirmed_batches.clear();
+    bBatchesConfirmed = false;
+
+    bool bReconnect = bAutoReconnect && !bStopping;
+    if (!bReconnect)
+    {
+        lock.unlock();
+        failAllCalls(JsonRpc::ConnectionClosedException());
+        return;
+    }
+
+    // Idempotent calls wait for the next connection, the rest fail once the lock is released
+    std::vector<std::pair<uint64_t, PendingCall>> dropped;
+    auto calls = pending_calls.takeAll();
+    for (auto& call: calls)
+    {
+        if (call.second.timer) { timer_wheel.cancel(call.second.timer); }
+        call.second.timer = 0;
+        if (!call.second.json.empty())  { replay_calls.push_back(call); }
+        else                            { dropped.push_back(call); }
+    }
+
+    // Only a connection that stayed up restarts the backoff, so a server that accepts and drops at once
+    // is still retried with growing delays
+    if (connected_since != std::chrono::steady_clock::time_point() && std::chrono::steady_clock::now() - connected_since >= std::chrono::milliseconds(RECONNECT_STABLE_TIME))
+    {
+        reconnect_attempts = 0;
+    }
+    connected_since = std::chrono::steady_clock::time_point();
+
+    // Full jitter: a uniform delay up to the capped exponential backoff
+    unsigned int ceiling = reconnect_max_delay;
+    if (reconnect_attempts < 32 && ((uint64_t)reconnect_min_delay << reconnect_attempts) < reconnect_max_delay)
+    {
+        ceiling = reconnect_min_delay << reconnect_attempts;
+    }
+    reconnect_attempts++;
+    std::uniform_int_distribution<unsigned int> distribution(0, ceiling);
+    unsigned int delay = distribution(jitter_rng);
+
+    reconnect_timer.reset(new boost::asio::deadline_timer(client.get_io_service(), boost::posix_time::milliseconds(delay)));
+    beginHandler();
+    reconnect_timer->async_wait(bind(&Client::onReconnectTimer, this, ::_1));
+    lock.unlock();
+
+    // User callbacks run outside the lock, since they may call back into the client
+    if (on_log && WS_LOG_ENABLED(info))
+    {
+        stringstream ss;
+        ss << "Reconnecting in " << delay << " ms.";
+        on_log(ss.str());
+    }
+    for (auto& call: dropped) { failCall(call.first, call.second.callbacks, JsonRpc::ConnectionClosedException()); }
+}
+
+#if defined(USE_TLS)
+void ClientTls::onReconnectTimer(const boost::system::error_code& ec)
+#else
+void ClientNoTls::onReconnectTimer(const boost::system::error_code& ec)
+#endif
+{
+    handler_scope_t scope(*this);
+    string error;
+    {
+        unique_lock<mutex> lock(connectionMutex);
+        if (bConnected) return;
+        if (ec || bStopping)
+        {
+            // Stopped while waiting: calls held for replay won't be sent
+            lock.unlock();
+            failAllCalls(JsonRpc::ConnectionClosedException());
+            return;
+        }
+        try
+        {
+            doConnect();
+            return;
+        }
+        catch (const exception& e)
+        {
+            error = e.what();
+        }
+    }
+    if (on_error) on_error(string("Reconnect failed - ") + error);
+    onDisconnect();
+}
+
+#if defined(USE_TLS)
+void ClientTls::resumeSession()
+#else
+void ClientNoTls::resumeSession()
+#endif
+{
+    // Subscriptions go out first so replayed calls see the subscribed state
+    std::vector<std::pair<string, Array>> requests;
+    {
+        unique_lock<mutex> lock(connectionMutex);
+        requests = subscriptions;
+    }
+    for (auto& request: requests) { send(JsonRpc::Request(request.first, request.second)); }
+
+    std::vector<std::pair<uint64_t, PendingCall>> calls;
+    calls.swap(replay_calls);
+    std::vector<std::pair<uint64_t, PendingCall>> dropped;     // stays empty while connected
+    unique_lock<mutex> lock(connectionMutex);
+    drainSendQueue(dropped);
+    for (auto& call: calls)
+    {
+        if (call.second.timeout) { call.second.timer = timer_wheel.schedule(call.second.timeout / CLIENT_TIMER_TICK_MS + 1, bind(&Client::onCallTimeout, this, call.first)); }
+        pending_calls.insert(call.first, call.second);
+        if (on_log && WS_LOG_ENABLED(debug)) on_log(string("Replaying command: ") + call.second.json);
+        doSend(call.first, call.second.json);
+    }
+}
+
+#if defined(USE_TLS)
+void ClientTls::enqueueSend(const queued_send_t& item)
+#else
+void ClientNoTls::enqueueSend(const queued_send_t& item)
+#endif
+{
+    send_queue.push(item);
+    if (!bDrainScheduled.exchange(true))
+    {
+        beginHandler();
+        client.get_io_service().post(bind(&Client::onSendQueue, this));
+    }
+}
+
+#if defined(USE_TLS)
+void ClientTls::onSendQueue()
+#else
+void ClientNoTls::onSendQueue()
+#endif
+{
+    handler_scope_t scope(*this);
+
+    // Cleared before draining so a push racing with the drain schedules another one
+    bDrainScheduled = false;
+
+    std::vector<std::pair<uint64_t, PendingCall>> dropped;
+    {
+        unique_lock<mutex> lock(connectionMutex);
+        drainSendQueue(dropped);
+    }
+    for (auto& call: dropped) { failCall(call.first, call.second.callbacks, JsonRpc::ConnectionClosedException()); }
+}
+
+#if defined(USE_TLS)
+void ClientTls::drainSendQueue(std::vector<std::pair<uint64_t, PendingCall>>& dropped)
+#else
+void ClientNoTls::drainSendQueue(std::vector<std::pair<uint64_t, PendingCall>>& dropped)
+#endif
+{
+    // Must be called on the io thread with connectionMutex held. Calls queued before a disconnect was
+    // noticed are held for replay or returned in dropped for the caller to fail outside the lock.
+    queued_send_t item;
+    while (send_queue.pop(item))
+    {
+        if (bConnected)
+        {
+            doSend(item.id, item.json);
+            continue;
+        }
+
+        PendingCall call;
+        if (!item.bTracked || !pending_calls.take(item.id, call)) continue;
+        if (call.timer) { timer_wheel.cancel(call.timer); }
+        call.timer = 0;
+        if (bAutoReconnect && !bStopping && !call.json.empty())   { replay_calls.push_back(make_pair(item.id, call)); }
+        else                                                        { dropped.push_back(make_pair(item.id, call)); }
+    }
+}
+
+#if defined(USE_TLS)
+void ClientTls::onCallTimeout(uint64_t id)
+#else
+void ClientNoTls::onCallTimeout(uint64_t id)
+#endif
+{
+    PendingCall call;
+    if (!pending_calls.take(id, call)) return;
+    if (on_log && WS_LOG_ENABLED(debug))
+    {
+        stringstream ss;
+        ss << "Call timed out for id " << id;
+        on_log(ss.str());
+    }
+    failCall(id, call.callbacks, JsonRpc::RequestTimeoutException());
+}
+
+#if defined(USE_TLS)
+void ClientTls::onWheelTick(const boost::system::error_code& ec)
+#else
+void ClientNoTls::onWheelTick(const boost::system::error_code& ec)
+#endif
+{
+    handler_scope_t scope(*this);
+    if (ec) return;
+    timer_wheel.advance(getTicks());
+    wheel_timer->expires_at(wheel_timer->expires_at() + boost::posix_time::milliseconds(CLIENT_TIMER_TICK_MS));
+    beginHandler();
+    wheel_timer->async_wait(bind(&Client::onWheelTick, this, ::_1));
+}
+
+#if defined(USE_TLS)
+void ClientTls::beginHandler()
+#else
+void ClientNoTls::beginHandler()
+#endif
+{
+    unique_lock<mutex> lock(handlerMutex);
+    pending_handlers++;
+}
+
+#if defined(USE_TLS)
+void ClientTls::endHandler()
+#else
+void ClientNoTls::endHandler()
+#endif
+{
+    // Notified under the lock so the destructor can't free the condition before notify_all() returns
+    unique_lock<mutex> lock(handlerMutex);
+    if (--pending_handlers == 0) { handlerCondition.notify_all(); }
+}
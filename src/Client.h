@@ -8,6 +8,13 @@
 #pragma once
 
 #include "JsonRpc.h"
+#include "JsonScanner.h"
+#include "IoServicePool.h"
+#include "LruCache.h"
+#include "MessagePool.h"
+#include "MpscQueue.h"
+#include "PendingCallTable.h"
+#include "TimerWheel.h"
 
 #if defined(USE_TLS)
     #include <websocketpp/config/asio_client.hpp>
@@ -17,10 +24,22 @@
 
 #include <websocketpp/client.hpp>
 
+#if defined(__cpp_impl_coroutine)
+    #include <coroutine>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
 #include <iostream>
 #include <sstream>
 #include <map>
 #include <mutex>
+#include <random>
+#include <set>
+#include <unordered_map>
 
 namespace WebSocket
 {
@@ -28,35 +47,68 @@ namespace WebSocket
 #if defined(USE_TLS)
     class ClientTls;
     typedef ClientTls Client;
-    typedef websocketpp::client<websocketpp::config::asio_tls_client>   client_t;
-    typedef websocketpp::config::asio_tls_client::message_type::ptr     message_ptr_t;
+    typedef websocketpp::client<PooledConfig<websocketpp::config::asio_tls_client>> client_t;
+    typedef client_t::message_ptr                                       message_ptr_t;
     typedef websocketpp::lib::shared_ptr<boost::asio::ssl::context>     context_ptr;
 
     typedef std::function<context_ptr(websocketpp::connection_hdl)>     tls_init_callback_t;
 #else
     class ClientNoTls;
     typedef ClientNoTls Client;
-    typedef websocketpp::client<websocketpp::config::asio_client>       client_t;
-    typedef websocketpp::config::asio_client::message_type::ptr         message_ptr_t;
+    typedef websocketpp::client<PooledConfig<websocketpp::config::asio_client>> client_t;
+    typedef client_t::message_ptr                                       message_ptr_t;
 #endif
 
 typedef client_t::connection_ptr                                    connection_ptr_t;
 typedef websocketpp::connection_hdl                                 connection_hdl_t;
 typedef websocketpp::lib::error_code                                error_code_t;
 
+const unsigned int CLIENT_TIMER_TICK_MS = 100;
+const unsigned int DEFAULT_RECONNECT_MIN_DELAY = 100;       // ms
+const unsigned int DEFAULT_RECONNECT_MAX_DELAY = 30000;     // ms
+const unsigned int RECONNECT_STABLE_TIME = 10000;           // ms a connection must stay up to restart the backoff
+const std::size_t DEFAULT_BATCH_MAX_CALLS = 100;
+const std::size_t DEFAULT_BATCH_MAX_BYTES = 64 * 1024;
+const std::size_t DEFAULT_CLIENT_CACHE_BUDGET = 16 * 1024 * 1024;     // bytes
+
+// How batched calls share a frame: as a JSON-RPC batch array, or as objects separated by newlines for
+// servers that read several per message
+enum BatchFormat { BATCH_ARRAY, BATCH_LINES };
+
 typedef std::function<void(const json_spirit::Value&)> ResultCallback;
 typedef std::function<void(const json_spirit::Value&)> ErrorCallback;
 typedef std::pair<ResultCallback, ErrorCallback> CallbackPair;
-typedef std::map<uint64_t, CallbackPair> CallbackMap;
 
 typedef std::function<void(const json_spirit::Value&)> EventHandler;
-typedef std::map<std::string, EventHandler> EventHandlerMap;
+typedef uint64_t EventHandlerId;
+typedef std::unordered_map<std::string, std::vector<std::pair<EventHandlerId, EventHandler>>> EventHandlerMap;
+
+// Last document and version received on each delta-encoded channel
+typedef std::pair<uint64_t, json_spirit::Value> DeltaDocument;
+typedef std::map<std::string, DeltaDocument> DeltaDocumentMap;
  
 typedef std::function<void()> OpenHandler;
 typedef std::function<void()> CloseHandler;
 typedef std::function<void(const std::string&)> LogHandler;
 typedef std::function<void(const std::string&)> ErrorHandler;
 
+// Thrown from futures returned by Client::call() when the call fails
+class RpcError : public std::runtime_error
+{
+public:
+    explicit RpcError(const json_spirit::Value& error);
+    virtual ~RpcError() throw() { }
+
+    const json_spirit::Value& error() const { return m_error; }
+
+    // Complete the promise behind a call() future with a result, or with an RpcError for an error
+    static void fulfill(std::shared_ptr<std::promise<json_spirit::Value>> result, const json_spirit::Value& value);
+    static void fail(std::shared_ptr<std::promise<json_spirit::Value>> result, const json_spirit::Value& error);
+
+private:
+    json_spirit::Value m_error;
+};
+
 #if defined(USE_TLS)
 class ClientTls
 #else
@@ -65,11 +117,17 @@ class ClientNoTls
 {
 public:
     // Constructor / Destructor
+    // Clients constructed with an io_service share it and are driven by whoever runs it (see IoServicePool).
+    // Destroying such a client closes its connection and waits until the io_service has run every handler
+    // bound to it, so the io_service must keep running meanwhile and the client must not be destroyed from
+    // one of its threads.
 #if defined(USE_TLS)
     ClientTls(const std::string& event_field, const std::string& data_field = "");
+    ClientTls(boost::asio::io_service& io_service, const std::string& event_field, const std::string& data_field = "");
     ~ClientTls();
 #else
     ClientNoTls(const std::string& event_field, const std::string& data_field = "");
+    ClientNoTls(boost::asio::io_service& io_service, const std::string& event_field, const std::string& data_field = "");
     ~ClientNoTls();
 #endif
 
@@ -79,22 +137,113 @@ public:
 
     void returnFullResponse(bool bReturnFullResponse) { this->bReturnFullResponse = bReturnFullResponse; }
 
-    // start() blocks until disconnection occurs.
+    // Calls with no reply after timeout ms fail with a RequestTimeoutException error. A request's own timeout
+    // takes precedence. 0 (the default) waits indefinitely. Pending calls fail when the connection closes.
+    void setCallTimeout(uint64_t timeout) { call_timeout = timeout; }
+
+    // After an unexpected disconnect or a failed attempt, reconnect after a random delay of up to
+    // minDelay * 2^attempts ms, capped at maxDelay. attempts counts from 0 again once a connection has stayed
+    // up for RECONNECT_STABLE_TIME ms. Subscriptions are sent on every connection, the first one included.
+    // In-flight calls to idempotent methods are sent again on the new connection instead of failing, with
+    // their timeouts restarted. Must be called before connect() or start().
+    void setAutoReconnect(bool bEnabled, unsigned int minDelay = DEFAULT_RECONNECT_MIN_DELAY, unsigned int maxDelay = DEFAULT_RECONNECT_MAX_DELAY);
+    // Adding a subscription already added does nothing. Removing one doesn't unsubscribe the connection.
+    void addSubscription(const std::string& method, const json_spirit::Array& params = json_spirit::Array());
+    void removeSubscription(const std::string& method, const json_spirit::Array& params = json_spirit::Array());
+    void setIdempotentMethod(const std::string& method, bool bIdempotent = true);
+
+    // Calls sent within window ms are written together as one frame, flushed early once maxCalls calls or
+    // maxBytes bytes are waiting. 0 flushes at the end of the current event loop pass and -1 (the default)
+    // writes each call immediately. Batch responses (arrays) are split back to the calls' callbacks. Until the
+    // server has answered an array, an error without an id fails the calls of the oldest array not yet
+    // rejected, as servers that can't read batches answer each array that way.
+    void setBatching(int window, std::size_t maxCalls = DEFAULT_BATCH_MAX_CALLS, std::size_t maxBytes = DEFAULT_BATCH_MAX_BYTES, BatchFormat format = BATCH_ARRAY);
+
+    // Connections receiving a larger message are closed with status 1009 (message too big)
+    void setMaxMessageSize(std::size_t size) { client.set_max_message_size(size); }
+
+    // start() blocks until disconnection occurs. Clients on an external io_service use connect() instead,
+    // which returns immediately; on_open is called once the connection is up.
+    // on_log only receives messages at or above log::setLevel() (see Log.h); per-message traces are built only
+    // when trace is enabled. Wrap slow log output in a log::AsyncSink.
     void start(const std::string& serverUrl, OpenHandler on_open = nullptr, CloseHandler on_close = nullptr, LogHandler on_log = nullptr, ErrorHandler on_error = nullptr);
+    void connect(const std::string& serverUrl, OpenHandler on_open = nullptr, CloseHandler on_close = nullptr, LogHandler on_log = nullptr, ErrorHandler on_error = nullptr);
     void stop();
 
+    bool isConnected() const { return bConnected; }
+
     // Send formatted commands
     void send(const json_spirit::Object& cmd, ResultCallback resultCallback = nullptr, ErrorCallback errorCallback = nullptr);
     void send(const JsonRpc::Request& request, ResultCallback resultCallback = nullptr, ErrorCallback errorCallback = nullptr);
 
-    // Subscribe to events
+    // Results of a cached method are kept for ttl ms, keyed by method and canonical params. Hits are answered
+    // from the io thread without a request, and identical calls made while one is in flight share its reply.
+    // Events of any type in invalidatingEvents drop the method's entries, as does invalidateCache(), which
+    // may be called from event handlers. The whole cache is dropped when the connection does. Least recently
+    // used entries are evicted once the cache exceeds its budget, in estimated serialized bytes. Only calls
+    // sent as a JsonRpc::Request with a callback are cached. Must be called before start().
+    void setCachedMethod(const std::string& method, unsigned int ttl, const std::vector<std::string>& invalidatingEvents = std::vector<std::string>());
+    void setResultCacheBudget(std::size_t budget) { result_cache.setBudget(budget); }
+    void invalidateCache(const std::string& method);
+
+    // Futures completed from the io thread when the reply arrives. Errors, timeouts and disconnects surface as
+    // RpcError from get(). Don't wait on them from a handler running on the io thread.
+    std::future<json_spirit::Value> call(const JsonRpc::Request& request);
+    std::future<json_spirit::Value> call(const std::string& method, const json_spirit::Array& params = json_spirit::Array());
+
+    // Issues every request at once and completes with their results in order, or with the first error
+    // once all of them have finished
+    std::future<json_spirit::Array> callAll(const std::vector<JsonRpc::Request>& requests);
+
+#if defined(__cpp_impl_coroutine)
+    // co_await client.callAsync(request) resumes on the io thread with the result or throws RpcError
+    class CallAwaitable
+    {
+    public:
+        CallAwaitable(Client& client, const JsonRpc::Request& request) : m_client(client), m_request(request), m_bError(false) { }
+
+        bool await_ready() const { return false; }
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            m_client.send(m_request,
+                [this, handle](const json_spirit::Value& result) { m_value = result; handle.resume(); },
+                [this, handle](const json_spirit::Value& error) { m_value = error; m_bError = true; handle.resume(); });
+        }
+        json_spirit::Value await_resume()
+        {
+            if (m_bError) throw RpcError(m_value);
+            return m_value;
+        }
+
+    private:
+        Client& m_client;
+        JsonRpc::Request m_request;
+        json_spirit::Value m_value;
+        bool m_bError;
+    };
+    CallAwaitable callAsync(const JsonRpc::Request& request) { return CallAwaitable(*this, request); }
+#endif
+
+    // Subscribe to events. on() replaces the handlers of a type with handler, addHandler() adds one to be
+    // called after those already there and returns an id for removeHandler(), and off() removes them all.
     Client& on(const std::string& eventType, EventHandler handler);
+    EventHandlerId addHandler(const std::string& eventType, EventHandler handler);
+    Client& removeHandler(const std::string& eventType, EventHandlerId id);
+    Client& off(const std::string& eventType);
+
+    // Runs event handlers on count worker threads instead of the io thread, so a slow handler doesn't hold up
+    // the connection. Events of one type always go to the same worker and are handled in order. on_error
+    // reports handler exceptions from the workers. 0 (the default) runs handlers inline. Must be called
+    // before start().
+    void setEventWorkers(std::size_t count);
 
 #if defined(USE_TLS)
     void setTlsInitCallback(tls_init_callback_t callback) { on_tls_init = callback; }
 #endif
 
 protected:
+    void init(const std::string& event_field, const std::string& data_field, boost::asio::io_service* io_service);
+
     // Connection handlers
     void onOpen(connection_hdl_t hdl);
     void onClose(connection_hdl_t hdl);
@@ -104,18 +253,70 @@ protected:
     context_ptr onTlsInit(connection_hdl_t hdl);
 #endif
 
+    // Handles one response or event object, returning false if it is neither
+    bool onServerObject(const JsonRpc::JsonScanner& scanner, const JsonRpc::JsonScanner::slice_t& slice);
+    void runEventHandlers(const EventHandlerMap& handlers, const std::string& eventType, const json_spirit::Value& data);
+    void onEventWork(std::shared_ptr<const EventHandlerMap> handlers, const std::string& eventType, const json_spirit::Value& data);
+
     // Results and errors from commands
     void onResult(const json_spirit::Value& result, uint64_t id);
     void onError(const json_spirit::Value& error, uint64_t id); 
 
+    // Applies a delta channel message, returning false if a resync was requested instead
+    bool resolveDelta(const json_spirit::Object& delta, json_spirit::Value& doc);
+
+    // Pending call bookkeeping. Timeouts fire on the io thread like replies do.
+    void addPendingCall(uint64_t id, const CallbackPair& callbacks, uint64_t timeout, const std::string& method, const std::string& json);
+    void failCall(uint64_t id, const CallbackPair& callbacks, const stdutils::custom_error& e);
+    void failAllCalls(const stdutils::custom_error& e);
+    void onCallTimeout(uint64_t id);
+    void onWheelTick(const boost::system::error_code& ec);
+    void doConnect();
+    void onDisconnect();
+    void onReconnectTimer(const boost::system::error_code& ec);
+    void resumeSession();
+
+    // Sends go through a lock-free queue drained on the io thread
+    struct queued_send_t
+    {
+        uint64_t                id;
+        bool                    bTracked;       // has a pending call to fail if the frame is never sent
+        std::string             json;
+    };
+    void enqueueSend(const queued_send_t& item);
+    void onSendQueue();
+    void doSend(uint64_t id, const std::string& json);
+    void flushBatch();
+    void onBatchTimer(const boost::system::error_code& ec);
+    void doSendRequest(const JsonRpc::Request& request, ResultCallback resultCallback, ErrorCallback errorCallback);
+
+    // Counts handlers bound to this client that the io_service has yet to run: timer waits, posts and the
+    // connection, which ends with onClose or onFail. Call beginHandler() before scheduling one, and open a
+    // handler_scope_t at the top of the handler.
+    void beginHandler();
+    void endHandler();
+    struct handler_scope_t
+    {
+        explicit handler_scope_t(Client& client) : client(client) { }
+        ~handler_scope_t() { client.endHandler(); }
+        Client& client;
+    };
+
+    uint64_t getTicks() const { return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - epoch).count() / CLIENT_TIMER_TICK_MS; }
+
 private:
     // WebSocket connection to CoinSocket server
     client_t            client;
     std::string         serverUrl;
     connection_ptr_t    pConnection;
-    bool                bConnected;
+    std::atomic<bool>   bConnected;
+    bool                bExternalIoService;
     std::mutex          connectionMutex;
 
+    unsigned int        pending_handlers;       // guarded by handlerMutex
+    std::mutex          handlerMutex;
+    std::condition_variable handlerCondition;
+
     OpenHandler         on_open;
     CloseHandler        on_close;
     LogHandler          on_log;
@@ -127,16 +328,83 @@ private:
 
     std::string         event_field;
     std::string         data_field;
-    EventHandlerMap     event_handler_map;
+    std::shared_ptr<const EventHandlerMap> event_handlers;     // replaced, never modified, under handlerMapMutex
     std::mutex          handlerMapMutex;
+    EventHandlerId      next_handler_id;        // under handlerMapMutex
+    DeltaDocumentMap    delta_documents;        // only accessed from the io thread
 
     std::string         result_field;           // default: "result"
     std::string         error_field;            // default: "error"
     std::string         id_field;               // default: "id"
 
     bool                bReturnFullResponse;    // default: false
-    uint64_t            sequence;
-    CallbackMap         callback_map;
+    std::atomic<uint64_t> sequence;
+
+    struct PendingCall
+    {
+        PendingCall() : timer(0), timeout(0) { }
+        CallbackPair            callbacks;
+        TimerWheel::timer_id_t  timer;
+        uint64_t                timeout;
+        std::string             json;           // kept for idempotent methods so the call can be replayed
+    };
+    void drainSendQueue(std::vector<std::pair<uint64_t, PendingCall>>& dropped);
+    PendingCallTable<PendingCall>   pending_calls;
+    TimerWheel                      timer_wheel;
+    std::shared_ptr<boost::asio::deadline_timer> wheel_timer;
+    std::chrono::steady_clock::time_point epoch;
+    uint64_t            call_timeout;           // default: 0
+
+    bool                bAutoReconnect;         // default: false
+    bool                bStopping;              // stop() was called, don't reconnect
+    unsigned int        reconnect_min_delay;
+    unsigned int        reconnect_max_delay;
+    unsigned int        reconnect_attempts;
+    std::chrono::steady_clock::time_point connected_since;      // when the connection opened, zero if it isn't
+    std::shared_ptr<boost::asio::deadline_timer> reconnect_timer;
+    std::mt19937        jitter_rng;
+    std::vector<std::pair<std::string, json_spirit::Array>> subscriptions;
+    std::set<std::string> idempotent_methods;
+    std::vector<std::pair<uint64_t, PendingCall>> replay_calls;     // only accessed from the io thread
+
+    int                 batch_window;           // default: -1 (off)
+    std::size_t         batch_max_calls;
+    std::size_t         batch_max_bytes;
+    BatchFormat         batch_format;           // default: BATCH_ARRAY
+    std::vector<std::pair<uint64_t, std::string>> batch_calls;     // guarded by connectionMutex
+    std::size_t         batch_bytes;
+    bool                bBatchFlushScheduled;
+    std::shared_ptr<boost::asio::deadline_timer> batch_timer;
+    std::atomic<bool>   bBatchesConfirmed;      // the server has answered an array on this connection
+    std::deque<std::vector<uint64_t>> unconfirmed_batches;     // calls of each array sent before that, guarded by connectionMutex
+
+    MpscQueue<queued_send_t> send_queue;
+    std::atomic<bool>   bDrainScheduled;
+
+    struct cached_method_t
+    {
+        cached_method_t() : ttl(0), generation(0) { }
+        unsigned int ttl;
+        uint64_t generation;    // bumped on invalidation and disconnect so results requested before are not stored
+    };
+    struct cache_flight_t
+    {
+        std::string method;
+        uint64_t generation;    // cache generation of the method when the call was sent
+        std::vector<CallbackPair> waiters;
+    };
+    bool sendCached(const JsonRpc::Request& request, ResultCallback resultCallback, ErrorCallback errorCallback);
+    void onCachedResult(const std::string& key, std::shared_ptr<cache_flight_t> flight, const json_spirit::Value& result);
+    void onCachedError(const std::string& key, std::shared_ptr<cache_flight_t> flight, const json_spirit::Value& error);
+
+    std::map<std::string, cached_method_t> cached_methods;
+    std::multimap<std::string, std::string> event_invalidations;   // event type -> cached method
+    std::map<std::string, std::shared_ptr<cache_flight_t>> cache_flights;
+    LruCache<json_spirit::Value> result_cache;
+    std::mutex          cacheMutex;
+
+    // Declared last so the workers are joined before anything their handlers use is destroyed
+    std::unique_ptr<IoServicePool> event_workers;
 };
 
 } 
@@ -0,0 +1,343 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// ClientPool.cpp
+//
+// Copyright (c) 2014 Eric Lombrozo, all rights reserved
+//
+
+#include "ClientPool.h"
+
+using websocketpp::lib::placeholders::_1;
+using websocketpp::lib::bind;
+
+using namespace std;
+using namespace json_spirit;
+using namespace WebSocket;
+
+/// Public Methods
+#if defined(USE_TLS)
+ClientPoolTls::ClientPoolTls(const vector<string>& serverUrls, size_t connectionsPerUrl, const string& event_field, const string& data_field, size_t threads)
+#else
+ClientPoolNoTls::ClientPoolNoTls(const vector<string>& serverUrls, size_t connectionsPerUrl, const string& event_field, const string& data_field, size_t threads)
+#endif
+    : m_ioServicePool(threads ? threads : boost::thread::hardware_concurrency()), m_next(0), m_bStopping(false)
+{
+    if (serverUrls.empty() || connectionsPerUrl == 0) throw runtime_error("Client pool needs at least one connection.");
+
+    // Interleave urls so consecutive members, and the io threads they land on, spread across servers
+    for (size_t i = 0; i < connectionsPerUrl; i++)
+    {
+        for (auto& url: serverUrls)
+        {
+            member_ptr member(new member_t(m_ioServicePool.next(), url, event_field, data_field));
+            member->client.setAutoReconnect(true);
+            m_members.push_back(member);
+        }
+    }
+}
+
+#if defined(USE_TLS)
+ClientPoolTls::~ClientPoolTls()
+#else
+ClientPoolNoTls::~ClientPoolNoTls()
+#endif
+{
+    // Members wait for their connections to close and their handlers to finish, which needs the io threads,
+    // so they go before the pool stops. Closing them all first lets the handshakes run in parallel.
+    stop();
+    {
+        unique_lock<mutex> lock(m_topicMutex);
+        m_topics.clear();
+    }
+    m_members.clear();
+    m_ioServicePool.stop();
+}
+
+#if defined(USE_TLS)
+void ClientPoolTls::setCallTimeout(uint64_t timeout)
+#else
+void ClientPoolNoTls::setCallTimeout(uint64_t timeout)
+#endif
+{
+    for (auto& member: m_members) { member->client.setCallTimeout(timeout); }
+}
+
+#if defined(USE_TLS)
+void ClientPoolTls::setIdempotentMethod(const string& method, bool bIdempotent)
+#else
+void ClientPoolNoTls::setIdempotentMethod(const string& method, bool bIdempotent)
+#endif
+{
+    for (auto& member: m_members) { member->client.setIdempotentMethod(method, bIdempotent); }
+}
+
+#if defined(USE_TLS)
+void ClientPoolTls::setReconnectDelays(unsigned int minDelay, unsigned int maxDelay)
+#else
+void ClientPoolNoTls::setReconnectDelays(unsigned int minDelay, unsigned int maxDelay)
+#endif
+{
+    for (auto& member: m_members) { member->client.setAutoReconnect(true, minDelay, maxDelay); }
+}
+
+#if defined(USE_TLS)
+void ClientPoolTls::setTlsInitCallback(tls_init_callback_t callback)
+{
+    for (auto& member: m_members) { member->client.setTlsInitCallback(callback); }
+}
+#endif
+
+#if defined(USE_TLS)
+void ClientPoolTls::start(LogHandler on_log, ErrorHandler on_error)
+#else
+void ClientPoolNoTls::start(LogHandler on_log, ErrorHandler on_error)
+#endif
+{
+    m_on_log = on_log;
+    m_on_error = on_error;
+    {
+        unique_lock<mutex> lock(m_topicMutex);
+        m_bStopping = false;
+    }
+    for (auto& member: m_members)
+    {
+        LogHandler memberLog;
+        if (on_log) { memberLog = bind(&ClientPool::onMemberLog, this, member.get(), ::_1); }
+        member->client.connect(member->url, bind(&ClientPool::onMemberOpen, this, member.get()), bind(&ClientPool::onMemberClose, this, member.get()), memberLog, bind(&ClientPool::onMemberError, this, member.get(), ::_1));
+    }
+}
+
+#if defined(USE_TLS)
+void ClientPoolTls::stop()
+#else
+void ClientPoolNoTls::stop()
+#endif
+{
+    {
+        unique_lock<mutex> lock(m_topicMutex);
+        m_bStopping = true;
+    }
+    for (auto& member: m_members) { member->client.stop(); }
+}
+
+#if defined(USE_TLS)
+size_t ClientPoolTls::getConnectedCount() const
+#else
+size_t ClientPoolNoTls::getConnectedCount() const
+#endif
+{
+    size_t count = 0;
+    for (auto& member: m_members)
+    {
+        if (member->client.isConnected()) { count++; }
+    }
+    return count;
+}
+
+#if defined(USE_TLS)
+void ClientPoolTls::send(const JsonRpc::Request& request, ResultCallback resultCallback, ErrorCallback errorCallback)
+#else
+void ClientPoolNoTls::send(const JsonRpc::Request& request, ResultCallback resultCallback, ErrorCallback errorCallback)
+#endif
+{
+    // A member can drop between selection and send, so try the next best a few times
+    for (size_t attempt = 0; attempt < m_members.size(); attempt++)
+    {
+        member_ptr member = selectMember();
+        if (!member) break;
+
+        member->outstanding++;
+        try
+        {
+            member->client.send(request, bind(&ClientPool::onCallResult, this, member.get(), resultCallback, ::_1), bind(&ClientPool::onCallError, this, member.get(), errorCallback, ::_1));
+            return;
+        }
+        catch (const runtime_error&)
+        {
+            member->outstanding--;
+        }
+    }
+    throw runtime_error("Not connected.");
+}
+
+#if defined(USE_TLS)
+future<Value> ClientPoolTls::call(const JsonRpc::Request& request)
+#else
+future<Value> ClientPoolNoTls::call(const JsonRpc::Request& request)
+#endif
+{
+    std::shared_ptr<promise<Value>> result(new promise<Value>());
+    future<Value> f = result->get_future();
+    send(request, bind(&RpcError::fulfill, result, ::_1), bind(&RpcError::fail, result, ::_1));
+    return f;
+}
+
+#if defined(USE_TLS)
+void ClientPoolTls::subscribe(const string& eventType, const JsonRpc::Request& request, EventHandler handler)
+#else
+void ClientPoolNoTls::subscribe(const string& eventType, const JsonRpc::Request& request, EventHandler handler)
+#endif
+{
+    // Held throughout so the topic can't move to another member halfway
+    unique_lock<mutex> lock(m_topicMutex);
+    topic_t& topic = m_topics[eventType];
+    if (!topic.member)
+    {
+        topic.member = selectMember();
+        if (!topic.member) { topic.member = m_members[hash<string>()(eventType) % m_members.size()]; }
+    }
+    topic.handlers.push_back(handler);
+    topic.handlerIds.push_back(topic.member->client.addHandler(eventType, handler));
+
+    std::pair<string, Array> subscription(request.getMethod(), request.getParams());
+    if (std::find(topic.requests.begin(), topic.requests.end(), subscription) != topic.requests.end()) return;
+    topic.requests.push_back(subscription);
+    topic.member->client.addSubscription(subscription.first, subscription.second);
+    if (!topic.member->client.isConnected()) return;
+
+    try
+    {
+        topic.member->client.send(request);
+    }
+    catch (const runtime_error&)
+    {
+        // Dropped meanwhile - the subscription goes out when the member reconnects
+    }
+}
+
+#if defined(USE_TLS)
+void ClientPoolTls::on(const string& eventType, EventHandler handler)
+#else
+void ClientPoolNoTls::on(const string& eventType, EventHandler handler)
+#endif
+{
+    for (auto& member: m_members) { member->client.on(eventType, handler); }
+}
+
+/// Private Methods
+#if defined(USE_TLS)
+ClientPoolTls::member_ptr ClientPoolTls::selectMember()
+#else
+ClientPoolNoTls::member_ptr ClientPoolNoTls::selectMember()
+#endif
+{
+    member_ptr best;
+    int bestOutstanding = 0;
+    size_t start = m_next++;
+    for (size_t i = 0; i < m_members.size(); i++)
+    {
+        const member_ptr& member = m_members[(start + i) % m_members.size()];
+        if (!member->client.isConnected()) continue;
+
+        int outstanding = member->outstanding.load(memory_order_relaxed);
+        if (!best || outstanding < bestOutstanding)
+        {
+            best = member;
+            bestOutstanding = outstanding;
+        }
+    }
+    return best;
+}
+
+#if defined(USE_TLS)
+void ClientPoolTls::moveTopic(const string& eventType, topic_t& topic, const member_ptr& member)
+#else
+void ClientPoolNoTls::moveTopic(const string& eventType, topic_t& topic, const member_ptr& member)
+#endif
+{
+    for (auto id: topic.handlerIds) { topic.member->client.removeHandler(eventType, id); }
+    for (auto& request: topic.requests) { topic.member->client.removeSubscription(request.first, request.second); }
+
+    topic.member = member;
+    topic.handlerIds.clear();
+    for (auto& handler: topic.handlers) { topic.handlerIds.push_back(member->client.addHandler(eventType, handler)); }
+    for (auto& request: topic.requests)
+    {
+        member->client.addSubscription(request.first, request.second);
+        if (!member->client.isConnected()) continue;
+        try
+        {
+            member->client.send(JsonRpc::Request(request.first, request.second));
+        }
+        catch (const runtime_error&)
+        {
+            // Dropped meanwhile - sent when it reconnects, or moved on again
+        }
+    }
+}
+
+#if defined(USE_TLS)
+void ClientPoolTls::onMemberOpen(member_t* member)
+#else
+void ClientPoolNoTls::onMemberOpen(member_t* member)
+#endif
+{
+    // Topics left on members that are down, because none was connected when they dropped, come here
+    unique_lock<mutex> lock(m_topicMutex);
+    if (m_bStopping) return;
+
+    member_ptr opened;
+    for (auto& candidate: m_members)
+    {
+        if (candidate.get() == member) { opened = candidate; }
+    }
+    for (auto& topic: m_topics)
+    {
+        if (topic.second.member != opened && !topic.second.member->client.isConnected()) { moveTopic(topic.first, topic.second, opened); }
+    }
+}
+
+#if defined(USE_TLS)
+void ClientPoolTls::onMemberClose(member_t* member)
+#else
+void ClientPoolNoTls::onMemberClose(member_t* member)
+#endif
+{
+    unique_lock<mutex> lock(m_topicMutex);
+    if (m_bStopping) return;
+
+    member_ptr replacement = selectMember();
+    if (!replacement) return;
+    for (auto& topic: m_topics)
+    {
+        if (topic.second.member.get() == member) { moveTopic(topic.first, topic.second, replacement); }
+    }
+}
+
+#if defined(USE_TLS)
+void ClientPoolTls::onCallResult(member_t* member, ResultCallback callback, const Value& result)
+#else
+void ClientPoolNoTls::onCallResult(member_t* member, ResultCallback callback, const Value& result)
+#endif
+{
+    member->outstanding--;
+    if (callback) callback(result);
+}
+
+#if defined(USE_TLS)
+void ClientPoolTls::onCallError(member_t* member, ErrorCallback callback, const Value& error)
+#else
+void ClientPoolNoTls::onCallError(member_t* member, ErrorCallback callback, const Value& error)
+#endif
+{
+    member->outstanding--;
+    if (callback) callback(error);
+}
+
+#if defined(USE_TLS)
+void ClientPoolTls::onMemberLog(member_t* member, const string& message)
+#else
+void ClientPoolNoTls::onMemberLog(member_t* member, const string& message)
+#endif
+{
+    if (m_on_log) m_on_log(member->url + ": " + message);
+}
+
+#if defined(USE_TLS)
+void ClientPoolTls::onMemberError(member_t* member, const string& message)
+#else
+void ClientPoolNoTls::onMemberError(member_t* member, const string& message)
+#endif
+{
+    if (m_on_error) m_on_error(member->url + ": " + message);
+}
@@ -0,0 +1,123 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// ClientPool.h
+//
+// Copyright (c) 2014 Eric Lombrozo, all rights reserved
+//
+
+#pragma once
+
+#include "Client.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace WebSocket
+{
+
+#if defined(USE_TLS)
+    class ClientPoolTls;
+    typedef ClientPoolTls ClientPool;
+#else
+    class ClientPoolNoTls;
+    typedef ClientPoolNoTls ClientPool;
+#endif
+
+// Several connections over one or more server urls, run by a shared IoServicePool. Each call goes to the
+// connected member with the fewest outstanding calls. Members whose connection closes or fails are left out
+// until they reconnect. Subscriptions to a topic are pinned to one member. When it drops they move to a
+// connected member, or to the next member to connect if none is.
+#if defined(USE_TLS)
+class ClientPoolTls
+#else
+class ClientPoolNoTls
+#endif
+{
+public:
+    // connectionsPerUrl connections are opened to each url. threads = 0 uses one io thread per core.
+#if defined(USE_TLS)
+    ClientPoolTls(const std::vector<std::string>& serverUrls, std::size_t connectionsPerUrl, const std::string& event_field, const std::string& data_field = "", std::size_t threads = 0);
+    ~ClientPoolTls();
+#else
+    ClientPoolNoTls(const std::vector<std::string>& serverUrls, std::size_t connectionsPerUrl, const std::string& event_field, const std::string& data_field = "", std::size_t threads = 0);
+    ~ClientPoolNoTls();
+#endif
+
+    // Applied to every member. Must be called before start().
+    void setCallTimeout(uint64_t timeout);
+    void setIdempotentMethod(const std::string& method, bool bIdempotent = true);
+    void setReconnectDelays(unsigned int minDelay, unsigned int maxDelay);
+#if defined(USE_TLS)
+    void setTlsInitCallback(tls_init_callback_t callback);
+#endif
+
+    // Connects every member and returns immediately. Log and error messages are prefixed with the member's url.
+    // Destroying the pool closes the connections and fails their pending calls before the io threads stop.
+    void start(LogHandler on_log = nullptr, ErrorHandler on_error = nullptr);
+    void stop();
+
+    std::size_t size() const { return m_members.size(); }
+    std::size_t getConnectedCount() const;
+
+    // Throw std::runtime_error if no member is connected
+    void send(const JsonRpc::Request& request, ResultCallback resultCallback = nullptr, ErrorCallback errorCallback = nullptr);
+    std::future<json_spirit::Value> call(const JsonRpc::Request& request);
+
+    // Sends request on the member owning eventType, choosing one on first use, and has it delivered events
+    // of that type to handler, along with any handlers subscribed before. The request is sent again whenever
+    // that member reconnects, and once on the member taking the topic over. Subscribing again with the same
+    // request only adds the handler.
+    void subscribe(const std::string& eventType, const JsonRpc::Request& request, EventHandler handler);
+
+    // Replaces the handlers of a type on every member, for events that need no subscription
+    void on(const std::string& eventType, EventHandler handler);
+
+private:
+    struct member_t
+    {
+        member_t(boost::asio::io_service& io_service, const std::string& url, const std::string& event_field, const std::string& data_field)
+            : client(io_service, event_field, data_field), url(url), outstanding(0) { }
+
+        Client client;
+        std::string url;
+        std::atomic<int> outstanding;   // calls sent and not yet answered
+    };
+    typedef std::shared_ptr<member_t> member_ptr;
+
+    // Connected member with the fewest outstanding calls, or null if none is connected
+    member_ptr selectMember();
+
+    // Subscriptions and handlers of one event type, and the member they are pinned to. handlerIds are the
+    // ids the member gave handlers, so moving the topic leaves handlers installed with on() alone.
+    struct topic_t
+    {
+        member_ptr member;
+        std::vector<std::pair<std::string, json_spirit::Array>> requests;
+        std::vector<EventHandler> handlers;
+        std::vector<EventHandlerId> handlerIds;
+    };
+
+    // Must be called with m_topicMutex held
+    void moveTopic(const std::string& eventType, topic_t& topic, const member_ptr& member);
+
+    void onMemberOpen(member_t* member);
+    void onMemberClose(member_t* member);
+    void onCallResult(member_t* member, ResultCallback callback, const json_spirit::Value& result);
+    void onCallError(member_t* member, ErrorCallback callback, const json_spirit::Value& error);
+    void onMemberLog(member_t* member, const std::string& message);
+    void onMemberError(member_t* member, const std::string& message);
+
+    IoServicePool               m_ioServicePool;
+    std::vector<member_ptr>     m_members;
+    std::atomic<std::size_t>    m_next;             // rotates where the least-loaded scan starts, to spread ties
+
+    LogHandler                  m_on_log;
+    ErrorHandler                m_on_error;
+
+    std::map<std::string, topic_t> m_topics;
+    std::mutex                  m_topicMutex;
+    bool                        m_bStopping;        // guarded by m_topicMutex, topics stay put while stopping
+};
+
+}
@@ -0,0 +1,61 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// IoServicePool.h
+//
+// Copyright (c) 2014 Eric Lombrozo
+//
+// All Rights Reserved.
+
+#pragma once
+
+#include <boost/asio/io_service.hpp>
+#include <boost/thread.hpp>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace WebSocket
+{
+
+// A fixed set of io_services, each run by its own thread. Clients handed out round-robin by next() share
+// the threads, and every handler of one client runs on the same thread.
+class IoServicePool
+{
+public:
+    explicit IoServicePool(std::size_t size = boost::thread::hardware_concurrency()) : m_next(0)
+    {
+        if (size == 0) { size = 1; }
+        for (std::size_t i = 0; i < size; i++)
+        {
+            std::shared_ptr<boost::asio::io_service> io_service(new boost::asio::io_service());
+            m_works.push_back(std::shared_ptr<boost::asio::io_service::work>(new boost::asio::io_service::work(*io_service)));
+            m_ioServices.push_back(io_service);
+            m_threads.create_thread(boost::bind(&IoServicePool::run, io_service));
+        }
+    }
+
+    ~IoServicePool() { stop(); }
+
+    // Stops the io_services and joins the threads. Stop the clients first so their connections close cleanly.
+    void stop()
+    {
+        m_works.clear();
+        for (auto& io_service: m_ioServices) { io_service->stop(); }
+        m_threads.join_all();
+    }
+
+    boost::asio::io_service& next() { return *m_ioServices[m_next++ % m_ioServices.size()]; }
+    boost::asio::io_service& get(std::size_t key) { return *m_ioServices[key % m_ioServices.size()]; }   // same key, same thread
+    std::size_t size() const { return m_ioServices.size(); }
+
+private:
+    static void run(std::shared_ptr<boost::asio::io_service> io_service) { io_service->run(); }
+
+    std::vector<std::shared_ptr<boost::asio::io_service>> m_ioServices;
+    std::vector<std::shared_ptr<boost::asio::io_service::work>> m_works;
+    boost::thread_group m_threads;
+    std::atomic<std::size_t> m_next;
+};
+
+}
@@ -0,0 +1,125 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// IpFilter.cpp
+//
+// Copyright (c) 2014 Eric Lombrozo
+//
+// All Rights Reserved.
+
+#include "IpFilter.h"
+
+#include <stdexcept>
+
+#include <stdlib.h>
+
+using namespace WebSocket;
+
+namespace {
+
+const unsigned char* v4MappedBytes(const boost::asio::ip::address_v6::bytes_type& bytes)
+{
+    for (int i = 0; i < 10; i++) { if (bytes[i] != 0) return NULL; }
+    if (bytes[10] != 0xff || bytes[11] != 0xff) return NULL;
+    return &bytes[12];
+}
+
+}
+
+IpFilter::IpFilter(const std::string& allow, const std::string& deny)
+    : m_v4(1), m_v6(1)
+{
+    addList(allow, ALLOW);
+    addList(deny, DENY);
+}
+
+bool IpFilter::isAllowed(const boost::asio::ip::address& address) const
+{
+    if (address.is_v4())
+    {
+        boost::asio::ip::address_v4::bytes_type bytes = address.to_v4().to_bytes();
+        return match(m_v4, &bytes[0], 32);
+    }
+
+    boost::asio::ip::address_v6::bytes_type bytes = address.to_v6().to_bytes();
+    const unsigned char* v4 = v4MappedBytes(bytes);
+    if (v4) return match(m_v4, v4, 32);
+    return match(m_v6, &bytes[0], 128);
+}
+
+void IpFilter::addList(const std::string& list, rule_t rule)
+{
+    const char* separators = ", \t\r\n";
+    std::size_t start = list.find_first_not_of(separators);
+    while (start != std::string::npos)
+    {
+        std::size_t end = list.find_first_of(separators, start);
+        std::string entry = list.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        start = list.find_first_not_of(separators, end);
+
+        std::string addressStr = entry;
+        long prefixLen = -1;
+        std::size_t slash = entry.find('/');
+        if (slash != std::string::npos)
+        {
+            addressStr = entry.substr(0, slash);
+            std::string lenStr = entry.substr(slash + 1);
+            char* lenEnd;
+            prefixLen = strtol(lenStr.c_str(), &lenEnd, 10);
+            if (lenStr.empty() || *lenEnd != '\0' || prefixLen < 0) throw std::invalid_argument("Invalid CIDR block: " + entry);
+        }
+        if (addressStr.size() > 2 && addressStr[0] == '[' && addressStr[addressStr.size() - 1] == ']')
+        {
+            addressStr = addressStr.substr(1, addressStr.size() - 2);
+        }
+
+        boost::system::error_code ec;
+        boost::asio::ip::address address = boost::asio::ip::address::from_string(addressStr, ec);
+        if (ec) throw std::invalid_argument("Invalid CIDR block: " + entry);
+
+        if (address.is_v4())
+        {
+            if (prefixLen < 0) { prefixLen = 32; }
+            if (prefixLen > 32) throw std::invalid_argument("Invalid CIDR block: " + entry);
+            boost::asio::ip::address_v4::bytes_type bytes = address.to_v4().to_bytes();
+            insert(m_v4, &bytes[0], prefixLen, rule);
+        }
+        else
+        {
+            if (prefixLen < 0) { prefixLen = 128; }
+            if (prefixLen > 128) throw std::invalid_argument("Invalid CIDR block: " + entry);
+            boost::asio::ip::address_v6::bytes_type bytes = address.to_v6().to_bytes();
+            const unsigned char* v4 = v4MappedBytes(bytes);
+            if (v4 && prefixLen >= 96)  { insert(m_v4, v4, prefixLen - 96, rule); }
+            else                        { insert(m_v6, &bytes[0], prefixLen, rule); }
+        }
+    }
+}
+
+void IpFilter::insert(trie_t& trie, const unsigned char* bytes, unsigned int prefixLen, rule_t rule)
+{
+    uint32_t node = 0;
+    for (unsigned int i = 0; i < prefixLen; i++)
+    {
+        int bit = (bytes[i / 8] >> (7 - i % 8)) & 1;
+        if (!trie[node].children[bit])
+        {
+            trie.push_back(node_t());
+            trie[node].children[bit] = trie.size() - 1;
+        }
+        node = trie[node].children[bit];
+    }
+    if (trie[node].rule != DENY) { trie[node].rule = rule; }
+}
+
+bool IpFilter::match(const trie_t& trie, const unsigned char* bytes, unsigned int bits)
+{
+    uint32_t node = 0;
+    unsigned char best = trie[0].rule;
+    for (unsigned int i = 0; i < bits; i++)
+    {
+        node = trie[node].children[(bytes[i / 8] >> (7 - i % 8)) & 1];
+        if (!node) break;
+        if (trie[node].rule != NONE) { best = trie[node].rule; }
+    }
+    return best == ALLOW;
+}
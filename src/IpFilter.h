@@ -0,0 +1,53 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// IpFilter.h
+//
+// Copyright (c) 2014 Eric Lombrozo
+//
+// All Rights Reserved.
+
+#pragma once
+
+#include <boost/asio/ip/address.hpp>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace WebSocket
+{
+
+const std::string DEFAULT_ALLOWED_CIDRS = "127.0.0.1/32, ::1/128";
+
+// Immutable IPv4/IPv6 allow/deny lists compiled into binary prefix tries.
+// IPv4-mapped IPv6 addresses are matched against the IPv4 lists.
+class IpFilter
+{
+public:
+    // allow and deny are comma or whitespace separated CIDR blocks, e.g. "10.0.0.0/8, ::1".
+    // A bare address is treated as a full-length prefix. Throws std::invalid_argument on bad entries.
+    explicit IpFilter(const std::string& allow, const std::string& deny = "");
+
+    // The longest matching prefix decides, with deny winning ties. Addresses matching nothing are rejected.
+    bool isAllowed(const boost::asio::ip::address& address) const;
+
+private:
+    enum rule_t { NONE = 0, ALLOW, DENY };
+
+    struct node_t
+    {
+        node_t() : rule(NONE) { children[0] = children[1] = 0; }
+        uint32_t children[2];   // 0 = no child, since the root is never a child
+        unsigned char rule;
+    };
+    typedef std::vector<node_t> trie_t;
+
+    trie_t m_v4;
+    trie_t m_v6;
+
+    void addList(const std::string& list, rule_t rule);
+    static void insert(trie_t& trie, const unsigned char* bytes, unsigned int prefixLen, rule_t rule);
+    static bool match(const trie_t& trie, const unsigned char* bytes, unsigned int bits);
+};
+
+}
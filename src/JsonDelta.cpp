@@ -0,0 +1,268 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// JsonDelta.cpp
+//
+// Copyright (c) 2014 Eric Lombrozo
+//
+// All Rights Reserved.
+
+#include "JsonDelta.h"
+#include "JsonExceptions.h"
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include <stdlib.h>
+
+using namespace JsonRpc;
+using namespace json_spirit;
+
+namespace {
+
+std::string escapeToken(const std::string& token)
+{
+    std::string escaped;
+    for (auto c: token)
+    {
+        if (c == '~')       { escaped += "~0"; }
+        else if (c == '/')  { escaped += "~1"; }
+        else                { escaped += c; }
+    }
+    return escaped;
+}
+
+std::string unescapeToken(const std::string& token)
+{
+    std::string unescaped;
+    for (std::size_t i = 0; i < token.size(); i++)
+    {
+        if (token[i] == '~' && i + 1 < token.size())
+        {
+            unescaped += (token[++i] == '0') ? '~' : '/';
+        }
+        else
+        {
+            unescaped += token[i];
+        }
+    }
+    return unescaped;
+}
+
+std::vector<std::string> splitPointer(const std::string& path)
+{
+    std::vector<std::string> tokens;
+    if (path.empty()) return tokens;
+    if (path[0] != '/') throw JsonInvalidPatchException(path);
+
+    std::size_t start = 1;
+    while (true)
+    {
+        std::size_t end = path.find('/', start);
+        tokens.push_back(unescapeToken(path.substr(start, end == std::string::npos ? std::string::npos : end - start)));
+        if (end == std::string::npos) break;
+        start = end + 1;
+    }
+    return tokens;
+}
+
+void pushOp(Array& patch, const std::string& op, const std::string& path, const Value* value = NULL)
+{
+    Object entry;
+    entry.push_back(Pair("op", op));
+    entry.push_back(Pair("path", path));
+    if (value) { entry.push_back(Pair("value", *value)); }
+    patch.push_back(entry);
+}
+
+void diffValues(const Value& from, const Value& to, const std::string& path, Array& patch);
+
+void diffObjects(const Object& from, const Object& to, const std::string& path, Array& patch)
+{
+    std::map<std::string, const Value*> toIndex;
+    for (auto& pair: to) { toIndex[pair.name_] = &pair.value_; }
+
+    std::map<std::string, const Value*> fromIndex;
+    for (auto& pair: from)
+    {
+        fromIndex[pair.name_] = &pair.value_;
+        auto it = toIndex.find(pair.name_);
+        if (it == toIndex.end())    { pushOp(patch, "remove", path + "/" + escapeToken(pair.name_)); }
+        else                        { diffValues(pair.value_, *it->second, path + "/" + escapeToken(pair.name_), patch); }
+    }
+
+    for (auto& pair: to)
+    {
+        if (!fromIndex.count(pair.name_)) { pushOp(patch, "add", path + "/" + escapeToken(pair.name_), &pair.value_); }
+    }
+}
+
+void diffArrays(const Array& from, const Array& to, const std::string& path, Array& patch)
+{
+    std::size_t common = std::min(from.size(), to.size());
+    for (std::size_t i = 0; i < common; i++)
+    {
+        diffValues(from[i], to[i], path + "/" + std::to_string((unsigned long long)i), patch);
+    }
+    for (std::size_t i = common; i < to.size(); i++)
+    {
+        pushOp(patch, "add", path + "/" + std::to_string((unsigned long long)i), &to[i]);
+    }
+    // Remove from the back so earlier indices stay valid
+    for (std::size_t i = from.size(); i > common; i--)
+    {
+        pushOp(patch, "remove", path + "/" + std::to_string((unsigned long long)(i - 1)));
+    }
+}
+
+void diffValues(const Value& from, const Value& to, const std::string& path, Array& patch)
+{
+    if (from.type() == obj_type && to.type() == obj_type)
+    {
+        diffObjects(from.get_obj(), to.get_obj(), path, patch);
+    }
+    else if (from.type() == array_type && to.type() == array_type)
+    {
+        diffArrays(from.get_array(), to.get_array(), path, patch);
+    }
+    else if (from.type() != to.type() || !(from == to))
+    {
+        pushOp(patch, "replace", path, &to);
+    }
+}
+
+Value* findMember(Object& obj, const std::string& name)
+{
+    for (auto& pair: obj)
+    {
+        if (pair.name_ == name) return &pair.value_;
+    }
+    return NULL;
+}
+
+std::size_t parseIndex(const std::string& token, std::size_t limit, const std::string& path)
+{
+    char* end;
+    unsigned long index = strtoul(token.c_str(), &end, 10);
+    if (token.empty() || *end != '\0' || index > limit) throw JsonInvalidPatchException(path);
+    return index;
+}
+
+Value& resolve(Value& doc, const std::vector<std::string>& tokens, std::size_t count, const std::string& path)
+{
+    Value* node = &doc;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        if (node->type() == obj_type)
+        {
+            node = findMember(node->get_obj(), tokens[i]);
+            if (!node) throw JsonInvalidPatchException(path);
+        }
+        else if (node->type() == array_type)
+        {
+            Array& array = node->get_array();
+            if (array.empty()) throw JsonInvalidPatchException(path);
+            node = &array[parseIndex(tokens[i], array.size() - 1, path)];
+        }
+        else
+        {
+            throw JsonInvalidPatchException(path);
+        }
+    }
+    return *node;
+}
+
+}
+
+Array JsonRpc::diff(const Value& from, const Value& to)
+{
+    Array patch;
+    diffValues(from, to, "", patch);
+    return patch;
+}
+
+void JsonRpc::applyPatch(Value& doc, const Array& patch)
+{
+    for (auto& entry: patch)
+    {
+        if (entry.type() != obj_type) throw JsonInvalidPatchException(write_string<Value>(entry));
+
+        const Object& opObj = entry.get_obj();
+        const Value& op = find_value(opObj, "op");
+        const Value& path = find_value(opObj, "path");
+        if (op.type() != str_type || path.type() != str_type) throw JsonInvalidPatchException(write_string<Value>(entry));
+
+        const std::string& opName = op.get_str();
+        const Value& value = find_value(opObj, "value");
+        std::vector<std::string> tokens = splitPointer(path.get_str());
+
+        if (tokens.empty())
+        {
+            if (opName != "replace" && opName != "add") throw JsonInvalidPatchException(path.get_str());
+            doc = value;
+            continue;
+        }
+
+        Value& parent = resolve(doc, tokens, tokens.size() - 1, path.get_str());
+        const std::string& last = tokens.back();
+
+        if (parent.type() == obj_type)
+        {
+            Object& obj = parent.get_obj();
+            Value* member = findMember(obj, last);
+            if (opName == "add" || opName == "replace")
+            {
+                if (member)                 { *member = value; }
+                else if (opName == "add")   { obj.push_back(Pair(last, value)); }
+                else                        { throw JsonInvalidPatchException(path.get_str()); }
+            }
+            else if (opName == "remove")
+            {
+                if (!member) throw JsonInvalidPatchException(path.get_str());
+                for (auto it = obj.begin(); it != obj.end(); ++it)
+                {
+                    if (it->name_ == last) { obj.erase(it); break; }
+                }
+            }
+            else
+            {
+                throw JsonInvalidPatchException(path.get_str());
+            }
+        }
+        else if (parent.type() == array_type)
+        {
+            Array& array = parent.get_array();
+            if (opName == "add")
+            {
+                std::size_t index = (last == "-") ? array.size() : parseIndex(last, array.size(), path.get_str());
+                array.insert(array.begin() + index, value);
+            }
+            else if (opName == "replace" || opName == "remove")
+            {
+                if (array.empty()) throw JsonInvalidPatchException(path.get_str());
+                std::size_t index = parseIndex(last, array.size() - 1, path.get_str());
+                if (opName == "replace")    { array[index] = value; }
+                else                        { array.erase(array.begin() + index); }
+            }
+            else
+            {
+                throw JsonInvalidPatchException(path.get_str());
+            }
+        }
+        else
+        {
+            throw JsonInvalidPatchException(path.get_str());
+        }
+    }
+}
+
+Object JsonRpc::expandDelta(const Object& message, const Value& doc)
+{
+    Object expanded;
+    for (auto& pair: message)
+    {
+        if (pair.name_ == DELTA_FIELD)  { expanded.push_back(Pair(DELTA_DATA_FIELD, doc)); }
+        else                            { expanded.push_back(pair); }
+    }
+    return expanded;
+}
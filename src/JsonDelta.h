@@ -0,0 +1,38 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// JsonDelta.h
+//
+// Copyright (c) 2014 Eric Lombrozo
+//
+// All Rights Reserved.
+
+#pragma once
+
+#include <json_spirit/json_spirit_reader_template.h>
+#include <json_spirit/json_spirit_writer_template.h>
+#include <json_spirit/json_spirit_utils.h>
+
+#include <string>
+
+namespace JsonRpc {
+
+// Delta-encoded channel messages carry an object under DELTA_FIELD:
+//   snapshot: { "channel": <key>, "version": <n>, "data": <document> }
+//   update:   { "channel": <key>, "version": <n>, "base": <n - 1>, "patch": <JSON Patch> }
+// A client that cannot apply an update asks for a new snapshot by calling DELTA_RESYNC_METHOD with the channel key.
+const std::string DELTA_FIELD = "delta";
+const std::string DELTA_DATA_FIELD = "data";
+const std::string DELTA_RESYNC_METHOD = "resync";
+
+// Returns an RFC 6902 JSON Patch (add, remove and replace operations only) that turns from into to.
+json_spirit::Array diff(const json_spirit::Value& from, const json_spirit::Value& to);
+
+// The message a delta channel message stands for once its document is resolved: the same members, with the
+// DELTA_FIELD object replaced by the document under DELTA_DATA_FIELD, as a channel without delta encoding
+// sends it.
+json_spirit::Object expandDelta(const json_spirit::Object& message, const json_spirit::Value& doc);
+
+// Applies a patch produced by diff(). Throws JsonInvalidPatchException on malformed or inapplicable patches.
+void applyPatch(json_spirit::Value& doc, const json_spirit::Array& patch);
+
+}
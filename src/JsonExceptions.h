@@ -19,7 +19,15 @@ enum ErrorCodes
     // JSON errors
     JSON_INVALID = 10001, // start numbering high so as not to clobber application errors
     JSON_MISSING_METHOD,
-    JSON_INVALID_PARAMETER_FORMAT
+    JSON_INVALID_PARAMETER_FORMAT,
+    JSON_INVALID_PATCH,
+
+    // Server errors
+    RATE_LIMIT_EXCEEDED = 10101,
+    REQUEST_TIMEOUT,
+
+    // Client errors
+    CONNECTION_CLOSED = 10201
 };
 
 // JSON EXCEPTIONS
@@ -53,4 +61,30 @@ public:
     explicit JsonInvalidParameterFormatException(const std::string& json) : JsonException("Invalid parameter format.", JSON_INVALID_PARAMETER_FORMAT, json) { }
 };
 
+class JsonInvalidPatchException: public JsonException
+{
+public:
+    explicit JsonInvalidPatchException(const std::string& json) : JsonException("Invalid patch.", JSON_INVALID_PATCH, json) { }
+};
+
+// SERVER EXCEPTIONS
+class RateLimitExceededException : public stdutils::custom_error
+{
+public:
+    RateLimitExceededException() : stdutils::custom_error("Rate limit exceeded.", RATE_LIMIT_EXCEEDED) { }
+};
+
+class RequestTimeoutException : public stdutils::custom_error
+{
+public:
+    RequestTimeoutException() : stdutils::custom_error("Request timed out.", REQUEST_TIMEOUT) { }
+};
+
+// CLIENT EXCEPTIONS
+class ConnectionClosedException : public stdutils::custom_error
+{
+public:
+    ConnectionClosedException() : stdutils::custom_error("Connection closed.", CONNECTION_CLOSED) { }
+};
+
 }
@@ -8,53 +8,154 @@
 
 #include "JsonRpc.h"
 #include "JsonExceptions.h"
+#include "JsonScanner.h"
+
+#include <algorithm>
 
 using namespace JsonRpc;
 using namespace json_spirit;
 
-void Request::setJson(const std::string& json)
+namespace {
+
+bool pairNameLess(const Pair& lhs, const Pair& rhs)
 {
-    Value value;
-    read_string(json, value);
-    if (value.type() != obj_type)
+    return lhs.name_ < rhs.name_;
+}
+
+Value canonicalize(const Value& value)
+{
+    if (value.type() == obj_type)
     {
-        throw JsonInvalidException(json);
+        Object obj;
+        for (auto& pair: value.get_obj()) { obj.push_back(Pair(pair.name_, canonicalize(pair.value_))); }
+        std::stable_sort(obj.begin(), obj.end(), &pairNameLess);
+        return obj;
+    }
+    if (value.type() == array_type)
+    {
+        Array array;
+        for (auto& element: value.get_array()) { array.push_back(canonicalize(element)); }
+        return array;
     }
+    return value;
+}
 
-    const Object& obj = value.get_obj();
-    const Value& method = find_value(obj, "method");
-    if (method.type() != str_type)
+}
+
+void Request::setJson(std::string&& json)
+{
+    std::shared_ptr<raw_params_t> raw(new raw_params_t());
+    raw->json.swap(json);
+
+    JsonScanner scanner(raw->json);
+    JsonScanner::slice_t root = scanner.root();
+    if (scanner.type(root) != '{')
     {
-        throw JsonMissingMethodException(json);
+        throw JsonInvalidException(raw->json);
     }
 
-    const Value& params = find_value(obj, "params");
-    if (params.is_null())
+    // Like find_value(), the first of any duplicate members wins
+    JsonScanner::members_t members = scanner.members(root);
+    const JsonScanner::slice_t* method = NULL;
+    const JsonScanner::slice_t* params = NULL;
+    const JsonScanner::slice_t* id = NULL;
+    const JsonScanner::slice_t* timeout = NULL;
+    for (auto it = members.rbegin(); it != members.rend(); ++it)
     {
-        m_params = Array();
+        if (it->first == "method")          { method = &it->second; }
+        else if (it->first == "params")     { params = &it->second; }
+        else if (it->first == "id")         { id = &it->second; }
+        else if (it->first == "timeout")    { timeout = &it->second; }
     }
-    else if (params.type() != array_type)
+
+    if (!method || scanner.type(*method) != '"')
     {
-        throw JsonInvalidParameterFormatException(json);
+        throw JsonMissingMethodException(raw->json);
     }
-    else
+
+    if (params && scanner.type(*params) != '[' && scanner.type(*params) != 'n')
     {
-        m_params = params.get_array();
+        throw JsonInvalidParameterFormatException(raw->json);
     }
 
-    m_method = method.get_str();
-    m_id = find_value(obj, "id");
+    Value value;
+    m_timeout = 0;
+    if (timeout && read_string(scanner.text(*timeout), value) && value.type() == int_type)
+    {
+        m_timeout = value.get_uint64();
+    }
+
+    read_string(scanner.text(*method), value);
+    m_method = value.get_str();
+
+    m_id = Value();
+    if (id) { read_string(scanner.text(*id), m_id); }
+
+    m_params.clear();
+    m_rawParams.reset();
+    if (params && scanner.type(*params) == '[')
+    {
+        raw->begin = params->begin;
+        raw->end = params->end;
+        m_rawParams = raw;
+    }
+}
+
+void Request::parseParams(raw_params_t* raw)
+{
+    Value params;
+    std::string text = raw->json.substr(raw->begin, raw->end - raw->begin);
+    if (!read_string(text, params) || params.type() != array_type)
+    {
+        throw JsonInvalidParameterFormatException(text);
+    }
+    raw->params.swap(params.get_array());
+}
+
+const Array& Request::getParams() const
+{
+    if (!m_rawParams) return m_params;
+    std::call_once(m_rawParams->parsed, &Request::parseParams, m_rawParams.get());
+    return m_rawParams->params;
+}
+
+void Request::forEachParam(const std::function<void(const Value&)>& callback) const
+{
+    if (!m_rawParams)
+    {
+        for (auto& param: m_params) { callback(param); }
+        return;
+    }
+
+    JsonScanner scanner(m_rawParams->json);
+    JsonScanner::slice_t slice = { m_rawParams->begin, m_rawParams->end };
+    std::vector<JsonScanner::slice_t> elements = scanner.elements(slice);
+    for (auto& element: elements)
+    {
+        Value param;
+        if (!read_string(scanner.text(element), param))
+        {
+            throw JsonInvalidParameterFormatException(scanner.text(slice));
+        }
+        callback(param);
+    }
 }
 
 std::string Request::getJson() const
 {
     Object req;
     req.push_back(Pair("method", m_method));
-    req.push_back(Pair("params", m_params));
+    req.push_back(Pair("params", getParams()));
     req.push_back(Pair("id", m_id));
+    if (m_timeout) { req.push_back(Pair("timeout", m_timeout)); }
     return write_string<Value>(req);
 }
 
+std::string Request::getKey() const
+{
+    return m_method + "\n" + write_string<Value>(canonicalize(getParams()));
+}
+
 
 
 void Response::setJson(const std::string& json)
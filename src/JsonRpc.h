@@ -14,7 +14,11 @@
 #include <json_spirit/json_spirit_writer_template.h>
 #include <json_spirit/json_spirit_utils.h>
 
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <stdint.h>
 #include <string>
 
 namespace JsonRpc {
@@ -22,27 +26,56 @@ namespace JsonRpc {
 class Request
 {
 public:
-    Request() { }
-    explicit Request(const Request& request) : m_method(request.m_method), m_params(request.m_params), m_id(request.m_id) { }
+    Request() : m_timeout(0) { }
+    explicit Request(const Request& request)
+        : m_method(request.m_method), m_params(request.m_params), m_rawParams(request.m_rawParams), m_id(request.m_id), m_timeout(request.m_timeout) { }
     Request(const std::string& method, const json_spirit::Array& params = json_spirit::Array(), const json_spirit::Value& id = json_spirit::Value())
-        : m_method(method), m_params(params), m_id(id) { }
+        : m_method(method), m_params(params), m_id(id), m_timeout(0) { }
 
-    void setJson(const std::string& json);
+    // Params are only checked for well-formedness here and kept as text until getParams() or forEachParam().
+    // The text is shared by copies of the request; pass an rvalue to hand it over without copying.
+    void setJson(const std::string& json) { setJson(std::string(json)); }
+    void setJson(std::string&& json);
     std::string getJson() const;
 
     void setMethod(const std::string& method) { m_method = method; }
     const std::string& getMethod() const { return m_method; }
 
-    void setParams(const json_spirit::Array& params) { m_params = params; }
-    const json_spirit::Array& getParams() const { return m_params; }
+    void setParams(const json_spirit::Array& params) { m_params = params; m_rawParams.reset(); }
+
+    // Parsed once on first use, even when copies of the request call it from several threads
+    const json_spirit::Array& getParams() const;
+
+    // Parses and visits one param at a time, so a large params array is never held as a json_spirit::Array
+    void forEachParam(const std::function<void(const json_spirit::Value&)>& callback) const;
 
     void setId(const json_spirit::Value& id) { m_id = id; }
     const json_spirit::Value& getId() const { return m_id; }
 
+    // Optional time in ms after which the caller no longer wants a result. 0 means no timeout.
+    void setTimeout(uint64_t timeout) { m_timeout = timeout; }
+    uint64_t getTimeout() const { return m_timeout; }
+
+    // Method and params with object members sorted by name, so identical calls have identical keys
+    std::string getKey() const;
+
 private:
+    // Message text from setJson() and the offsets of its params array
+    struct raw_params_t
+    {
+        std::string json;
+        std::size_t begin;
+        std::size_t end;
+        std::once_flag parsed;
+        json_spirit::Array params;
+    };
+    static void parseParams(raw_params_t* raw);
+
     std::string m_method;
     json_spirit::Array m_params;
+    std::shared_ptr<raw_params_t> m_rawParams;  // null unless params came from setJson()
     json_spirit::Value m_id;
+    uint64_t m_timeout;
 };
 
 
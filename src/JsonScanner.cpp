@@ -0,0 +1,278 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// JsonScanner.cpp
+//
+// Copyright (c) 2014 Eric Lombrozo
+//
+// All Rights Reserved.
+
+#include "JsonScanner.h"
+#include "JsonExceptions.h"
+
+#include <string.h>
+
+using namespace JsonRpc;
+
+namespace {
+
+// Scanned texts can be large, so errors only quote the start
+const std::size_t MAX_ERROR_TEXT = 256;
+
+bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+int hexValue(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+void appendUtf8(std::string& out, unsigned long cp)
+{
+    if (cp < 0x80)
+    {
+        out += (char)cp;
+    }
+    else if (cp < 0x800)
+    {
+        out += (char)(0xc0 | (cp >> 6));
+        out += (char)(0x80 | (cp & 0x3f));
+    }
+    else if (cp < 0x10000)
+    {
+        out += (char)(0xe0 | (cp >> 12));
+        out += (char)(0x80 | ((cp >> 6) & 0x3f));
+        out += (char)(0x80 | (cp & 0x3f));
+    }
+    else
+    {
+        out += (char)(0xf0 | (cp >> 18));
+        out += (char)(0x80 | ((cp >> 12) & 0x3f));
+        out += (char)(0x80 | ((cp >> 6) & 0x3f));
+        out += (char)(0x80 | (cp & 0x3f));
+    }
+}
+
+}
+
+JsonScanner::slice_t JsonScanner::root() const
+{
+    slice_t slice;
+    slice.begin = skipSpace(0);
+    slice.end = skipValue(slice.begin);
+    if (skipSpace(slice.end) != m_json.size()) fail();
+    return slice;
+}
+
+JsonScanner::members_t JsonScanner::members(const slice_t& slice) const
+{
+    members_t members;
+    std::size_t pos = slice.begin;
+    if (pos >= m_json.size() || m_json[pos] != '{') fail();
+    pos = skipSpace(pos + 1);
+    if (pos < m_json.size() && m_json[pos] == '}') return members;
+
+    for (;;)
+    {
+        std::string name;
+        pos = skipSpace(skipString(pos, &name));
+        if (pos >= m_json.size() || m_json[pos] != ':') fail();
+
+        slice_t value;
+        value.begin = skipSpace(pos + 1);
+        value.end = skipValue(value.begin);
+        members.push_back(std::make_pair(name, value));
+
+        pos = skipSpace(value.end);
+        if (pos >= m_json.size()) fail();
+        if (m_json[pos] == '}') return members;
+        if (m_json[pos] != ',') fail();
+        pos = skipSpace(pos + 1);
+    }
+}
+
+std::vector<JsonScanner::slice_t> JsonScanner::elements(const slice_t& slice) const
+{
+    std::vector<slice_t> elements;
+    std::size_t pos = slice.begin;
+    if (pos >= m_json.size() || m_json[pos] != '[') fail();
+    pos = skipSpace(pos + 1);
+    if (pos < m_json.size() && m_json[pos] == ']') return elements;
+
+    for (;;)
+    {
+        slice_t element;
+        element.begin = pos;
+        element.end = skipValue(pos);
+        elements.push_back(element);
+
+        pos = skipSpace(element.end);
+        if (pos >= m_json.size()) fail();
+        if (m_json[pos] == ']') return elements;
+        if (m_json[pos] != ',') fail();
+        pos = skipSpace(pos + 1);
+    }
+}
+
+std::size_t JsonScanner::skipSpace(std::size_t pos) const
+{
+    while (pos < m_json.size() && (m_json[pos] == ' ' || m_json[pos] == '\t' || m_json[pos] == '\n' || m_json[pos] == '\r')) { pos++; }
+    return pos;
+}
+
+std::size_t JsonScanner::skipValue(std::size_t pos) const
+{
+    // Iterative so deeply nested input can't exhaust the stack
+    std::vector<char> closers;
+    for (;;)
+    {
+        pos = skipSpace(pos);
+        if (pos >= m_json.size()) fail();
+
+        char c = m_json[pos];
+        if (c == '{' || c == '[')
+        {
+            char closer = (c == '{') ? '}' : ']';
+            pos = skipSpace(pos + 1);
+            if (pos < m_json.size() && m_json[pos] == closer)
+            {
+                pos++;
+            }
+            else
+            {
+                closers.push_back(closer);
+                if (closer == '}')
+                {
+                    pos = skipSpace(skipString(pos));
+                    if (pos >= m_json.size() || m_json[pos] != ':') fail();
+                    pos++;
+                }
+                continue;
+            }
+        }
+        else if (c == '"')  { pos = skipString(pos); }
+        else if (c == 't')  { pos = skipLiteral(pos, "true"); }
+        else if (c == 'f')  { pos = skipLiteral(pos, "false"); }
+        else if (c == 'n')  { pos = skipLiteral(pos, "null"); }
+        else                { pos = skipNumber(pos); }
+
+        // A value just ended: close finished containers or step to the next element
+        for (;;)
+        {
+            if (closers.empty()) return pos;
+
+            pos = skipSpace(pos);
+            if (pos >= m_json.size()) fail();
+            if (m_json[pos] == ',')
+            {
+                pos++;
+                if (closers.back() == '}')
+                {
+                    pos = skipSpace(skipString(skipSpace(pos)));
+                    if (pos >= m_json.size() || m_json[pos] != ':') fail();
+                    pos++;
+                }
+                break;
+            }
+            if (m_json[pos] != closers.back()) fail();
+            closers.pop_back();
+            pos++;
+        }
+    }
+}
+
+std::size_t JsonScanner::skipString(std::size_t pos, std::string* unescaped) const
+{
+    if (pos >= m_json.size() || m_json[pos] != '"') fail();
+    pos++;
+
+    for (;;)
+    {
+        if (pos >= m_json.size()) fail();
+        char c = m_json[pos];
+        if (c == '"') return pos + 1;
+        if ((unsigned char)c < 0x20) fail();
+        if (c != '\\')
+        {
+            if (unescaped) { *unescaped += c; }
+            pos++;
+            continue;
+        }
+
+        if (++pos >= m_json.size()) fail();
+        c = m_json[pos++];
+        if (c == 'u')
+        {
+            unsigned long cp = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                int digit = (pos < m_json.size()) ? hexValue(m_json[pos++]) : -1;
+                if (digit < 0) fail();
+                cp = (cp << 4) | digit;
+            }
+
+            // Combine surrogate pairs
+            if (cp >= 0xd800 && cp < 0xdc00 && pos + 6 <= m_json.size() && m_json[pos] == '\\' && m_json[pos + 1] == 'u')
+            {
+                unsigned long low = 0;
+                bool bValid = true;
+                for (int i = 2; i < 6; i++)
+                {
+                    int digit = hexValue(m_json[pos + i]);
+                    if (digit < 0) { bValid = false; break; }
+                    low = (low << 4) | digit;
+                }
+                if (bValid && low >= 0xdc00 && low < 0xe000)
+                {
+                    cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                    pos += 6;
+                }
+            }
+            if (unescaped) { appendUtf8(*unescaped, cp); }
+            continue;
+        }
+
+        const char* escapes = "\"\\/bfnrt";
+        const char* decoded = "\"\\/\b\f\n\r\t";
+        const char* match = strchr(escapes, c);
+        if (!match || !c) fail();
+        if (unescaped) { *unescaped += decoded[match - escapes]; }
+    }
+}
+
+std::size_t JsonScanner::skipNumber(std::size_t pos) const
+{
+    if (pos < m_json.size() && m_json[pos] == '-') { pos++; }
+    if (pos >= m_json.size() || !isDigit(m_json[pos])) fail();
+    if (m_json[pos] == '0') { pos++; }
+    else                    { while (pos < m_json.size() && isDigit(m_json[pos])) { pos++; } }
+
+    if (pos < m_json.size() && m_json[pos] == '.')
+    {
+        pos++;
+        if (pos >= m_json.size() || !isDigit(m_json[pos])) fail();
+        while (pos < m_json.size() && isDigit(m_json[pos])) { pos++; }
+    }
+
+    if (pos < m_json.size() && (m_json[pos] == 'e' || m_json[pos] == 'E'))
+    {
+        pos++;
+        if (pos < m_json.size() && (m_json[pos] == '+' || m_json[pos] == '-')) { pos++; }
+        if (pos >= m_json.size() || !isDigit(m_json[pos])) fail();
+        while (pos < m_json.size() && isDigit(m_json[pos])) { pos++; }
+    }
+    return pos;
+}
+
+std::size_t JsonScanner::skipLiteral(std::size_t pos, const char* literal) const
+{
+    std::size_t length = strlen(literal);
+    if (m_json.compare(pos, length, literal) != 0) fail();
+    return pos + length;
+}
+
+void JsonScanner::fail() const
+{
+    throw JsonInvalidException(m_json.substr(0, MAX_ERROR_TEXT));
+}
@@ -0,0 +1,56 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// JsonScanner.h
+//
+// Copyright (c) 2014 Eric Lombrozo
+//
+// All Rights Reserved.
+
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace JsonRpc {
+
+// Finds the values in JSON text without building a json_spirit::Value, so large members can be skipped,
+// copied out raw or parsed one element at a time. Values are checked for well-formedness as they are
+// skipped. All methods throw JsonInvalidException on malformed input.
+class JsonScanner
+{
+public:
+    // Offsets [begin, end) of a value in the scanned text
+    struct slice_t
+    {
+        std::size_t begin;
+        std::size_t end;
+    };
+    typedef std::vector<std::pair<std::string, slice_t>> members_t;
+
+    explicit JsonScanner(const std::string& json) : m_json(json) { }
+
+    // Slice of the single value making up the whole text
+    slice_t root() const;
+
+    // Members of the object at slice, in order, with their names unescaped
+    members_t members(const slice_t& slice) const;
+
+    // Elements of the array at slice
+    std::vector<slice_t> elements(const slice_t& slice) const;
+
+    std::string text(const slice_t& slice) const { return m_json.substr(slice.begin, slice.end - slice.begin); }
+    char type(const slice_t& slice) const { return m_json[slice.begin]; }   // first character: { [ " t f n or number
+
+private:
+    const std::string& m_json;
+
+    std::size_t skipSpace(std::size_t pos) const;
+    std::size_t skipValue(std::size_t pos) const;
+    std::size_t skipString(std::size_t pos, std::string* unescaped = NULL) const;
+    std::size_t skipNumber(std::size_t pos) const;
+    std::size_t skipLiteral(std::size_t pos, const char* literal) const;
+    void fail() const;
+};
+
+}
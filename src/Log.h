@@ -0,0 +1,302 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Log.h
+//
+// Copyright (c) 2014 Eric Lombrozo
+//
+// All Rights Reserved.
+
+#pragma once
+
+#include "MpmcQueue.h"
+
+#include <boost/thread.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Levels below WS_LOG_MIN_LEVEL (0 = trace ... 5 = none) are compiled out: the checks below fold to false
+// and the statements they guard are dropped.
+#if !defined(WS_LOG_MIN_LEVEL)
+    #define WS_LOG_MIN_LEVEL 0
+#endif
+
+// True if messages at level are logged. Test it before building a message.
+#define WS_LOG_ENABLED(level) (WebSocket::log::level >= WS_LOG_MIN_LEVEL && WebSocket::log::enabled(WebSocket::log::level))
+
+// Replaces LOGGER(level): nothing streamed into it is evaluated unless the level is enabled. The line goes to
+// the sink given to log::setSink(), or to LOGGER if there is none.
+#define WS_LOG(level) if (!WS_LOG_ENABLED(level)) ; else WebSocket::log::Line(WebSocket::log::level)
+
+namespace WebSocket
+{
+
+namespace log
+{
+
+enum level_t { trace, debug, info, warning, error, none };
+
+inline std::atomic<int>& threshold()
+{
+    static std::atomic<int> level(trace);
+    return level;
+}
+
+// Runtime threshold shared by every client and server in the process. Default: trace.
+inline void setLevel(level_t level) { threshold().store(level, std::memory_order_relaxed); }
+inline bool enabled(level_t level) { return level >= threshold().load(std::memory_order_relaxed); }
+
+inline const char* levelName(level_t level)
+{
+    static const char* names[] = { "trace", "debug", "info", "warning", "error", "none" };
+    return names[level];
+}
+
+const std::size_t ASYNC_SINK_CAPACITY = 8192;   // records waiting for the writer thread
+
+class AsyncSink;
+
+inline std::atomic<AsyncSink*>& installedSink()
+{
+    static std::atomic<AsyncSink*> sink(NULL);
+    return sink;
+}
+
+// WS_LOG lines go to sink, and are formatted on its writer thread, instead of straight to LOGGER. NULL goes
+// back to LOGGER. A sink uninstalls itself when destroyed, but must outlive any WS_LOG still running.
+inline void setSink(AsyncSink* sink) { installedSink().store(sink, std::memory_order_release); }
+
+// Hands log records to a writer thread through a bounded lock-free MpmcQueue, so formatting and slow output
+// (files, consoles) run off the io threads. A record is either a finished message or a formatter run on the
+// writer thread. When the queue is full records are dropped and counted rather than blocking; the writer
+// reports how many were lost. handler() plugs it in as a client's LogHandler, setSink() behind WS_LOG.
+class AsyncSink
+{
+public:
+    typedef std::function<void(const std::string&)> output_t;
+    typedef std::function<std::string()> formatter_t;
+
+    explicit AsyncSink(output_t output, std::size_t capacity = ASYNC_SINK_CAPACITY)
+        : m_output(output), m_queue(capacity), m_dropped(0), m_bStop(false)
+    {
+        m_writer = boost::thread(&AsyncSink::writeLoop, this);
+    }
+
+    // Writes whatever is still queued before returning
+    ~AsyncSink()
+    {
+        AsyncSink* self = this;
+        installedSink().compare_exchange_strong(self, NULL);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_bStop = true;
+        }
+        m_cond.notify_one();
+        m_writer.join();
+    }
+
+    // Any thread. Returns false if the record was dropped.
+    bool push(const std::string& message)
+    {
+        record_t record;
+        record.message = message;
+        return enqueue(record);
+    }
+
+    // format runs on the writer thread, so it must own, not reference, whatever it formats
+    bool defer(formatter_t format)
+    {
+        record_t record;
+        record.format = std::move(format);
+        return enqueue(record);
+    }
+
+    output_t handler() { return std::bind(&AsyncSink::push, this, std::placeholders::_1); }
+
+    std::size_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+    AsyncSink(const AsyncSink&);
+    AsyncSink& operator=(const AsyncSink&);
+
+    struct record_t
+    {
+        std::string message;
+        formatter_t format;         // set instead of message for deferred records
+    };
+
+    bool enqueue(record_t& record)
+    {
+        if (m_queue.push(std::move(record))) return true;
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    void writeLoop()
+    {
+        // Producers never signal, so they stay off the mutex; the writer polls every few ms instead
+        std::size_t reported = 0;
+        record_t record;
+        for (;;)
+        {
+            bool bStop;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                if (!m_bStop) { m_cond.wait_for(lock, std::chrono::milliseconds(5)); }
+                bStop = m_bStop;
+            }
+
+            while (m_queue.pop(record))
+            {
+                if (!record.format)
+                {
+                    m_output(record.message);
+                    continue;
+                }
+                try
+                {
+                    m_output(record.format());
+                }
+                catch (const std::exception& e)
+                {
+                    m_output(std::string("Log formatter failed: ") + e.what());
+                }
+            }
+
+            std::size_t dropped = m_dropped.load(std::memory_order_relaxed);
+            if (dropped != reported)
+            {
+                std::stringstream ss;
+                ss << (dropped - reported) << " log messages dropped.";
+                m_output(ss.str());
+                reported = dropped;
+            }
+            if (bStop) return;
+        }
+    }
+
+    output_t m_output;
+    MpmcQueue<record_t> m_queue;            // many producers, the writer thread consumes
+    std::atomic<std::size_t> m_dropped;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_bStop;
+    boost::thread m_writer;
+};
+
+// Writes a WS_LOG line to LOGGER when no sink is installed. Defined by the server, which links the logger.
+void writeLogger(level_t level, const std::string& message);
+
+// One WS_LOG statement. Strings are copied in as they are streamed; integers, floating point values and
+// pointers are kept as they are and only turned into text when the line is formatted, which with a sink
+// installed happens on its writer thread. Other types are formatted on the spot. Manipulators are ignored:
+// each statement is one line. The line is handed on when the statement ends, with its level.
+class Line
+{
+public:
+    explicit Line(level_t level) : m_level(level) { }
+
+    ~Line()
+    {
+        try
+        {
+            AsyncSink* sink = installedSink().load(std::memory_order_acquire);
+            if (sink)   { sink->defer(Formatter(m_level, std::move(m_pieces))); }
+            else        { writeLogger(m_level, Formatter::text(m_pieces)); }
+        }
+        catch (...)
+        {
+            // Logging never throws
+        }
+    }
+
+    Line& operator<<(const std::string& value) { m_pieces.push_back(piece_t(value)); return *this; }
+    Line& operator<<(const char* value) { m_pieces.push_back(piece_t(std::string(value ? value : "(null)"))); return *this; }
+    Line& operator<<(std::ostream& (*)(std::ostream&)) { return *this; }
+
+    template <typename T>
+    Line& operator<<(const T& value) { m_pieces.push_back(piece_t(value)); return *this; }
+
+private:
+    Line(const Line&);
+    Line& operator=(const Line&);
+
+    struct piece_t
+    {
+        enum kind_t { TEXT, SIGNED, UNSIGNED, REAL, POINTER };
+
+        explicit piece_t(const std::string& text) : kind(TEXT), text(text) { }
+        explicit piece_t(int value) : kind(SIGNED), i(value) { }
+        explicit piece_t(long value) : kind(SIGNED), i(value) { }
+        explicit piece_t(long long value) : kind(SIGNED), i(value) { }
+        explicit piece_t(unsigned int value) : kind(UNSIGNED), u(value) { }
+        explicit piece_t(unsigned long value) : kind(UNSIGNED), u(value) { }
+        explicit piece_t(unsigned long long value) : kind(UNSIGNED), u(value) { }
+        explicit piece_t(double value) : kind(REAL), d(value) { }
+
+        template <typename T>
+        explicit piece_t(T* value) : kind(POINTER), p(value) { }
+
+        template <typename T>
+        explicit piece_t(const T& value) : kind(TEXT)
+        {
+            std::ostringstream ss;
+            ss << value;
+            text = ss.str();
+        }
+
+        kind_t kind;
+        std::string text;
+        union
+        {
+            long long i;
+            unsigned long long u;
+            double d;
+            const void* p;
+        };
+    };
+
+    // Sink output has no severity of its own, so deferred lines start with their level as "[error] "
+    struct Formatter
+    {
+        Formatter(level_t level, std::vector<piece_t>&& pieces) : level(level), pieces(std::move(pieces)) { }
+
+        std::string operator()() const { return std::string("[") + levelName(level) + "] " + text(pieces); }
+
+        static std::string text(const std::vector<piece_t>& pieces)
+        {
+            std::ostringstream ss;
+            for (auto& piece: pieces)
+            {
+                switch (piece.kind)
+                {
+                case piece_t::TEXT:     ss << piece.text; break;
+                case piece_t::SIGNED:   ss << piece.i; break;
+                case piece_t::UNSIGNED: ss << piece.u; break;
+                case piece_t::REAL:     ss << piece.d; break;
+                case piece_t::POINTER:  ss << piece.p; break;
+                }
+            }
+            return ss.str();
+        }
+
+        level_t level;
+        std::vector<piece_t> pieces;
+    };
+
+    level_t m_level;
+    std::vector<piece_t> m_pieces;
+};
+
+}
+
+}
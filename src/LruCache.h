@@ -0,0 +1,150 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// LruCache.h
+//
+// Copyright (c) 2014 Eric Lombrozo
+//
+// All Rights Reserved.
+
+#pragma once
+
+#include <chrono>
+#include <list>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+namespace WebSocket
+{
+
+// Thread-safe cache with per-entry time to live and a total cost budget. Once the budget is exceeded the least
+// recently used entries are evicted. Entries can carry a tag so related entries can be dropped together.
+template<typename V>
+class LruCache
+{
+public:
+    explicit LruCache(std::size_t budget) : m_budget(budget), m_cost(0) { }
+
+    void setBudget(std::size_t budget)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_budget = budget;
+        evict();
+    }
+
+    void put(const std::string& key, const V& value, std::size_t cost, unsigned int ttl, const std::string& tag = std::string())
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        typename index_t::iterator it = m_index.find(key);
+        if (it != m_index.end()) { remove(it->second); }
+        if (cost > m_budget) return;
+
+        entry_t entry;
+        entry.key = key;
+        entry.value = value;
+        entry.cost = cost;
+        entry.tag = tag;
+        entry.expiry = std::chrono::steady_clock::now() + std::chrono::milliseconds(ttl);
+        m_entries.push_front(entry);
+        m_index[key] = m_entries.begin();
+        if (!tag.empty()) { m_tags[tag].insert(key); }
+        m_cost += cost;
+        evict();
+    }
+
+    bool get(const std::string& key, V& value)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        typename index_t::iterator it = m_index.find(key);
+        if (it == m_index.end()) return false;
+        if (std::chrono::steady_clock::now() >= it->second->expiry)
+        {
+            remove(it->second);
+            return false;
+        }
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        value = it->second->value;
+        return true;
+    }
+
+    void erase(const std::string& key)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        typename index_t::iterator it = m_index.find(key);
+        if (it != m_index.end()) { remove(it->second); }
+    }
+
+    void eraseTag(const std::string& tag)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::map<std::string, std::set<std::string>>::iterator tagIt = m_tags.find(tag);
+        if (tagIt == m_tags.end()) return;
+        std::set<std::string> keys;
+        keys.swap(tagIt->second);
+        m_tags.erase(tagIt);
+        for (auto& key: keys)
+        {
+            typename index_t::iterator it = m_index.find(key);
+            if (it != m_index.end()) { remove(it->second); }
+        }
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_entries.clear();
+        m_index.clear();
+        m_tags.clear();
+        m_cost = 0;
+    }
+
+    std::size_t size()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_index.size();
+    }
+
+private:
+    struct entry_t
+    {
+        std::string key;
+        V value;
+        std::size_t cost;
+        std::string tag;
+        std::chrono::steady_clock::time_point expiry;
+    };
+    typedef std::list<entry_t> entries_t;   // most recently used first
+    typedef std::unordered_map<std::string, typename entries_t::iterator> index_t;
+
+    entries_t m_entries;
+    index_t m_index;
+    std::map<std::string, std::set<std::string>> m_tags;
+    std::size_t m_budget;
+    std::size_t m_cost;
+    std::mutex m_mutex;
+
+    void remove(typename entries_t::iterator it)
+    {
+        if (!it->tag.empty())
+        {
+            std::map<std::string, std::set<std::string>>::iterator tagIt = m_tags.find(it->tag);
+            if (tagIt != m_tags.end())
+            {
+                tagIt->second.erase(it->key);
+                if (tagIt->second.empty()) { m_tags.erase(tagIt); }
+            }
+        }
+        m_cost -= it->cost;
+        m_index.erase(it->key);
+        m_entries.erase(it);
+    }
+
+    void evict()
+    {
+        while (m_cost > m_budget && !m_entries.empty()) { remove(--m_entries.end()); }
+    }
+};
+
+}
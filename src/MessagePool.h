@@ -0,0 +1,179 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// MessagePool.h
+//
+// Copyright (c) 2014 Eric Lombrozo
+//
+// All Rights Reserved.
+
+#pragma once
+
+#include "MpmcQueue.h"
+
+#include <websocketpp/common/memory.hpp>
+#include <websocketpp/frame.hpp>
+#include <websocketpp/message_buffer/message.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace WebSocket
+{
+
+const std::size_t MESSAGE_POOL_FREE_LIST_SIZE = 1024;               // recycled payload buffers, shared by all threads
+const std::size_t MESSAGE_POOL_MAX_BYTES = 16 * 1024 * 1024;        // total capacity the free list may hold
+const std::size_t MESSAGE_POOL_MIN_CAPACITY = 4096;                 // payload bytes a recycled buffer may always keep
+
+namespace pool
+{
+
+// Payload buffers of dropped messages, shared by every thread: messages are usually built on the sending
+// thread and dropped on an io thread once written. Buffers much larger than the recent average message size
+// are freed instead of pooled so one large message doesn't pin its memory.
+class buffer_pool
+{
+public:
+    // Swaps a recycled buffer, if any, into the empty payload and reserves size bytes
+    static void take(std::string& payload, std::size_t size)
+    {
+        std::string buffer;
+        if (free_list().pop(buffer))
+        {
+            pooled_bytes().fetch_sub(buffer.capacity(), std::memory_order_relaxed);
+            buffer.clear();
+            payload.swap(buffer);
+        }
+        if (payload.capacity() < size) { payload.reserve(size); }
+    }
+
+    static void give(std::string& payload)
+    {
+        // Moving average over the last ~16 messages. Races between threads only blur it. Payloads moved out
+        // of their message, like inbound requests, leave it empty and say nothing about message sizes.
+        std::size_t size = payload.size();
+        std::size_t average = average_size().load(std::memory_order_relaxed);
+        if (size > 0)
+        {
+            average = average - average / 16 + size / 16;
+            average_size().store(average, std::memory_order_relaxed);
+        }
+
+        if (payload.capacity() > std::max(MESSAGE_POOL_MIN_CAPACITY, 2 * average)) return;
+
+        std::size_t capacity = payload.capacity();
+        if (capacity == 0) return;
+        if (pooled_bytes().fetch_add(capacity, std::memory_order_relaxed) + capacity > MESSAGE_POOL_MAX_BYTES || !free_list().push(std::move(payload)))
+        {
+            pooled_bytes().fetch_sub(capacity, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    // Never destroyed, so messages dropped during static destruction can still be released
+    static MpmcQueue<std::string>& free_list()
+    {
+        static MpmcQueue<std::string>* freeList = new MpmcQueue<std::string>(MESSAGE_POOL_FREE_LIST_SIZE);
+        return *freeList;
+    }
+
+    static std::atomic<std::size_t>& pooled_bytes()
+    {
+        static std::atomic<std::size_t> pooledBytes(0);
+        return pooledBytes;
+    }
+
+    static std::atomic<std::size_t>& average_size()
+    {
+        static std::atomic<std::size_t> averageSize(0);
+        return averageSize;
+    }
+};
+
+// A websocketpp message whose payload buffer comes from and goes back to the buffer pool
+template <typename message>
+class pooled_message : public message
+{
+public:
+    explicit pooled_message(typename message::con_msg_man_ptr manager) : message(manager)
+    {
+        buffer_pool::take(this->get_raw_payload(), 0);
+    }
+
+    pooled_message(typename message::con_msg_man_ptr manager, websocketpp::frame::opcode::value op, size_t size) : message(manager, op, 0)
+    {
+        buffer_pool::take(this->get_raw_payload(), size);
+    }
+
+    ~pooled_message() { buffer_pool::give(this->get_raw_payload()); }
+};
+
+// Drop-in replacement for websocketpp's message_buffer::alloc managers. Each message and its reference count
+// are one allocation, and payload buffers are recycled through the buffer pool.
+template <typename message>
+class con_msg_manager : public websocketpp::lib::enable_shared_from_this<con_msg_manager<message>>
+{
+public:
+    typedef con_msg_manager<message> type;
+    typedef websocketpp::lib::shared_ptr<type> ptr;
+    typedef websocketpp::lib::weak_ptr<type> weak_ptr;
+    typedef typename message::ptr message_ptr;
+
+    message_ptr get_message()
+    {
+        return websocketpp::lib::make_shared<pooled_message<message>>(type::shared_from_this());
+    }
+
+    message_ptr get_message(websocketpp::frame::opcode::value op, size_t size)
+    {
+        return websocketpp::lib::make_shared<pooled_message<message>>(type::shared_from_this(), op, size);
+    }
+
+    // Payload buffers return to the pool when the message is destroyed
+    bool recycle(message*) { return true; }
+};
+
+// One prepared message holding the frames of messages back to back, with an empty header. websocketpp writes
+// a queued message as its header and payload buffers, so a joined batch goes out in a single write.
+template <typename message_ptr, typename manager_ptr>
+message_ptr join_prepared(const std::vector<message_ptr>& messages, manager_ptr manager)
+{
+    std::size_t size = 0;
+    for (auto& msg: messages) { size += msg->get_header().size() + msg->get_payload().size(); }
+
+    message_ptr joined = manager->get_message(websocketpp::frame::opcode::text, size);
+    std::string& payload = joined->get_raw_payload();
+    for (auto& msg: messages)
+    {
+        payload += msg->get_header();
+        payload += msg->get_payload();
+    }
+    joined->set_prepared(true);
+    return joined;
+}
+
+template <typename con_msg_manager>
+class endpoint_msg_manager
+{
+public:
+    typedef endpoint_msg_manager<con_msg_manager> type;
+    typedef websocketpp::lib::shared_ptr<type> ptr;
+    typedef typename con_msg_manager::ptr con_msg_man_ptr;
+
+    con_msg_man_ptr get_manager() const { return con_msg_man_ptr(new con_msg_manager()); }
+};
+
+}
+
+// Any websocketpp config with its message managers swapped for the pooled ones
+template <typename base>
+struct PooledConfig : public base
+{
+    typedef PooledConfig<base> type;
+    typedef websocketpp::message_buffer::message<pool::con_msg_manager> message_type;
+    typedef pool::con_msg_manager<message_type> con_msg_manager_type;
+    typedef pool::endpoint_msg_manager<con_msg_manager_type> endpoint_msg_manager_type;
+};
+
+}
@@ -0,0 +1,115 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// MpmcQueue.h
+//
+// Copyright (c) 2014 Eric Lombrozo
+//
+// All Rights Reserved.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace WebSocket
+{
+
+// Bounded multi-producer multi-consumer queue on a ring of cells, each tagged with a sequence number that
+// says whether it is free to write or ready to read. push() and pop() claim a cell with one compare-and-swap
+// and never block: push() fails when the ring is full and pop() when it is empty. Capacity is rounded up to
+// a power of two.
+template <typename T>
+class MpmcQueue
+{
+public:
+    explicit MpmcQueue(std::size_t capacity) : m_enqueuePos(0), m_dequeuePos(0)
+    {
+        std::size_t size = 2;
+        while (size < capacity) { size <<= 1; }
+        m_cells = std::vector<cell_t>(size);
+        for (std::size_t i = 0; i < size; i++) { m_cells[i].sequence.store(i, std::memory_order_relaxed); }
+        m_mask = size - 1;
+    }
+
+    // Moves value in. Returns false, leaving value untouched, if the queue is full.
+    bool push(T&& value)
+    {
+        std::size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+        cell_t* cell;
+        for (;;)
+        {
+            cell = &m_cells[pos & m_mask];
+            std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t dif = (std::ptrdiff_t)sequence - (std::ptrdiff_t)pos;
+            if (dif == 0)
+            {
+                if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            }
+            else if (dif < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = std::move(value);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool push(const T& value)
+    {
+        T copy(value);
+        return push(std::move(copy));
+    }
+
+    // Returns false if the queue is empty
+    bool pop(T& value)
+    {
+        std::size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+        cell_t* cell;
+        for (;;)
+        {
+            cell = &m_cells[pos & m_mask];
+            std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t dif = (std::ptrdiff_t)sequence - (std::ptrdiff_t)(pos + 1);
+            if (dif == 0)
+            {
+                if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            }
+            else if (dif < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        value = std::move(cell->value);
+        cell->value = T();
+        cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    MpmcQueue(const MpmcQueue&);
+    MpmcQueue& operator=(const MpmcQueue&);
+
+    struct cell_t
+    {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    std::vector<cell_t> m_cells;
+    std::size_t m_mask;
+    std::atomic<std::size_t> m_enqueuePos;
+    std::atomic<std::size_t> m_dequeuePos;
+};
+
+}
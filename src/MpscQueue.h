@@ -0,0 +1,69 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// MpscQueue.h
+//
+// Copyright (c) 2014 Eric Lombrozo
+//
+// All Rights Reserved.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace WebSocket
+{
+
+// Unbounded multi-producer single-consumer queue. push() is wait-free: one atomic exchange on the head and
+// a store linking the previous node. Only one thread may pop(). Values from one producer come out in order.
+template <typename T>
+class MpscQueue
+{
+public:
+    MpscQueue() : m_tail(new node_t()) { m_head.store(m_tail); }
+
+    ~MpscQueue()
+    {
+        T value;
+        while (pop(value)) { }
+        delete m_tail;
+    }
+
+    void push(const T& value)
+    {
+        node_t* node = new node_t(value);
+        node_t* prev = m_head.exchange(node);
+        prev->next.store(node);
+    }
+
+    // Returns false if the queue is empty. A value whose push() is still in progress may be missed; it is
+    // returned by a later pop().
+    bool pop(T& value)
+    {
+        node_t* next = m_tail->next.load();
+        if (!next) return false;
+
+        value = std::move(next->value);
+        delete m_tail;
+        m_tail = next;
+        return true;
+    }
+
+private:
+    MpscQueue(const MpscQueue&);
+    MpscQueue& operator=(const MpscQueue&);
+
+    struct node_t
+    {
+        node_t() : next(NULL) { }
+        explicit node_t(const T& value) : value(value), next(NULL) { }
+        T value;
+        std::atomic<node_t*> next;
+    };
+
+    std::atomic<node_t*> m_head;    // last pushed node, shared by producers
+    node_t* m_tail;                 // already consumed node whose next is the front, consumer only
+};
+
+}
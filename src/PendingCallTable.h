@@ -0,0 +1,164 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// PendingCallTable.h
+//
+// Copyright (c) 2014 Eric Lombrozo
+//
+// All Rights Reserved.
+
+#pragma once
+
+#include <mutex>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+namespace WebSocket
+{
+
+// Calls awaiting a reply, indexed by sequence id. Ids are striped over shards, each an open-addressed table
+// with linear probing under its own lock, so callers on different threads rarely contend. Sequential ids
+// land in consecutive slots and removal shifts followers back, so probes stay short without tombstones.
+template <typename T>
+class PendingCallTable
+{
+public:
+    explicit PendingCallTable(std::size_t shardCapacity = 64)
+    {
+        std::size_t capacity = 1;
+        while (capacity < shardCapacity) { capacity <<= 1; }
+        for (auto& shard: m_shards) { shard.slots.resize(capacity); }
+    }
+
+    // Replaces any call already pending under id
+    void insert(uint64_t id, const T& value)
+    {
+        shard_t& shard = m_shards[id & SHARD_MASK];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if ((shard.count + 1) * 2 > shard.slots.size()) { grow(shard); }
+        place(shard, id, value);
+    }
+
+    // Removes the call pending under id into value. Returns false if there is none.
+    bool take(uint64_t id, T& value)
+    {
+        shard_t& shard = m_shards[id & SHARD_MASK];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        std::size_t mask = shard.slots.size() - 1;
+        std::size_t i = home(id, mask);
+        for (std::size_t probe = 0; probe <= shard.maxProbe; probe++, i = (i + 1) & mask)
+        {
+            slot_t& slot = shard.slots[i];
+            if (!slot.bUsed) return false;
+            if (slot.id != id) continue;
+
+            value = slot.value;
+            erase(shard, i);
+            return true;
+        }
+        return false;
+    }
+
+    // Removes every pending call
+    std::vector<std::pair<uint64_t, T>> takeAll()
+    {
+        std::vector<std::pair<uint64_t, T>> calls;
+        for (auto& shard: m_shards)
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            for (auto& slot: shard.slots)
+            {
+                if (!slot.bUsed) continue;
+                calls.push_back(std::make_pair(slot.id, slot.value));
+                slot = slot_t();
+            }
+            shard.count = 0;
+            shard.maxProbe = 0;
+        }
+        return calls;
+    }
+
+    std::size_t size() const
+    {
+        std::size_t count = 0;
+        for (auto& shard: m_shards)
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            count += shard.count;
+        }
+        return count;
+    }
+
+private:
+    enum { SHARD_BITS = 4, SHARD_MASK = (1 << SHARD_BITS) - 1 };
+
+    struct slot_t
+    {
+        slot_t() : id(0), bUsed(false) { }
+        uint64_t id;
+        bool bUsed;
+        T value;
+    };
+
+    struct shard_t
+    {
+        shard_t() : count(0), maxProbe(0) { }
+        mutable std::mutex mutex;
+        std::vector<slot_t> slots;
+        std::size_t count;
+        std::size_t maxProbe;   // longest displacement from a home slot, bounds lookups
+    };
+
+    shard_t m_shards[1 << SHARD_BITS];
+
+    static std::size_t home(uint64_t id, std::size_t mask) { return (std::size_t)(id >> SHARD_BITS) & mask; }
+
+    static void place(shard_t& shard, uint64_t id, const T& value)
+    {
+        std::size_t mask = shard.slots.size() - 1;
+        std::size_t i = home(id, mask);
+        for (std::size_t probe = 0; ; probe++, i = (i + 1) & mask)
+        {
+            slot_t& slot = shard.slots[i];
+            if (slot.bUsed && slot.id != id) continue;
+
+            if (!slot.bUsed) { shard.count++; }
+            slot.id = id;
+            slot.bUsed = true;
+            slot.value = value;
+            if (probe > shard.maxProbe) { shard.maxProbe = probe; }
+            return;
+        }
+    }
+
+    static void erase(shard_t& shard, std::size_t i)
+    {
+        // Backward shift: pull later entries of the probe run into the hole unless that would move them
+        // before their home slot
+        std::size_t mask = shard.slots.size() - 1;
+        for (std::size_t j = (i + 1) & mask; shard.slots[j].bUsed; j = (j + 1) & mask)
+        {
+            std::size_t k = home(shard.slots[j].id, mask);
+            bool bStays = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+            if (bStays) continue;
+            shard.slots[i] = shard.slots[j];
+            i = j;
+        }
+        shard.slots[i] = slot_t();
+        shard.count--;
+    }
+
+    static void grow(shard_t& shard)
+    {
+        std::vector<slot_t> slots(shard.slots.size() * 2);
+        slots.swap(shard.slots);
+        shard.count = 0;
+        shard.maxProbe = 0;
+        for (auto& slot: slots)
+        {
+            if (slot.bUsed) { place(shard, slot.id, slot.value); }
+        }
+    }
+};
+
+}
@@ -0,0 +1,90 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// RateLimiter.cpp
+//
+// Copyright (c) 2014 Eric Lombrozo
+//
+// All Rights Reserved.
+
+#include "RateLimiter.h"
+
+#include <algorithm>
+
+using namespace WebSocket;
+
+std::size_t RateLimiter::limiter_key_hash_t::operator()(const limiter_key_t& key) const
+{
+    uint64_t hi, lo;
+    memcpy(&hi, key.bytes, sizeof(hi));
+    memcpy(&lo, key.bytes + sizeof(hi), sizeof(lo));
+    uint64_t h = (hi ^ (lo * 0x9e3779b97f4a7c15ULL)) * 0xff51afd7ed558ccdULL;
+    return (std::size_t)(h ^ (h >> 32));
+}
+
+RateLimiter::RateLimiter(double rate, double burst)
+    : m_rate(rate), m_burst(std::max(burst, 1.0)), m_epoch(std::chrono::steady_clock::now())
+{
+    m_expiry = (uint32_t)std::min(m_burst / m_rate * 1000.0 + 1.0, 86400000.0);
+    m_expiry = std::max<uint32_t>(m_expiry, 1000);
+}
+
+bool RateLimiter::allow(const boost::asio::ip::address& address, double cost)
+{
+    limiter_key_t key;
+    if (address.is_v4())
+    {
+        boost::asio::ip::address_v4::bytes_type v4 = address.to_v4().to_bytes();
+        memset(key.bytes, 0, 10);
+        key.bytes[10] = key.bytes[11] = 0xff;
+        memcpy(key.bytes + 12, &v4[0], 4);
+    }
+    else
+    {
+        boost::asio::ip::address_v6::bytes_type v6 = address.to_v6().to_bytes();
+        memcpy(key.bytes, &v6[0], 16);
+    }
+
+    uint32_t now = (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_epoch).count();
+    std::size_t hash = limiter_key_hash_t()(key);
+    shard_t& shard = m_shards[(hash >> 8) % SHARD_COUNT];
+
+    boost::unique_lock<boost::mutex> lock(shard.mutex);
+    if (now - shard.lastSweep >= m_expiry) { sweep(shard, now); }
+
+    std::pair<buckets_t::iterator, bool> inserted = shard.buckets.insert(std::make_pair(key, bucket_t()));
+    bucket_t& bucket = inserted.first->second;
+    if (inserted.second)
+    {
+        bucket.tokens = m_burst;
+    }
+    else
+    {
+        bucket.tokens = std::min(m_burst, bucket.tokens + (now - bucket.stamp) * m_rate / 1000.0);
+    }
+    bucket.stamp = now;
+
+    if (bucket.tokens < cost) return false;
+    bucket.tokens -= cost;
+    return true;
+}
+
+std::size_t RateLimiter::size()
+{
+    std::size_t count = 0;
+    for (auto& shard: m_shards)
+    {
+        boost::unique_lock<boost::mutex> lock(shard.mutex);
+        count += shard.buckets.size();
+    }
+    return count;
+}
+
+void RateLimiter::sweep(shard_t& shard, uint32_t now)
+{
+    for (buckets_t::iterator it = shard.buckets.begin(); it != shard.buckets.end();)
+    {
+        if (now - it->second.stamp >= m_expiry)    { it = shard.buckets.erase(it); }
+        else                                        { ++it; }
+    }
+    shard.lastSweep = now;
+}
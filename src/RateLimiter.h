@@ -0,0 +1,78 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// RateLimiter.h
+//
+// Copyright (c) 2014 Eric Lombrozo
+//
+// All Rights Reserved.
+
+#pragma once
+
+#include <boost/asio/ip/address.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <chrono>
+#include <stdint.h>
+#include <string.h>
+#include <unordered_map>
+
+namespace WebSocket
+{
+
+// Token buckets keyed by remote address, kept in a lock-sharded table. A bucket that has been idle long
+// enough to refill completely is indistinguishable from a new one, so such buckets are expired.
+class RateLimiter
+{
+public:
+    // rate is in tokens per second and burst is the bucket capacity
+    RateLimiter(double rate, double burst);
+
+    // Takes cost tokens from the address's bucket if it has them
+    bool allow(const boost::asio::ip::address& address, double cost = 1.0);
+
+    std::size_t size();
+
+private:
+    // IPv4 addresses are stored IPv4-mapped
+    struct limiter_key_t
+    {
+        unsigned char bytes[16];
+        bool operator==(const limiter_key_t& rhs) const { return memcmp(bytes, rhs.bytes, sizeof(bytes)) == 0; }
+    };
+
+    struct limiter_key_hash_t
+    {
+        std::size_t operator()(const limiter_key_t& key) const;
+    };
+
+    struct bucket_t
+    {
+        float tokens;
+        uint32_t stamp;         // ms since m_epoch, compared with wrapping arithmetic
+    };
+
+    // Each entry is a 16-byte key and an 8-byte bucket inside an unordered_map node, which adds the next
+    // pointer, usually a cached hash and allocator padding: about 48 bytes on 64-bit builds, plus a bucket
+    // array slot per entry.
+    typedef std::unordered_map<limiter_key_t, bucket_t, limiter_key_hash_t> buckets_t;
+
+    struct shard_t
+    {
+        shard_t() : lastSweep(0) { }
+        boost::mutex mutex;
+        buckets_t buckets;
+        uint32_t lastSweep;
+    };
+
+    enum { SHARD_COUNT = 64 };
+    shard_t m_shards[SHARD_COUNT];
+
+    double m_rate;
+    double m_burst;
+    uint32_t m_expiry;          // ms for an empty bucket to refill
+    std::chrono::steady_clock::time_point m_epoch;
+
+    void sweep(shard_t& shard, uint32_t now);
+};
+
+}
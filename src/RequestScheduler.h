@@ -0,0 +1,113 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// RequestScheduler.h
+//
+// Copyright (c) 2014 Eric Lombrozo
+//
+// All Rights Reserved.
+
+#pragma once
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace WebSocket
+{
+
+const std::string DEFAULT_PRIORITY_CLASS = "default";
+
+// Weighted round-robin over priority classes, with round-robin over sources (connections) inside each class.
+// A class with weight w is served up to w times per round while it has work, so every class with queued
+// items is served at least once per round and one source's burst only delays its own requests.
+// Not thread-safe - callers provide the locking.
+template<typename T, typename Source>
+class RequestScheduler
+{
+public:
+    RequestScheduler() : m_size(0), m_current(0), m_credit(1) { m_lanes.push_back(lane_t(DEFAULT_PRIORITY_CLASS, 1)); }
+
+    void setClassWeight(const std::string& priorityClass, unsigned int weight)
+    {
+        m_lanes[getLane(priorityClass)].weight = weight ? weight : 1;
+    }
+
+    void setMethodClass(const std::string& method, const std::string& priorityClass)
+    {
+        m_methodLanes[method] = getLane(priorityClass);
+    }
+
+    void push(const std::string& method, const Source& source, const T& item)
+    {
+        std::size_t index = 0;
+        if (!m_methodLanes.empty())
+        {
+            typename std::map<std::string, std::size_t>::const_iterator it = m_methodLanes.find(method);
+            if (it != m_methodLanes.end()) { index = it->second; }
+        }
+
+        lane_t& lane = m_lanes[index];
+        std::deque<T>& queue = lane.queues[source];
+        if (queue.empty()) { lane.active.push_back(source); }
+        queue.push_back(item);
+        m_size++;
+    }
+
+    // Must not be called when empty
+    T pop()
+    {
+        while (true)
+        {
+            lane_t& lane = m_lanes[m_current];
+            if (m_credit > 0 && !lane.active.empty())
+            {
+                m_credit--;
+                m_size--;
+
+                Source source = lane.active.front();
+                lane.active.pop_front();
+                typename std::map<Source, std::deque<T>>::iterator it = lane.queues.find(source);
+                T item = it->second.front();
+                it->second.pop_front();
+                if (it->second.empty())     { lane.queues.erase(it); }
+                else                        { lane.active.push_back(source); }
+                return item;
+            }
+
+            m_current = (m_current + 1) % m_lanes.size();
+            m_credit = m_lanes[m_current].weight;
+        }
+    }
+
+    bool empty() const { return m_size == 0; }
+    std::size_t size() const { return m_size; }
+
+private:
+    struct lane_t
+    {
+        lane_t(const std::string& name_, unsigned int weight_) : name(name_), weight(weight_) { }
+        std::string name;
+        unsigned int weight;
+        std::map<Source, std::deque<T>> queues;
+        std::deque<Source> active;      // sources with queued items, in service order
+    };
+
+    std::vector<lane_t> m_lanes;
+    std::map<std::string, std::size_t> m_methodLanes;
+    std::size_t m_size;
+    std::size_t m_current;
+    unsigned int m_credit;
+
+    std::size_t getLane(const std::string& priorityClass)
+    {
+        for (std::size_t i = 0; i < m_lanes.size(); i++)
+        {
+            if (m_lanes[i].name == priorityClass) return i;
+        }
+        m_lanes.push_back(lane_t(priorityClass, 1));
+        return m_lanes.size() - 1;
+    }
+};
+
+}
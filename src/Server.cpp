@@ -8,31 +8,96 @@
 
 #include "Server.h"
 #include "JsonRpc.h"
+#include "JsonDelta.h"
+#include "JsonExceptions.h"
+#include "JsonScanner.h"
+#include "Log.h"
 
 #include <logger/logger.h>
 
 #include <boost/lexical_cast.hpp>
 
+#include <algorithm>
+#include <limits>
+
+#include <sys/stat.h>
+
 using namespace WebSocket;
 using namespace std;
 
+namespace {
+
+// Ids given to the calls leading coalesced flights
+const std::string FLIGHT_TOKEN_PREFIX = "coalesced-";
+
+// Ids given to the calls of a batch: the prefix, the batch number, a dash and the call's index
+const std::string BATCH_TOKEN_PREFIX = "batch-";
+
+bool isBatch(const std::string& json)
+{
+    std::size_t pos = json.find_first_not_of(" \t\r\n");
+    return pos != std::string::npos && json[pos] == '[';
+}
+
+#if !defined(USE_TLS)
+// WS_LOG is only used at trace and error
+void writeToLogger(WebSocket::log::level_t level, const std::string& message)
+{
+    if (level >= WebSocket::log::error) { LOGGER(error) << message << endl; }
+    else                                { LOGGER(trace) << message << endl; }
+}
+#endif
+
+}
+
+#if !defined(USE_TLS)
+void WebSocket::log::writeLogger(level_t level, const std::string& message)
+{
+    ::writeToLogger(level, message);
+}
+#endif
+
 #if defined(USE_TLS)
 bool ServerTls::onValidate(websocketpp::connection_hdl hdl)
 #else
 bool ServerNoTls::onValidate(websocketpp::connection_hdl hdl)
 #endif
 {
-    LOGGER(trace) << SERVER_CLASS_NAME << "::onValidate() entered." << endl;
+    WS_LOG(trace) << SERVER_CLASS_NAME << "::onValidate() entered." << endl;
     ws_server_t::connection_ptr con = m_ws_server.get_con_from_hdl(hdl);
-    std::string remote_endpoint = boost::lexical_cast<std::string>(con->get_remote_endpoint());
-    LOGGER(trace) << SERVER_CLASS_NAME << "::onValidate() - Remote endpoint: " << remote_endpoint << endl;
-    if (boost::regex_match(remote_endpoint, m_allow_ips_regex)) {
-        LOGGER(trace) << SERVER_CLASS_NAME << "::onValidate() - IP validation successful." << endl;
+
+    boost::system::error_code ec;
+    boost::asio::ip::address address = con->get_raw_socket().remote_endpoint(ec).address();
+
+    std::shared_ptr<const IpFilter> ipFilter;
+    {
+        boost::unique_lock<boost::mutex> lock(m_ipFilterMutex);
+        ipFilter = m_ipFilter;
+    }
+
+    bool bAllowed;
+    if (ipFilter) {
+        WS_LOG(trace) << SERVER_CLASS_NAME << "::onValidate() - Remote address: " << address << endl;
+        bAllowed = !ec && ipFilter->isAllowed(address);
+    }
+    else {
+        std::string remote_endpoint = boost::lexical_cast<std::string>(con->get_remote_endpoint());
+        WS_LOG(trace) << SERVER_CLASS_NAME << "::onValidate() - Remote endpoint: " << remote_endpoint << endl;
+        bAllowed = boost::regex_match(remote_endpoint, m_allow_ips_regex);
+    }
+
+    if (bAllowed && m_connectionLimiter && !m_connectionLimiter->allow(address)) {
+        WS_LOG(trace) << SERVER_CLASS_NAME << "::onValidate() - Connection rate limit exceeded." << endl;
+        return false;
+    }
+
+    if (bAllowed) {
+        WS_LOG(trace) << SERVER_CLASS_NAME << "::onValidate() - IP validation successful." << endl;
         if (m_validateCallback) { return m_validateCallback(*this, hdl); }
         return true;
     }
     else {
-        LOGGER(trace) << "IP Validation failed." << endl;
+        WS_LOG(trace) << "IP Validation failed." << endl;
         return false;
     }
 }
@@ -43,10 +108,21 @@ void ServerTls::onOpen(websocketpp::connection_hdl hdl)
 void ServerNoTls::onOpen(websocketpp::connection_hdl hdl)
 #endif
 {
-    LOGGER(trace) << SERVER_CLASS_NAME << "::onOpen() called with hdl: " << hdl.lock().get() << endl;
+    WS_LOG(trace) << SERVER_CLASS_NAME << "::onOpen() called with hdl: " << hdl.lock().get() << endl;
+    connection_data_t data;
+    boost::system::error_code ec;
+    ws_server_t::connection_ptr con = m_ws_server.get_con_from_hdl(hdl);
+    data.address = con->get_raw_socket().remote_endpoint(ec).address();
+    con->lastActivity = con->lastMessage = do_now();
     {
         boost::unique_lock<boost::mutex> lock(m_connectionMutex);
-        m_connections.insert(hdl);
+        if (do_isKeepAliveEnabled())
+        {
+            unsigned int interval = m_pingInterval ? m_pingInterval : m_idleTimeout;
+            if (m_idleTimeout) { interval = std::min(interval, m_idleTimeout); }
+            data.keepAliveTimer = m_timerWheel.schedule(interval / TIMER_WHEEL_TICK_MS + 1, websocketpp::lib::bind(&Server::do_checkKeepAlive, this, hdl));
+        }
+        m_connections[hdl] = data;
     }
     if (m_openCallback) { m_openCallback(*this, hdl); }
 }
@@ -57,11 +133,16 @@ void ServerTls::onClose(websocketpp::connection_hdl hdl)
 void ServerNoTls::onClose(websocketpp::connection_hdl hdl)
 #endif
 {
-    LOGGER(trace) << SERVER_CLASS_NAME << "::onClose() called with hdl: " << hdl.lock().get() << endl;
+    WS_LOG(trace) << SERVER_CLASS_NAME << "::onClose() called with hdl: " << hdl.lock().get() << endl;
     {
         boost::unique_lock<boost::mutex> lock(m_connectionMutex);
         do_removeFromAllChannels(hdl);
-        m_connections.erase(hdl);
+        connections_t::iterator it = m_connections.find(hdl);
+        if (it != m_connections.end())
+        {
+            do_closeConnectionData(hdl, it->second);
+            m_connections.erase(it);
+        }
     }
     if (m_closeCallback) { m_closeCallback(*this, hdl); }
 }
@@ -74,7 +155,7 @@ void ServerNoTls::onFail(websocketpp::connection_hdl hdl)
 {
     ws_server_t::connection_ptr con = m_ws_server.get_con_from_hdl(hdl);
     string error = con->get_ec().message();
-    LOGGER(trace) << SERVER_CLASS_NAME << "::onFail() called with hdl: " << hdl.lock().get() << " Error: " << error << " Value: " << con->get_ec().value() << endl;
+    WS_LOG(trace) << SERVER_CLASS_NAME << "::onFail() called with hdl: " << hdl.lock().get() << " Error: " << error << " Value: " << con->get_ec().value() << endl;
 
 /*
     {
@@ -92,42 +173,442 @@ void ServerTls::onMessage(websocketpp::connection_hdl hdl, ws_server_t::message_
 void ServerNoTls::onMessage(websocketpp::connection_hdl hdl, ws_server_t::message_ptr msg)
 #endif
 {
-    LOGGER(trace) << SERVER_CLASS_NAME << "::onMessage() called with hdl: " << hdl.lock().get()
+    WS_LOG(trace) << SERVER_CLASS_NAME << "::onMessage() called with hdl: " << hdl.lock().get()
                   << " and message: " << msg->get_payload()
                   << endl;
 
     std::stringstream err;
 
+    // Messages still arriving on a connection the server is closing, after an eviction or otherwise, are
+    // dropped without a reply
+    ws_server_t::connection_ptr con = m_ws_server.get_con_from_hdl(hdl);
+    if (con->bClosing || con->get_state() != websocketpp::session::state::open)
+    {
+        WS_LOG(trace) << SERVER_CLASS_NAME << "::onMessage() dropping message on closing hdl " << hdl.lock().get() << endl;
+        return;
+    }
+    if (do_isKeepAliveEnabled()) { con->lastActivity = con->lastMessage = do_now(); }
+
     try {
+        if (isBatch(msg->get_payload())) {
+            do_dispatchBatch(hdl, msg);
+            return;
+        }
+
         JsonRpc::Request request;
-        request.setJson(msg->get_payload());
-        boost::unique_lock<boost::mutex> lock(m_requestMutex);
-        m_requests.push(std::make_pair(hdl, request));
-        lock.unlock();
-        m_requestCond.notify_one();
+        // The request keeps the payload text for its params, so take it rather than copy it
+        request.setJson(std::move(msg->get_raw_payload()));
+        do_dispatchRequest(hdl, request, msg->get_opcode());
     }
     catch (const stdutils::custom_error& e) {
         JsonRpc::Response response;
         response.setError(e);
         string json(response.getJson());
-        LOGGER(trace) << SERVER_CLASS_NAME << "::onMessage() sending error to hdl " << hdl.lock().get() << ": " << json << endl;
-        m_ws_server.send(hdl, json, msg->get_opcode());
+        WS_LOG(trace) << SERVER_CLASS_NAME << "::onMessage() sending error to hdl " << hdl.lock().get() << ": " << json << endl;
+        do_sendError(hdl, json, msg->get_opcode());
     }
     catch (const std::exception& e) {
         JsonRpc::Response response;
         response.setError(e);
         string json(response.getJson());
-        LOGGER(trace) << SERVER_CLASS_NAME << "::onMessage() sending error to hdl " << hdl.lock().get() << ": " << json << endl;
-        m_ws_server.send(hdl, json, msg->get_opcode());
+        WS_LOG(trace) << SERVER_CLASS_NAME << "::onMessage() sending error to hdl " << hdl.lock().get() << ": " << json << endl;
+        do_sendError(hdl, json, msg->get_opcode());
+    }
+}
+
+#if defined(USE_TLS)
+std::chrono::steady_clock::time_point ServerTls::do_dispatchRequest(websocketpp::connection_hdl hdl, JsonRpc::Request& request, websocketpp::frame::opcode::value op)
+#else
+std::chrono::steady_clock::time_point ServerNoTls::do_dispatchRequest(websocketpp::connection_hdl hdl, JsonRpc::Request& request, websocketpp::frame::opcode::value op)
+#endif
+{
+    // Answers the request here if it can and queues it for the request callback otherwise. Returns its
+    // deadline, time_point::max() if it has none.
+    std::chrono::steady_clock::time_point arrival = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    uint64_t timeout = request.getTimeout();
+    uint64_t defaultTimeout = m_requestTimeout;
+    if (!m_methodTimeouts.empty())
+    {
+        auto it = m_methodTimeouts.find(request.getMethod());
+        if (it != m_methodTimeouts.end()) { defaultTimeout = it->second; }
+    }
+    if (defaultTimeout && (!timeout || defaultTimeout < timeout)) { timeout = defaultTimeout; }
+    if (timeout) { deadline = arrival + std::chrono::milliseconds(timeout); }
+
+    if (request.getMethod() == JsonRpc::DELTA_RESYNC_METHOD && do_resync(hdl, request)) {
+        JsonRpc::Response response;
+        response.setResult(true, request.getId());
+        send(hdl, response);
+        return deadline;
+    }
+    if (!do_allowRequest(hdl, request.getMethod())) {
+        JsonRpc::Response response;
+        response.setError(JsonRpc::RateLimitExceededException(), request.getId());
+        if (m_batchCount > 0 && do_completeBatch(hdl, response)) return deadline;
+        string json(response.getJson());
+        WS_LOG(trace) << SERVER_CLASS_NAME << "::do_dispatchRequest() sending error to hdl " << hdl.lock().get() << ": " << json << endl;
+        do_sendError(hdl, json, op);
+        return deadline;
+    }
+
+    if (do_isTrackingFlights())
+    {
+        const std::string& method = request.getMethod();
+        bool bCached = m_cachedMethods.count(method) > 0;
+        if (bCached || m_coalescedMethods.count(method))
+        {
+            std::string key = request.getKey();
+            if (bCached && do_sendCachedResult(hdl, request, key)) return deadline;
+            if (do_joinFlight(hdl, request, key, deadline)) return deadline;
+        }
+    }
+
+    queued_request_t item = { std::make_pair(hdl, request), arrival, deadline };
+
+    boost::unique_lock<boost::mutex> lock(m_requestMutex);
+    m_requests.push(request.getMethod(), hdl.lock().get(), item);
+    lock.unlock();
+    m_requestCond.notify_one();
+    return deadline;
+}
+
+#if defined(USE_TLS)
+void ServerTls::do_dispatchBatch(websocketpp::connection_hdl hdl, ws_server_t::message_ptr msg)
+#else
+void ServerNoTls::do_dispatchBatch(websocketpp::connection_hdl hdl, ws_server_t::message_ptr msg)
+#endif
+{
+    // Each call is dispatched on its own with its id replaced by a token naming the batch and the call's
+    // slot. Replies carrying a token fill the slot, and the array goes out once no slot is pending.
+    const std::string& json = msg->get_payload();
+    JsonRpc::JsonScanner scanner(json);
+    std::vector<JsonRpc::JsonScanner::slice_t> elements = scanner.elements(scanner.root());
+    if (elements.empty()) throw JsonRpc::JsonInvalidException(json);
+
+    std::shared_ptr<batch_t> batch(new batch_t());
+    batch->hdl = hdl;
+    batch->ids.resize(elements.size());
+    batch->replies.resize(elements.size());
+    batch->pending.resize(elements.size(), false);
+    batch->remaining = 1;
+    uint64_t number;
+    {
+        boost::unique_lock<boost::mutex> lock(m_batchMutex);
+        number = m_nextBatch++;
+        m_batches[number] = batch;
+    }
+    m_batchCount++;
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point expiry = now;
+    for (std::size_t i = 0; i < elements.size(); i++)
+    {
+        JsonRpc::Request request;
+        JsonRpc::Response error;
+        bool bInvalid = false;
+        try {
+            request.setJson(scanner.text(elements[i]));
+        }
+        catch (const stdutils::custom_error& e) {
+            error.setError(e);
+            bInvalid = true;
+        }
+        catch (const std::exception& e) {
+            error.setError(e);
+            bInvalid = true;
+        }
+
+        if (!bInvalid && request.getId().is_null())
+        {
+            // Notifications get no reply, errors included
+            try {
+                do_dispatchRequest(hdl, request, msg->get_opcode());
+            }
+            catch (const std::exception& e) {
+                WS_LOG(trace) << SERVER_CLASS_NAME << "::do_dispatchBatch() - Error: " << e.what() << endl;
+            }
+            continue;
+        }
+
+        {
+            boost::unique_lock<boost::mutex> lock(m_batchMutex);
+            batch->ids[i] = bInvalid ? json_spirit::Value() : request.getId();
+            batch->pending[i] = true;
+            batch->remaining++;
+        }
+        if (bInvalid) {
+            do_setBatchReply(number, i, error.getJson());
+            continue;
+        }
+
+        request.setId(BATCH_TOKEN_PREFIX + boost::lexical_cast<std::string>(number) + "-" + boost::lexical_cast<std::string>(i));
+        try {
+            expiry = std::max(expiry, do_dispatchRequest(hdl, request, msg->get_opcode()));
+        }
+        catch (const stdutils::custom_error& e) {
+            error.setError(e, batch->ids[i]);
+            do_setBatchReply(number, i, error.getJson());
+        }
+        catch (const std::exception& e) {
+            error.setError(e, batch->ids[i]);
+            do_setBatchReply(number, i, error.getJson());
+        }
+    }
+
+    uint64_t timeout = DEFAULT_BATCH_TIMEOUT;
+    if (expiry != std::chrono::steady_clock::time_point::max()) { timeout = std::chrono::duration_cast<std::chrono::milliseconds>(expiry - now).count(); }
+    {
+        boost::unique_lock<boost::mutex> lock(m_batchMutex);
+        batch->expiryTimer = m_timerWheel.schedule(timeout / TIMER_WHEEL_TICK_MS + 1, websocketpp::lib::bind(&Server::do_expireBatch, this, number));
+    }
+
+    // Every call is dispatched: release the hold taken above
+    do_setBatchReply(number, std::string::npos, std::string());
+}
+
+#if defined(USE_TLS)
+bool ServerTls::do_completeBatch(websocketpp::connection_hdl hdl, const JsonRpc::Response& res)
+#else
+bool ServerNoTls::do_completeBatch(websocketpp::connection_hdl hdl, const JsonRpc::Response& res)
+#endif
+{
+    // Returns true if res answered a call in a batch, or one in a batch that has already been answered
+    if (res.getId().type() != json_spirit::str_type) return false;
+    const std::string& token = res.getId().get_str();
+    if (token.compare(0, BATCH_TOKEN_PREFIX.size(), BATCH_TOKEN_PREFIX) != 0) return false;
+    std::size_t dash = token.find('-', BATCH_TOKEN_PREFIX.size());
+    if (dash == std::string::npos) return false;
+
+    uint64_t number;
+    std::size_t index;
+    try {
+        number = boost::lexical_cast<uint64_t>(token.substr(BATCH_TOKEN_PREFIX.size(), dash - BATCH_TOKEN_PREFIX.size()));
+        index = boost::lexical_cast<std::size_t>(token.substr(dash + 1));
+    }
+    catch (const boost::bad_lexical_cast& e) {
+        return false;
+    }
+
+    json_spirit::Value id;
+    {
+        boost::unique_lock<boost::mutex> lock(m_batchMutex);
+        auto it = m_batches.find(number);
+        if (it == m_batches.end()) return number < m_nextBatch;     // late reply to an expired batch
+
+        // Only the batch's own connection can answer for it
+        const batch_t& batch = *it->second;
+        if (batch.hdl.owner_before(hdl) || hdl.owner_before(batch.hdl)) return false;
+        if (index >= batch.pending.size() || !batch.pending[index]) return true;
+        id = batch.ids[index];
+    }
+
+    JsonRpc::Response reply;
+    if (res.getError().is_null())   { reply.setResult(res.getResult(), id); }
+    else                            { reply.setError(res.getError(), id); }
+    do_setBatchReply(number, index, reply.getJson());
+    return true;
+}
+
+#if defined(USE_TLS)
+bool ServerTls::do_completeBatch(websocketpp::connection_hdl hdl, const std::string& data)
+#else
+bool ServerNoTls::do_completeBatch(websocketpp::connection_hdl hdl, const std::string& data)
+#endif
+{
+    // Raw text replies are only parsed if they might carry a batch token
+    if (data.find(BATCH_TOKEN_PREFIX) == std::string::npos) return false;
+
+    JsonRpc::Response res;
+    try {
+        res.setJson(data);
+    }
+    catch (const std::exception& e) {
+        return false;
+    }
+    return do_completeBatch(hdl, res);
+}
+
+#if defined(USE_TLS)
+void ServerTls::do_setBatchReply(uint64_t number, std::size_t index, const std::string& json)
+#else
+void ServerNoTls::do_setBatchReply(uint64_t number, std::size_t index, const std::string& json)
+#endif
+{
+    // index == npos only releases the hold do_dispatchBatch() keeps while dispatching
+    std::shared_ptr<batch_t> batch;
+    {
+        boost::unique_lock<boost::mutex> lock(m_batchMutex);
+        auto it = m_batches.find(number);
+        if (it == m_batches.end()) return;
+        batch = it->second;
+        if (index != std::string::npos)
+        {
+            if (index >= batch->pending.size() || !batch->pending[index]) return;
+            batch->pending[index] = false;
+            batch->replies[index] = json;
+        }
+        if (--batch->remaining > 0) return;
+        m_batches.erase(it);
+    }
+    m_batchCount--;
+    m_timerWheel.cancel(batch->expiryTimer);
+
+    std::string array;
+    for (auto& reply: batch->replies)
+    {
+        if (reply.empty()) continue;
+        array += array.empty() ? '[' : ',';
+        array += reply;
+    }
+    if (array.empty()) return;      // only notifications
+    array += ']';
+
+    boost::unique_lock<boost::mutex> lock(m_connectionMutex);
+    if (!m_bRunning || m_connections.count(batch->hdl) == 0) return;
+    WS_LOG(trace) << SERVER_CLASS_NAME << "::do_setBatchReply() sending batch response to hdl " << batch->hdl.lock().get() << ": " << array << endl;
+    do_write(batch->hdl, array);
+}
+
+#if defined(USE_TLS)
+void ServerTls::do_expireBatch(uint64_t number)
+#else
+void ServerNoTls::do_expireBatch(uint64_t number)
+#endif
+{
+    std::vector<std::pair<std::size_t, json_spirit::Value>> expired;
+    {
+        boost::unique_lock<boost::mutex> lock(m_batchMutex);
+        auto it = m_batches.find(number);
+        if (it == m_batches.end()) return;
+        const batch_t& batch = *it->second;
+        for (std::size_t i = 0; i < batch.pending.size(); i++)
+        {
+            if (batch.pending[i]) { expired.push_back(std::make_pair(i, batch.ids[i])); }
+        }
+    }
+
+    WS_LOG(trace) << SERVER_CLASS_NAME << "::do_expireBatch() " << expired.size() << " calls in batch " << number << " timed out" << endl;
+    for (auto& call: expired)
+    {
+        JsonRpc::Response response;
+        response.setError(JsonRpc::RequestTimeoutException(), call.second);
+        do_setBatchReply(number, call.first, response.getJson());
     }
 }
 
 #if defined(USE_TLS)
 ServerTls::context_ptr ServerTls::onTlsInit(websocketpp::connection_hdl hdl)
 {
-    LOGGER(trace) << SERVER_CLASS_NAME << "::onTlsInit() called with hdl: " << hdl.lock().get() << endl;
-    if (m_tlsInitCallback) { return m_tlsInitCallback(*this, hdl); }
-    return context_ptr();
+    WS_LOG(trace) << SERVER_CLASS_NAME << "::onTlsInit() called with hdl: " << hdl.lock().get() << endl;
+    boost::unique_lock<boost::mutex> lock(m_tlsMutex);
+    if (!m_certChainFile.empty())
+    {
+        time_t now = time(NULL);
+        if (!m_tlsContext || now - m_tlsLastCheck >= TLS_FILES_CHECK_INTERVAL)
+        {
+            m_tlsLastCheck = now;
+            time_t mtime = do_getTlsFilesMTime();
+            if (!m_tlsContext || mtime != m_tlsFilesMTime)
+            {
+                try
+                {
+                    context_ptr ctx = do_newTlsContext();
+                    m_tlsContext = ctx;
+                    m_tlsFilesMTime = mtime;
+                    WS_LOG(trace) << SERVER_CLASS_NAME << "::onTlsInit() - TLS context loaded." << endl;
+                }
+                catch (const std::exception& e)
+                {
+                    // Keep serving with the previous context until the files are fixed
+                    WS_LOG(error) << SERVER_CLASS_NAME << "::onTlsInit() - Error loading TLS files: " << e.what() << endl;
+                }
+            }
+        }
+        return m_tlsContext;
+    }
+
+    if (!m_tlsInitCallback) return context_ptr();
+    if (!m_bCacheTlsContext)
+    {
+        lock.unlock();
+        return m_tlsInitCallback(*this, hdl);
+    }
+    if (!m_tlsContext)
+    {
+        m_tlsContext = m_tlsInitCallback(*this, hdl);
+        if (m_tlsContext) { do_initTlsSessionCache(m_tlsContext, context_ptr()); }
+    }
+    return m_tlsContext;
+}
+
+void ServerTls::setTlsInitCallback(tls_init_callback_t callback, bool bCache)
+{
+    boost::unique_lock<boost::mutex> lock(m_tlsMutex);
+    m_tlsInitCallback = callback;
+    m_bCacheTlsContext = bCache;
+    m_tlsContext.reset();
+}
+
+void ServerTls::setTlsFiles(const std::string& certChainFile, const std::string& privateKeyFile, const std::string& dhFile)
+{
+    boost::unique_lock<boost::mutex> lock(m_tlsMutex);
+    m_certChainFile = certChainFile;
+    m_privateKeyFile = privateKeyFile;
+    m_dhFile = dhFile;
+    m_tlsContext.reset();
+}
+
+time_t ServerTls::do_getTlsFilesMTime() const
+{
+    time_t mtime = 0;
+    const std::string* files[] = { &m_certChainFile, &m_privateKeyFile, &m_dhFile };
+    for (auto file: files)
+    {
+        struct stat st;
+        if (!file->empty() && stat(file->c_str(), &st) == 0) { mtime = std::max(mtime, st.st_mtime); }
+    }
+    return mtime;
+}
+
+ServerTls::context_ptr ServerTls::do_newTlsContext()
+{
+    context_ptr ctx(new boost::asio::ssl::context(boost::asio::ssl::context::sslv23));
+    ctx->set_options(boost::asio::ssl::context::default_workarounds |
+                     boost::asio::ssl::context::no_sslv2 |
+                     boost::asio::ssl::context::no_sslv3 |
+                     boost::asio::ssl::context::single_dh_use);
+    ctx->use_certificate_chain_file(m_certChainFile);
+    ctx->use_private_key_file(m_privateKeyFile, boost::asio::ssl::context::pem);
+    if (!m_dhFile.empty()) { ctx->use_tmp_dh_file(m_dhFile); }
+    do_initTlsSessionCache(ctx, m_tlsContext);
+    return ctx;
+}
+
+void ServerTls::do_initTlsSessionCache(context_ptr ctx, context_ptr previous)
+{
+    static const unsigned char SESSION_ID_CONTEXT[] = "WebSocketAPI";
+
+    SSL_CTX* native = ctx->native_handle();
+    SSL_CTX_set_session_cache_mode(native, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_session_id_context(native, SESSION_ID_CONTEXT, sizeof(SESSION_ID_CONTEXT) - 1);
+    SSL_CTX_sess_set_cache_size(native, m_tlsSessionCacheSize);
+    SSL_CTX_set_timeout(native, m_tlsSessionTimeout);
+    SSL_CTX_clear_options(native, SSL_OP_NO_TICKET);
+
+    // Carry the ticket keys over a reload so tickets issued by the old context stay valid
+    if (previous)
+    {
+        long len = SSL_CTX_get_tlsext_ticket_keys(previous->native_handle(), NULL, 0);
+        if (len > 0)
+        {
+            std::vector<unsigned char> keys(len);
+            if (SSL_CTX_get_tlsext_ticket_keys(previous->native_handle(), &keys[0], len) > 0)
+            {
+                SSL_CTX_set_tlsext_ticket_keys(native, &keys[0], len);
+            }
+        }
+    }
 }
 #endif
 
@@ -146,21 +627,48 @@ void ServerNoTls::requestLoop()
 
         if (!m_bRunning) break;
 
-        client_request_t req = m_requests.front();
-        m_requests.pop();
+        queued_request_t item = m_requests.pop();
 
         lock.unlock();
 
+        const client_request_t& req = item.request;
+        if (std::chrono::steady_clock::now() > item.deadline && do_isFlightToken(req.second.getId())) {
+            // A coalesced call goes ahead while any caller that joined it still waits. Those that gave up
+            // have been answered.
+            if (!do_expireFlight(req.second.getId().get_str())) continue;
+        }
+        else if (std::chrono::steady_clock::now() > item.deadline) {
+            // The caller has given up - answering now only adds load
+            WS_LOG(trace) << SERVER_CLASS_NAME << "::requestLoop() - Dropping expired request " << req.second.getMethod() << " after "
+                          << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - item.arrival).count() << " ms" << endl;
+            JsonRpc::Response response;
+            response.setError(JsonRpc::RequestTimeoutException(), req.second.getId());
+            send(req.first, response);
+            continue;
+        }
+
         try {
             if (m_requestCallback) {
                 m_requestCallback(*this, req);
             }
             else {
-                m_ws_server.send(req.first, "Client request callback not set.", websocketpp::frame::opcode::text);
+                JsonRpc::Response response;
+                response.setError(std::runtime_error("Client request callback not set."), req.second.getId());
+                bool bAnswered = do_isTrackingFlights() && do_completeFlight(req.first, response);
+                if (!bAnswered && m_batchCount > 0) { bAnswered = do_completeBatch(req.first, response); }
+                if (!bAnswered) {
+                    send(req.first, std::string("Client request callback not set."));
+                }
             }
         }
         catch (const std::exception& e) {
-            LOGGER(trace) << SERVER_CLASS_NAME << "::requestLoop() - Error: " << e.what() << endl;
+            WS_LOG(trace) << SERVER_CLASS_NAME << "::requestLoop() - Error: " << e.what() << endl;
+            if (do_isTrackingFlights() || m_batchCount > 0) {
+                // Don't leave coalesced or batched callers waiting on a call that will never be answered
+                JsonRpc::Response response;
+                response.setError(e, req.second.getId());
+                if (!do_isTrackingFlights() || !do_completeFlight(req.first, response)) { do_completeBatch(req.first, response); }
+            }
         }
     }
 }
@@ -173,14 +681,42 @@ void ServerNoTls::init(int port, const std::string& allow_ips)
 {
     m_port = port;
     m_bRunning = false;
+    m_ioThreadCount = 1;
+    m_sendBatchWindow = -1;
+    m_msgManager.reset(new msg_manager_t());
+    m_nextFlightToken = 0;
+    m_nextBatch = 0;
+    m_batchCount = 0;
+    m_streamFrameSize = DEFAULT_STREAM_FRAME_SIZE;
+    m_streamBufferLimit = DEFAULT_STREAM_BUFFER_LIMIT;
+    m_streamQueueLimit = DEFAULT_STREAM_QUEUE_LIMIT;
+    m_requestTimeout = 0;
+    m_pingInterval = 0;
+    m_pongTimeout = 0;
+    m_idleTimeout = 0;
+    m_epoch = std::chrono::steady_clock::now();
+#if defined(USE_TLS)
+    m_bCacheTlsContext = true;
+    m_tlsFilesMTime = 0;
+    m_tlsLastCheck = 0;
+    m_tlsSessionCacheSize = DEFAULT_TLS_SESSION_CACHE_SIZE;
+    m_tlsSessionTimeout = DEFAULT_TLS_SESSION_TIMEOUT;
+#endif
+    m_eventField = "event";
+    m_dataField = "data";
     m_openCallback = nullptr;
     m_requestCallback = nullptr;
     try {
-        m_allow_ips_regex.assign(allow_ips);
+        m_ipFilter.reset(new IpFilter(allow_ips == DEFAULT_ALLOWED_IPS ? DEFAULT_ALLOWED_CIDRS : allow_ips));
     }
-    catch (const boost::regex_error& e) {
-        LOGGER(error) <<  "WARNING: Invalid allowips regex. Allowing localhost only." << endl;
-        m_allow_ips_regex.assign(DEFAULT_ALLOWED_IPS);
+    catch (const std::invalid_argument& e) {
+        try {
+            m_allow_ips_regex.assign(allow_ips);
+        }
+        catch (const boost::regex_error& e) {
+            WS_LOG(error) <<  "WARNING: Invalid allowips regex. Allowing localhost only." << endl;
+            m_ipFilter.reset(new IpFilter(DEFAULT_ALLOWED_CIDRS));
+        }
     }
 
     m_ws_server.set_access_channels(websocketpp::log::alevel::all);
@@ -193,6 +729,7 @@ void ServerNoTls::init(int port, const std::string& allow_ips)
     m_ws_server.set_close_handler(websocketpp::lib::bind(&Server::onClose, this, websocketpp::lib::placeholders::_1));
     m_ws_server.set_fail_handler(websocketpp::lib::bind(&Server::onFail, this, websocketpp::lib::placeholders::_1));
     m_ws_server.set_message_handler(websocketpp::lib::bind(&Server::onMessage, this, websocketpp::lib::placeholders::_1, websocketpp::lib::placeholders::_2));
+    m_ws_server.set_pong_handler(websocketpp::lib::bind(&Server::onPong, this, websocketpp::lib::placeholders::_1, websocketpp::lib::placeholders::_2));
 #if defined(USE_TLS)
     m_ws_server.set_tls_init_handler(websocketpp::lib::bind(&Server::onTlsInit, this, websocketpp::lib::placeholders::_1));
 #endif
@@ -214,8 +751,16 @@ void ServerNoTls::start()
     m_ws_server.listen(m_port);
     m_ws_server.start_accept();
 
+    // Always running, since any client may send a batch that needs expiring
+    m_wheelTimer.reset(new boost::asio::deadline_timer(m_ws_server.get_io_service()));
+    m_wheelTimer->expires_from_now(boost::posix_time::milliseconds(TIMER_WHEEL_TICK_MS));
+    m_wheelTimer->async_wait(websocketpp::lib::bind(&Server::onWheelTick, this, websocketpp::lib::placeholders::_1));
+
     m_request_loop_thread   = boost::thread(websocketpp::lib::bind(&Server::requestLoop, this));
-    m_io_service_thread     = boost::thread(websocketpp::lib::bind(&ws_server_t::run, &m_ws_server));
+    for (unsigned int i = 0; i < m_ioThreadCount; i++)
+    {
+        m_io_service_threads.create_thread(websocketpp::lib::bind(&ws_server_t::run, &m_ws_server));
+    }
 }
 
 #if defined(USE_TLS)
@@ -228,122 +773,546 @@ void ServerNoTls::stop()
     m_bRunning = false;
     lock.unlock();
 
-    LOGGER(trace) << "Websocket server stopping request loop thread..." << endl;
+    WS_LOG(trace) << "Websocket server stopping request loop thread..." << endl;
     m_requestCond.notify_all();
     m_request_loop_thread.join();
-    LOGGER(trace) << "Done." << endl;
+    WS_LOG(trace) << "Done." << endl;
 
-    LOGGER(trace) << "Websocket server stopping io service thread..." << endl;
+    WS_LOG(trace) << "Websocket server stopping io service threads..." << endl;
     m_ws_server.stop();
-    m_io_service_thread.join();
-    LOGGER(trace) << "Done." << endl;
+    m_io_service_threads.join_all();
+    WS_LOG(trace) << "Done." << endl;
 }
 
 #if defined(USE_TLS)
-std::string ServerTls::getRemoteEndpoint(websocketpp::connection_hdl hdl)
+void ServerTls::setIpFilter(const std::string& allow, const std::string& deny)
 #else
-std::string ServerNoTls::getRemoteEndpoint(websocketpp::connection_hdl hdl)
+void ServerNoTls::setIpFilter(const std::string& allow, const std::string& deny)
 #endif
 {
-    ws_server_t::connection_ptr con = m_ws_server.get_con_from_hdl(hdl);
-    return boost::lexical_cast<std::string>(con->get_remote_endpoint());
+    std::shared_ptr<const IpFilter> ipFilter(new IpFilter(allow, deny));
+    boost::unique_lock<boost::mutex> lock(m_ipFilterMutex);
+    m_ipFilter = ipFilter;
 }
 
 #if defined(USE_TLS)
-std::string ServerTls::getResource(websocketpp::connection_hdl hdl)
+void ServerTls::setConnectionRateLimit(double rate, double burst)
 #else
-std::string ServerNoTls::getResource(websocketpp::connection_hdl hdl)
+void ServerNoTls::setConnectionRateLimit(double rate, double burst)
 #endif
 {
-    ws_server_t::connection_ptr con = m_ws_server.get_con_from_hdl(hdl);
-    return boost::lexical_cast<std::string>(con->get_resource());
+    if (rate > 0)   { m_connectionLimiter.reset(new RateLimiter(rate, burst)); }
+    else            { m_connectionLimiter.reset(); }
 }
 
 #if defined(USE_TLS)
-void ServerTls::addToChannel(const std::string& channel, websocketpp::connection_hdl hdl)
+void ServerTls::setRequestRateLimit(double rate, double burst)
 #else
-void ServerNoTls::addToChannel(const std::string& channel, websocketpp::connection_hdl hdl)
+void ServerNoTls::setRequestRateLimit(double rate, double burst)
 #endif
 {
-    boost::unique_lock<boost::mutex> lock(m_connectionMutex);
-    if (m_connections.count(hdl)) { m_channels.insert(std::pair<std::string, websocketpp::connection_hdl>(channel, hdl.lock())); }
+    if (rate > 0)   { m_requestLimiter.reset(new RateLimiter(rate, burst)); }
+    else            { m_requestLimiter.reset(); }
 }
 
 #if defined(USE_TLS)
-void ServerTls::removeFromChannel(const std::string& channel, websocketpp::connection_hdl hdl)
+void ServerTls::setRequestRateLimit(const std::string& method, double rate, double burst)
 #else
-void ServerNoTls::removeFromChannel(const std::string& channel, websocketpp::connection_hdl hdl)
+void ServerNoTls::setRequestRateLimit(const std::string& method, double rate, double burst)
 #endif
 {
-    // TODO: improve upon this linear search
-    std::vector<channels_t::iterator> its;
+    if (rate > 0)   { m_methodLimiters[method].reset(new RateLimiter(rate, burst)); }
+    else            { m_methodLimiters.erase(method); }
+}
 
-    boost::unique_lock<boost::mutex> lock(m_connectionMutex);
-    auto hdl_ = hdl.lock();
-    if (!hdl_) return;
+#if defined(USE_TLS)
+bool ServerTls::do_allowRequest(websocketpp::connection_hdl hdl, const std::string& method)
+#else
+bool ServerNoTls::do_allowRequest(websocketpp::connection_hdl hdl, const std::string& method)
+#endif
+{
+    RateLimiter* limiter = m_requestLimiter.get();
+    if (!m_methodLimiters.empty())
+    {
+        method_limiters_t::iterator it = m_methodLimiters.find(method);
+        if (it != m_methodLimiters.end()) { limiter = it->second.get(); }
+    }
+    if (!limiter) return true;
 
-    auto range = m_channels.equal_range(channel);
-    for (channels_t::iterator it = range.first; it != range.second; ++it)
+    boost::asio::ip::address address;
     {
-        if (hdl_ == it->second.lock()) { its.push_back(it); }
+        boost::unique_lock<boost::mutex> lock(m_connectionMutex);
+        connections_t::iterator it = m_connections.find(hdl);
+        if (it == m_connections.end()) return false;
+        address = it->second.address;
     }
-    for (auto& it: its) { m_channels.erase(it); }
+    return limiter->allow(address);
 }
 
 #if defined(USE_TLS)
-void ServerTls::removeFromAllChannels(websocketpp::connection_hdl hdl)
+void ServerTls::setKeepAlive(unsigned int pingInterval, unsigned int pongTimeout, unsigned int idleTimeout)
 #else
-void ServerNoTls::removeFromAllChannels(websocketpp::connection_hdl hdl)
+void ServerNoTls::setKeepAlive(unsigned int pingInterval, unsigned int pongTimeout, unsigned int idleTimeout)
 #endif
 {
-    boost::unique_lock<boost::mutex> lock(m_connectionMutex);
-    do_removeFromAllChannels(hdl);
+    m_pingInterval = pingInterval;
+    m_pongTimeout = pongTimeout;
+    m_idleTimeout = idleTimeout;
 }
 
 #if defined(USE_TLS)
-void ServerTls::do_removeFromAllChannels(websocketpp::connection_hdl hdl)
+void ServerTls::onWheelTick(const boost::system::error_code& ec)
 #else
-void ServerNoTls::do_removeFromAllChannels(websocketpp::connection_hdl hdl)
+void ServerNoTls::onWheelTick(const boost::system::error_code& ec)
 #endif
 {
-    // TODO: improve upon this linear search
-    std::vector<channels_t::iterator> its;
-    auto hdl_ = hdl.lock();
-    if (!hdl_) return;
-    for (channels_t::iterator it = m_channels.begin(); it != m_channels.end(); ++it)
-    {
-        if (hdl_ == it->second.lock()) { its.push_back(it); }
-    }
-    for (auto& it: its) { m_channels.erase(it); }
+    if (ec || !m_bRunning) return;
+    m_timerWheel.advance(do_now() / TIMER_WHEEL_TICK_MS);
+    m_wheelTimer->expires_at(m_wheelTimer->expires_at() + boost::posix_time::milliseconds(TIMER_WHEEL_TICK_MS));
+    m_wheelTimer->async_wait(websocketpp::lib::bind(&Server::onWheelTick, this, websocketpp::lib::placeholders::_1));
 }
 
 #if defined(USE_TLS)
-void ServerTls::removeChannel(const std::string& channel)
+void ServerTls::onPong(websocketpp::connection_hdl hdl, std::string payload)
 #else
-void ServerNoTls::removeChannel(const std::string& channel)
+void ServerNoTls::onPong(websocketpp::connection_hdl hdl, std::string payload)
 #endif
 {
+    m_ws_server.get_con_from_hdl(hdl)->lastActivity = do_now();
+
     boost::unique_lock<boost::mutex> lock(m_connectionMutex);
-    m_channels.erase(channel);
+    connections_t::iterator it = m_connections.find(hdl);
+    if (it == m_connections.end()) return;
+    it->second.bPingPending = false;
 }
 
 #if defined(USE_TLS)
-void ServerTls::send(websocketpp::connection_hdl hdl, const JsonRpc::Response& res)
+void ServerTls::do_checkKeepAlive(websocketpp::connection_hdl hdl)
 #else
-void ServerNoTls::send(websocketpp::connection_hdl hdl, const JsonRpc::Response& res)
+void ServerNoTls::do_checkKeepAlive(websocketpp::connection_hdl hdl)
 #endif
 {
-    if (!m_bRunning) return;
     boost::unique_lock<boost::mutex> lock(m_connectionMutex);
-    if (!m_bRunning) return;
-    if (m_connections.count(hdl) == 0) return;
-    string json(res.getJson());
-    LOGGER(trace) << SERVER_CLASS_NAME << "::send() sending response to hdl " << hdl.lock().get() << ": " << json << endl;
-    m_ws_server.send(hdl, json, websocketpp::frame::opcode::text);
-}
+    connections_t::iterator it = m_connections.find(hdl);
+    if (it == m_connections.end()) return;
 
-#if defined(USE_TLS)
-void ServerTls::sendAll(const JsonRpc::Response& res)
+    // Still in m_connections, so onClose() hasn't run and the connection is alive
+    ws_server_t::connection_ptr con = m_ws_server.get_con_from_hdl(hdl);
+    connection_data_t& data = it->second;
+    uint64_t now = do_now();
+    // onMessage() may have stamped the connection after now was read
+    uint64_t lastMessage = std::min(now, con->lastMessage.load());
+    uint64_t lastActivity = std::min(now, con->lastActivity.load());
+    std::string reason;
+    if (m_idleTimeout && now - lastMessage >= m_idleTimeout)                        { reason = "Idle timeout"; }
+    else if (data.bPingPending && m_pongTimeout && now - data.pingSent >= m_pongTimeout) { reason = "Pong timeout"; }
+
+    if (!reason.empty())
+    {
+        // Stop broadcasting to the peer right away - onClose() runs once the close handshake finishes or times out
+        WS_LOG(trace) << SERVER_CLASS_NAME << "::do_checkKeepAlive() closing hdl " << hdl.lock().get() << ": " << reason << endl;
+        do_removeFromAllChannels(hdl);
+        do_closeConnectionData(hdl, data);
+        m_connections.erase(it);
+        lock.unlock();
+
+        websocketpp::lib::error_code ec;
+        m_ws_server.close(hdl, websocketpp::close::status::policy_violation, reason, ec);
+        return;
+    }
+
+    if (m_pingInterval && !data.bPingPending && now - lastActivity >= m_pingInterval)
+    {
+        websocketpp::lib::error_code ec;
+        m_ws_server.ping(hdl, std::string(), ec);
+        data.bPingPending = true;
+        data.pingSent = now;
+    }
+
+    // Next check is at the earliest upcoming deadline
+    uint64_t next = std::numeric_limits<uint64_t>::max();
+    if (m_idleTimeout)                                  { next = std::min(next, lastMessage + m_idleTimeout); }
+    if (data.bPingPending && m_pongTimeout)             { next = std::min(next, data.pingSent + m_pongTimeout); }
+    else if (!data.bPingPending && m_pingInterval)      { next = std::min(next, lastActivity + m_pingInterval); }
+    if (next == std::numeric_limits<uint64_t>::max())   { next = now + m_pingInterval; }
+
+    uint64_t delay = next > now ? next - now : 0;
+    data.keepAliveTimer = m_timerWheel.schedule(delay / TIMER_WHEEL_TICK_MS + 1, websocketpp::lib::bind(&Server::do_checkKeepAlive, this, hdl));
+}
+
+#if defined(USE_TLS)
+void ServerTls::setCoalescedMethod(const std::string& method, bool bEnabled)
+#else
+void ServerNoTls::setCoalescedMethod(const std::string& method, bool bEnabled)
+#endif
+{
+    if (bEnabled)   { m_coalescedMethods.insert(method); }
+    else            { m_coalescedMethods.erase(method); }
+}
+
+#if defined(USE_TLS)
+bool ServerTls::do_joinFlight(websocketpp::connection_hdl hdl, JsonRpc::Request& request, const std::string& key, std::chrono::steady_clock::time_point deadline)
+#else
+bool ServerNoTls::do_joinFlight(websocketpp::connection_hdl hdl, JsonRpc::Request& request, const std::string& key, std::chrono::steady_clock::time_point deadline)
+#endif
+{
+    // Returns true if the request was attached to a call already in flight. Otherwise the request leads a new
+    // flight and its id is replaced by the flight's token, which the response must carry back.
+    if (request.getId().is_null()) return false;
+    if (deadline == std::chrono::steady_clock::time_point::max())
+    {
+        deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(DEFAULT_FLIGHT_TIMEOUT);
+    }
+    waiter_t waiter = { hdl, request.getId(), deadline };
+
+    boost::unique_lock<boost::mutex> lock(m_flightMutex);
+    auto it = m_flights.find(key);
+    if (it != m_flights.end())
+    {
+        WS_LOG(trace) << SERVER_CLASS_NAME << "::do_joinFlight() coalescing " << request.getMethod() << " from hdl " << hdl.lock().get() << endl;
+        flight_t& flight = *it->second;
+        flight.waiters.push_back(waiter);
+        if (deadline < flight.expiry) { do_scheduleFlightExpiry(flight); }
+        return true;
+    }
+
+    std::shared_ptr<flight_t> flight(new flight_t());
+    flight->key = key;
+    flight->method = request.getMethod();
+    auto cachedIt = m_cachedMethods.find(flight->method);
+    flight->generation = (cachedIt != m_cachedMethods.end()) ? cachedIt->second.generation : 0;
+    flight->leader = hdl;
+    flight->waiters.push_back(waiter);
+
+    std::string token = FLIGHT_TOKEN_PREFIX + boost::lexical_cast<std::string>(m_nextFlightToken++);
+    flight->token = token;
+    flight->expiryTimer = 0;
+    do_scheduleFlightExpiry(*flight);
+
+    m_flights[key] = flight;
+    m_flightLeaders[token] = key;
+    request.setId(token);
+    return false;
+}
+
+#if defined(USE_TLS)
+bool ServerTls::do_completeFlight(websocketpp::connection_hdl hdl, const JsonRpc::Response& res)
+#else
+bool ServerNoTls::do_completeFlight(websocketpp::connection_hdl hdl, const JsonRpc::Response& res)
+#endif
+{
+    // Returns true if res answered a coalesced call and was sent to all of its callers
+    if (res.getId().type() != json_spirit::str_type) return false;
+
+    std::shared_ptr<flight_t> flight;
+    {
+        boost::unique_lock<boost::mutex> lock(m_flightMutex);
+        if (m_flightLeaders.empty()) return false;
+        auto leaderIt = m_flightLeaders.find(res.getId().get_str());
+        if (leaderIt == m_flightLeaders.end()) return false;
+        auto flightIt = m_flights.find(leaderIt->second);
+
+        // Only the leading call's connection can answer for the flight
+        if (flightIt->second->leader.owner_before(hdl) || hdl.owner_before(flightIt->second->leader)) return false;
+
+        flight = flightIt->second;
+        m_flights.erase(flightIt);
+        m_flightLeaders.erase(leaderIt);
+    }
+    m_timerWheel.cancel(flight->expiryTimer);
+
+    // Serialize the result once and patch each caller's id in. The layout matches Response::getJson().
+    json_spirit::Object body;
+    body.push_back(json_spirit::Pair("result", res.getResult()));
+    body.push_back(json_spirit::Pair("error", res.getError()));
+    string prefix = json_spirit::write_string<json_spirit::Value>(body);
+    prefix.erase(prefix.size() - 1);
+    prefix += ",\"id\":";
+
+    if (!m_cachedMethods.empty() && res.getError().is_null())
+    {
+        // Checked under the lock so a concurrent invalidation can't be undone by a stale result
+        boost::unique_lock<boost::mutex> lock(m_flightMutex);
+        auto cachedIt = m_cachedMethods.find(flight->method);
+        if (cachedIt != m_cachedMethods.end() && cachedIt->second.generation == flight->generation)
+        {
+            m_resultCache.put(flight->key, prefix, flight->key.size() + prefix.size(), cachedIt->second.ttl, flight->method);
+        }
+    }
+
+    WS_LOG(trace) << SERVER_CLASS_NAME << "::do_completeFlight() sending coalesced response to " << flight->waiters.size() << " callers" << endl;
+    for (auto& waiter: flight->waiters)
+    {
+        send(waiter.hdl, prefix + json_spirit::write_string<json_spirit::Value>(waiter.id) + "}");
+    }
+    return true;
+}
+
+#if defined(USE_TLS)
+bool ServerTls::do_completeFlight(websocketpp::connection_hdl hdl, const std::string& data)
+#else
+bool ServerNoTls::do_completeFlight(websocketpp::connection_hdl hdl, const std::string& data)
+#endif
+{
+    // Raw text replies are only parsed if they might carry a flight token
+    if (data.find(FLIGHT_TOKEN_PREFIX) == std::string::npos) return false;
+    {
+        boost::unique_lock<boost::mutex> lock(m_flightMutex);
+        if (m_flightLeaders.empty()) return false;
+    }
+
+    JsonRpc::Response res;
+    try {
+        res.setJson(data);
+    }
+    catch (const std::exception& e) {
+        return false;
+    }
+    return do_completeFlight(hdl, res);
+}
+
+#if defined(USE_TLS)
+bool ServerTls::do_isFlightToken(const json_spirit::Value& id) const
+#else
+bool ServerNoTls::do_isFlightToken(const json_spirit::Value& id) const
+#endif
+{
+    return do_isTrackingFlights() && id.type() == json_spirit::str_type && id.get_str().compare(0, FLIGHT_TOKEN_PREFIX.size(), FLIGHT_TOKEN_PREFIX) == 0;
+}
+
+#if defined(USE_TLS)
+void ServerTls::do_scheduleFlightExpiry(flight_t& flight)
+#else
+void ServerNoTls::do_scheduleFlightExpiry(flight_t& flight)
+#endif
+{
+    // Must be called with m_flightMutex held. Moves the flight's timer to its earliest waiter deadline.
+    flight.expiry = std::chrono::steady_clock::time_point::max();
+    for (auto& waiter: flight.waiters) { flight.expiry = std::min(flight.expiry, waiter.deadline); }
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    uint64_t timeout = flight.expiry > now ? std::chrono::duration_cast<std::chrono::milliseconds>(flight.expiry - now).count() : 0;
+    if (flight.expiryTimer) { m_timerWheel.cancel(flight.expiryTimer); }
+    flight.expiryTimer = m_timerWheel.schedule(timeout / TIMER_WHEEL_TICK_MS + 1, websocketpp::lib::bind(&Server::do_expireFlight, this, flight.token));
+}
+
+#if defined(USE_TLS)
+bool ServerTls::do_expireFlight(const std::string& token)
+#else
+bool ServerNoTls::do_expireFlight(const std::string& token)
+#endif
+{
+    // Answers the callers whose deadlines have passed with RequestTimeoutException errors. Returns whether
+    // any caller still waits; once none does, the flight is dropped.
+    std::vector<waiter_t> expired;
+    bool bWaiting;
+    {
+        boost::unique_lock<boost::mutex> lock(m_flightMutex);
+        auto leaderIt = m_flightLeaders.find(token);
+        if (leaderIt == m_flightLeaders.end()) return false;
+        auto flightIt = m_flights.find(leaderIt->second);
+        flight_t& flight = *flightIt->second;
+
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        std::vector<waiter_t> waiting;
+        for (auto& waiter: flight.waiters)
+        {
+            if (waiter.deadline <= now) { expired.push_back(waiter); }
+            else                        { waiting.push_back(waiter); }
+        }
+        flight.waiters.swap(waiting);
+
+        // Rescheduled even if nobody expired: a timer the wheel fired a little early has been used up
+        bWaiting = !flight.waiters.empty();
+        if (bWaiting)
+        {
+            do_scheduleFlightExpiry(flight);
+        }
+        else
+        {
+            m_timerWheel.cancel(flight.expiryTimer);
+            m_flights.erase(flightIt);
+            m_flightLeaders.erase(leaderIt);
+        }
+    }
+
+    if (!expired.empty()) { WS_LOG(trace) << SERVER_CLASS_NAME << "::do_expireFlight() " << expired.size() << " callers of coalesced call " << token << " timed out" << endl; }
+    for (auto& waiter: expired)
+    {
+        JsonRpc::Response response;
+        response.setError(JsonRpc::RequestTimeoutException(), waiter.id);
+        send(waiter.hdl, response);
+    }
+    return bWaiting;
+}
+
+#if defined(USE_TLS)
+void ServerTls::setCachedMethod(const std::string& method, unsigned int ttl, const std::vector<std::string>& invalidatingChannels)
+#else
+void ServerNoTls::setCachedMethod(const std::string& method, unsigned int ttl, const std::vector<std::string>& invalidatingChannels)
+#endif
+{
+    m_cachedMethods[method].ttl = ttl;
+    for (auto& channel: invalidatingChannels) { m_channelInvalidations.insert(std::make_pair(channel, method)); }
+}
+
+#if defined(USE_TLS)
+void ServerTls::invalidateCache(const std::string& method)
+#else
+void ServerNoTls::invalidateCache(const std::string& method)
+#endif
+{
+    boost::unique_lock<boost::mutex> lock(m_flightMutex);
+    auto it = m_cachedMethods.find(method);
+    if (it == m_cachedMethods.end()) return;
+    it->second.generation++;
+    m_resultCache.eraseTag(method);
+}
+
+#if defined(USE_TLS)
+bool ServerTls::do_sendCachedResult(websocketpp::connection_hdl hdl, const JsonRpc::Request& request, const std::string& key)
+#else
+bool ServerNoTls::do_sendCachedResult(websocketpp::connection_hdl hdl, const JsonRpc::Request& request, const std::string& key)
+#endif
+{
+    std::string prefix;
+    if (!m_resultCache.get(key, prefix)) return false;
+    WS_LOG(trace) << SERVER_CLASS_NAME << "::do_sendCachedResult() cache hit for " << request.getMethod() << " from hdl " << hdl.lock().get() << endl;
+    send(hdl, prefix + json_spirit::write_string<json_spirit::Value>(request.getId()) + "}");
+    return true;
+}
+
+#if defined(USE_TLS)
+void ServerTls::do_invalidateChannel(const std::string& channel)
+#else
+void ServerNoTls::do_invalidateChannel(const std::string& channel)
+#endif
+{
+    auto range = m_channelInvalidations.equal_range(channel);
+    for (auto it = range.first; it != range.second; ++it) { invalidateCache(it->second); }
+}
+
+#if defined(USE_TLS)
+std::string ServerTls::getRemoteEndpoint(websocketpp::connection_hdl hdl)
+#else
+std::string ServerNoTls::getRemoteEndpoint(websocketpp::connection_hdl hdl)
+#endif
+{
+    ws_server_t::connection_ptr con = m_ws_server.get_con_from_hdl(hdl);
+    return boost::lexical_cast<std::string>(con->get_remote_endpoint());
+}
+
+#if defined(USE_TLS)
+std::string ServerTls::getResource(websocketpp::connection_hdl hdl)
+#else
+std::string ServerNoTls::getResource(websocketpp::connection_hdl hdl)
+#endif
+{
+    ws_server_t::connection_ptr con = m_ws_server.get_con_from_hdl(hdl);
+    return boost::lexical_cast<std::string>(con->get_resource());
+}
+
+#if defined(USE_TLS)
+void ServerTls::addToChannel(const std::string& channel, websocketpp::connection_hdl hdl)
+#else
+void ServerNoTls::addToChannel(const std::string& channel, websocketpp::connection_hdl hdl)
+#endif
+{
+    boost::unique_lock<boost::mutex> lock(m_connectionMutex);
+    if (m_connections.count(hdl))
+    {
+        m_channels.insert(std::pair<std::string, websocketpp::connection_hdl>(channel, hdl.lock()));
+
+        auto deltaIt = m_deltaChannels.find(channel);
+        if (deltaIt != m_deltaChannels.end() && deltaIt->second.version > 0) { do_sendSnapshot(channel, deltaIt->second, hdl); }
+    }
+}
+
+#if defined(USE_TLS)
+void ServerTls::removeFromChannel(const std::string& channel, websocketpp::connection_hdl hdl)
+#else
+void ServerNoTls::removeFromChannel(const std::string& channel, websocketpp::connection_hdl hdl)
+#endif
+{
+    // TODO: improve upon this linear search
+    std::vector<channels_t::iterator> its;
+
+    boost::unique_lock<boost::mutex> lock(m_connectionMutex);
+    auto hdl_ = hdl.lock();
+    if (!hdl_) return;
+
+    auto range = m_channels.equal_range(channel);
+    for (channels_t::iterator it = range.first; it != range.second; ++it)
+    {
+        if (hdl_ == it->second.lock()) { its.push_back(it); }
+    }
+    for (auto& it: its) { m_channels.erase(it); }
+
+    auto deltaIt = m_deltaChannels.find(channel);
+    if (deltaIt != m_deltaChannels.end()) { deltaIt->second.versions.erase(hdl); }
+}
+
+#if defined(USE_TLS)
+void ServerTls::removeFromAllChannels(websocketpp::connection_hdl hdl)
+#else
+void ServerNoTls::removeFromAllChannels(websocketpp::connection_hdl hdl)
+#endif
+{
+    boost::unique_lock<boost::mutex> lock(m_connectionMutex);
+    do_removeFromAllChannels(hdl);
+}
+
+#if defined(USE_TLS)
+void ServerTls::do_removeFromAllChannels(websocketpp::connection_hdl hdl)
+#else
+void ServerNoTls::do_removeFromAllChannels(websocketpp::connection_hdl hdl)
+#endif
+{
+    // TODO: improve upon this linear search
+    std::vector<channels_t::iterator> its;
+    auto hdl_ = hdl.lock();
+    if (!hdl_) return;
+    for (channels_t::iterator it = m_channels.begin(); it != m_channels.end(); ++it)
+    {
+        if (hdl_ == it->second.lock()) { its.push_back(it); }
+    }
+    for (auto& it: its) { m_channels.erase(it); }
+
+    for (auto& deltaChannel: m_deltaChannels) { deltaChannel.second.versions.erase(hdl); }
+}
+
+#if defined(USE_TLS)
+void ServerTls::removeChannel(const std::string& channel)
+#else
+void ServerNoTls::removeChannel(const std::string& channel)
+#endif
+{
+    boost::unique_lock<boost::mutex> lock(m_connectionMutex);
+    m_channels.erase(channel);
+
+    auto deltaIt = m_deltaChannels.find(channel);
+    if (deltaIt != m_deltaChannels.end()) { deltaIt->second.versions.clear(); }
+}
+
+#if defined(USE_TLS)
+void ServerTls::send(websocketpp::connection_hdl hdl, const JsonRpc::Response& res)
+#else
+void ServerNoTls::send(websocketpp::connection_hdl hdl, const JsonRpc::Response& res)
+#endif
+{
+    if (!m_bRunning) return;
+    if (do_isTrackingFlights() && do_completeFlight(hdl, res)) return;
+    if (m_batchCount > 0 && do_completeBatch(hdl, res)) return;
+    boost::unique_lock<boost::mutex> lock(m_connectionMutex);
+    if (!m_bRunning) return;
+    if (m_connections.count(hdl) == 0) return;
+    string json(res.getJson());
+    WS_LOG(trace) << SERVER_CLASS_NAME << "::send() sending response to hdl " << hdl.lock().get() << ": " << json << endl;
+    do_write(hdl, json);
+}
+
+#if defined(USE_TLS)
+void ServerTls::sendAll(const JsonRpc::Response& res)
 #else
 void ServerNoTls::sendAll(const JsonRpc::Response& res)
 #endif
@@ -351,11 +1320,12 @@ void ServerNoTls::sendAll(const JsonRpc::Response& res)
     if (!m_bRunning) return;
     boost::unique_lock<boost::mutex> lock(m_connectionMutex);
     if (!m_bRunning) return;
-    for (auto& hdl: m_connections)
+    for (auto& connection: m_connections)
     {
+        const websocketpp::connection_hdl& hdl = connection.first;
         string json(res.getJson());
-        LOGGER(trace) << SERVER_CLASS_NAME << "::sendAll() sending response to hdl " << hdl.lock().get() << ": " << json << endl;
-        m_ws_server.send(hdl, json, websocketpp::frame::opcode::text);
+        WS_LOG(trace) << SERVER_CLASS_NAME << "::sendAll() sending response to hdl " << hdl.lock().get() << ": " << json << endl;
+        do_write(hdl, json);
     }
 }
 
@@ -365,17 +1335,18 @@ void ServerTls::sendChannel(const std::string& channel, const JsonRpc::Response&
 void ServerNoTls::sendChannel(const std::string& channel, const JsonRpc::Response& res)
 #endif
 {
+    if (!m_channelInvalidations.empty()) { do_invalidateChannel(channel); }
     if (!m_bRunning) return;
     boost::unique_lock<boost::mutex> lock(m_connectionMutex);
     if (!m_bRunning) return;
 
-    LOGGER(trace) << SERVER_CLASS_NAME << "::sendChannel() response sending to channel " << channel << endl;
+    WS_LOG(trace) << SERVER_CLASS_NAME << "::sendChannel() response sending to channel " << channel << endl;
     auto range = m_channels.equal_range(channel);
     for (channels_t::iterator it = range.first; it != range.second; ++it)
     {
         string json(res.getJson());
-        LOGGER(trace) << SERVER_CLASS_NAME << "::send() sending response to hdl " << it->second.lock().get() << ": " << json << endl;
-        m_ws_server.send(it->second, json, websocketpp::frame::opcode::text);
+        WS_LOG(trace) << SERVER_CLASS_NAME << "::send() sending response to hdl " << it->second.lock().get() << ": " << json << endl;
+        do_write(it->second, json);
     }
 }
 
@@ -386,11 +1357,13 @@ void ServerNoTls::send(websocketpp::connection_hdl hdl, const std::string& data)
 #endif
 {
     if (!m_bRunning) return;
+    if (do_isTrackingFlights() && do_completeFlight(hdl, data)) return;
+    if (m_batchCount > 0 && do_completeBatch(hdl, data)) return;
     boost::unique_lock<boost::mutex> lock(m_connectionMutex);
     if (!m_bRunning) return;
     if (m_connections.count(hdl) == 0) return;
-    LOGGER(trace) << SERVER_CLASS_NAME << "::send() sending data to hdl " << hdl.lock().get() << ": " << data << endl;
-    m_ws_server.send(hdl, data, websocketpp::frame::opcode::text);
+    WS_LOG(trace) << SERVER_CLASS_NAME << "::send() sending data to hdl " << hdl.lock().get() << ": " << data << endl;
+    do_write(hdl, data);
 }
 
 #if defined(USE_TLS)
@@ -402,10 +1375,11 @@ void ServerNoTls::sendAll(const std::string& data)
     if (!m_bRunning) return;
     boost::unique_lock<boost::mutex> lock(m_connectionMutex);
     if (!m_bRunning) return;
-    for (auto& hdl: m_connections)
+    for (auto& connection: m_connections)
     {
-        LOGGER(trace) << SERVER_CLASS_NAME << "::sendAll() sending data to hdl " << hdl.lock().get() << ": " << data << endl;
-        m_ws_server.send(hdl, data, websocketpp::frame::opcode::text);
+        const websocketpp::connection_hdl& hdl = connection.first;
+        WS_LOG(trace) << SERVER_CLASS_NAME << "::sendAll() sending data to hdl " << hdl.lock().get() << ": " << data << endl;
+        do_write(hdl, data);
     }
 }
 
@@ -415,16 +1389,661 @@ void ServerTls::sendChannel(const std::string& channel, const std::string& data)
 void ServerNoTls::sendChannel(const std::string& channel, const std::string& data)
 #endif
 {
+    if (!m_channelInvalidations.empty()) { do_invalidateChannel(channel); }
     if (!m_bRunning) return;
     boost::unique_lock<boost::mutex> lock(m_connectionMutex);
     if (!m_bRunning) return;
 
-    LOGGER(trace) << SERVER_CLASS_NAME << "::sendChannel() sending data to channel " << channel << endl;
+    WS_LOG(trace) << SERVER_CLASS_NAME << "::sendChannel() sending data to channel " << channel << endl;
     auto range = m_channels.equal_range(channel);
     for (channels_t::iterator it = range.first; it != range.second; ++it)
     {
-        LOGGER(trace) << SERVER_CLASS_NAME << "::sendChannel() sending data to hdl " << it->second.lock().get() << ": " << data << endl;
-        m_ws_server.send(it->second, data, websocketpp::frame::opcode::text);
+        WS_LOG(trace) << SERVER_CLASS_NAME << "::sendChannel() sending data to hdl " << it->second.lock().get() << ": " << data << endl;
+        do_write(it->second, data);
     }
 }
 
+
+#if defined(USE_TLS)
+void ServerTls::publishAll(const JsonRpc::Response& res)
+#else
+void ServerNoTls::publishAll(const JsonRpc::Response& res)
+#endif
+{
+    publishAll(res.getJson());
+}
+
+#if defined(USE_TLS)
+void ServerTls::publishChannel(const std::string& channel, const JsonRpc::Response& res)
+#else
+void ServerNoTls::publishChannel(const std::string& channel, const JsonRpc::Response& res)
+#endif
+{
+    publishChannel(channel, res.getJson());
+}
+
+#if defined(USE_TLS)
+void ServerTls::publishAll(const std::string& data)
+#else
+void ServerNoTls::publishAll(const std::string& data)
+#endif
+{
+    if (!m_bRunning) return;
+    m_ws_server.get_io_service().post(websocketpp::lib::bind(&Server::do_publish, this, std::string(), true, do_prepareMessage(data)));
+}
+
+#if defined(USE_TLS)
+void ServerTls::publishChannel(const std::string& channel, const std::string& data)
+#else
+void ServerNoTls::publishChannel(const std::string& channel, const std::string& data)
+#endif
+{
+    if (!m_channelInvalidations.empty()) { do_invalidateChannel(channel); }
+    if (!m_bRunning) return;
+    m_ws_server.get_io_service().post(websocketpp::lib::bind(&Server::do_publish, this, channel, false, do_prepareMessage(data)));
+}
+
+#if defined(USE_TLS)
+void ServerTls::send(websocketpp::connection_hdl hdl, const payload_ptr& data)
+#else
+void ServerNoTls::send(websocketpp::connection_hdl hdl, const payload_ptr& data)
+#endif
+{
+    if (!m_bRunning) return;
+    boost::unique_lock<boost::mutex> lock(m_connectionMutex);
+    if (!m_bRunning) return;
+    if (m_connections.count(hdl) == 0) return;
+    WS_LOG(trace) << SERVER_CLASS_NAME << "::send() sending " << data->get_payload().size() << " shared bytes to hdl " << hdl.lock().get() << endl;
+    do_write(hdl, data);
+}
+
+#if defined(USE_TLS)
+void ServerTls::sendAll(const payload_ptr& data)
+#else
+void ServerNoTls::sendAll(const payload_ptr& data)
+#endif
+{
+    if (!m_bRunning) return;
+    boost::unique_lock<boost::mutex> lock(m_connectionMutex);
+    if (!m_bRunning) return;
+    WS_LOG(trace) << SERVER_CLASS_NAME << "::sendAll() sending " << data->get_payload().size() << " shared bytes to " << m_connections.size() << " connections" << endl;
+    for (auto& connection: m_connections) { do_write(connection.first, data); }
+}
+
+#if defined(USE_TLS)
+void ServerTls::sendChannel(const std::string& channel, const payload_ptr& data)
+#else
+void ServerNoTls::sendChannel(const std::string& channel, const payload_ptr& data)
+#endif
+{
+    if (!m_channelInvalidations.empty()) { do_invalidateChannel(channel); }
+    if (!m_bRunning) return;
+    boost::unique_lock<boost::mutex> lock(m_connectionMutex);
+    if (!m_bRunning) return;
+
+    WS_LOG(trace) << SERVER_CLASS_NAME << "::sendChannel() sending " << data->get_payload().size() << " shared bytes to channel " << channel << endl;
+    auto range = m_channels.equal_range(channel);
+    for (channels_t::iterator it = range.first; it != range.second; ++it) { do_write(it->second, data); }
+}
+
+#if defined(USE_TLS)
+void ServerTls::publishAll(const payload_ptr& data)
+#else
+void ServerNoTls::publishAll(const payload_ptr& data)
+#endif
+{
+    if (!m_bRunning) return;
+    m_ws_server.get_io_service().post(websocketpp::lib::bind(&Server::do_publish, this, std::string(), true, data));
+}
+
+#if defined(USE_TLS)
+void ServerTls::publishChannel(const std::string& channel, const payload_ptr& data)
+#else
+void ServerNoTls::publishChannel(const std::string& channel, const payload_ptr& data)
+#endif
+{
+    if (!m_channelInvalidations.empty()) { do_invalidateChannel(channel); }
+    if (!m_bRunning) return;
+    m_ws_server.get_io_service().post(websocketpp::lib::bind(&Server::do_publish, this, channel, false, data));
+}
+
+#if defined(USE_TLS)
+void ServerTls::do_publish(const std::string& channel, bool bAll, ws_server_t::message_ptr msg)
+#else
+void ServerNoTls::do_publish(const std::string& channel, bool bAll, ws_server_t::message_ptr msg)
+#endif
+{
+    if (!m_bRunning) return;
+
+    // Only the recipient list is built under m_connectionMutex. The sends take each connection's own lock.
+    hdl_list_ptr hdls(new std::vector<websocketpp::connection_hdl>());
+    {
+        boost::unique_lock<boost::mutex> lock(m_connectionMutex);
+        if (bAll)
+        {
+            hdls->reserve(m_connections.size());
+            for (auto& connection: m_connections) { hdls->push_back(connection.first); }
+        }
+        else
+        {
+            auto range = m_channels.equal_range(channel);
+            for (channels_t::iterator it = range.first; it != range.second; ++it) { hdls->push_back(it->second); }
+        }
+    }
+
+    WS_LOG(trace) << SERVER_CLASS_NAME << "::do_publish() publishing to " << hdls->size() << " connections"
+                  << (bAll ? std::string() : " on channel " + channel) << endl;
+
+    // Split the fan-out into one slice per io thread. The slices share no lock, so they are written
+    // concurrently.
+    std::size_t slices = std::min<std::size_t>(m_ioThreadCount, hdls->size());
+    if (slices == 0) return;
+    std::size_t sliceSize = (hdls->size() + slices - 1) / slices;
+    for (std::size_t begin = sliceSize; begin < hdls->size(); begin += sliceSize)
+    {
+        std::size_t end = std::min(begin + sliceSize, hdls->size());
+        m_ws_server.get_io_service().post(websocketpp::lib::bind(&Server::do_fanout, this, hdls, begin, end, msg));
+    }
+    do_fanout(hdls, 0, std::min(sliceSize, hdls->size()), msg);
+}
+
+#if defined(USE_TLS)
+void ServerTls::do_fanout(hdl_list_ptr hdls, std::size_t begin, std::size_t end, ws_server_t::message_ptr msg)
+#else
+void ServerNoTls::do_fanout(hdl_list_ptr hdls, std::size_t begin, std::size_t end, ws_server_t::message_ptr msg)
+#endif
+{
+    // do_write() decides per connection, under its writeMutex, whether the message is sent, batched or held
+    // behind a stream
+    for (std::size_t i = begin; i < end; i++) { do_write((*hdls)[i], msg); }
+}
+
+#if defined(USE_TLS)
+ws_server_t::message_ptr ServerTls::do_prepareMessage(const std::string& data)
+#else
+ws_server_t::message_ptr ServerNoTls::do_prepareMessage(const std::string& data)
+#endif
+{
+    // Frame the payload once as an unmasked text frame. websocketpp queues prepared messages as they are,
+    // so the same message can be shared by any number of connections.
+    using namespace websocketpp::frame;
+    ws_server_t::message_ptr msg = m_msgManager->get_message(opcode::text, data.size());
+    msg->set_payload(data);
+    msg->set_header(prepare_header(basic_header(opcode::text, data.size(), true, false), extended_header(data.size())));
+    msg->set_prepared(true);
+    return msg;
+}
+
+#if defined(USE_TLS)
+void ServerTls::do_write(websocketpp::connection_hdl hdl, const std::string& data)
+#else
+void ServerNoTls::do_write(websocketpp::connection_hdl hdl, const std::string& data)
+#endif
+{
+    do_write(hdl, do_prepareMessage(data));
+}
+
+#if defined(USE_TLS)
+void ServerTls::do_write(websocketpp::connection_hdl hdl, const ws_server_t::message_ptr& msg)
+#else
+void ServerNoTls::do_write(websocketpp::connection_hdl hdl, const ws_server_t::message_ptr& msg)
+#endif
+{
+    // Takes only the connection's writeMutex, so callers may or may not hold m_connectionMutex
+    websocketpp::lib::error_code ec;
+    ws_server_t::connection_ptr con = m_ws_server.get_con_from_hdl(hdl, ec);
+    if (!con) return;
+
+    boost::unique_lock<boost::mutex> lock(con->writeMutex);
+    if (con->bClosing) return;
+    if (con->bStreaming)
+    {
+        con->heldWrites.push_back(msg);
+        return;
+    }
+    do_queueWrite(hdl, con, msg);
+}
+
+#if defined(USE_TLS)
+void ServerTls::do_queueWrite(websocketpp::connection_hdl hdl, ws_server_t::connection_ptr con, const ws_server_t::message_ptr& msg)
+#else
+void ServerNoTls::do_queueWrite(websocketpp::connection_hdl hdl, ws_server_t::connection_ptr con, const ws_server_t::message_ptr& msg)
+#endif
+{
+    // Must be called with con->writeMutex held
+    if (m_sendBatchWindow < 0)
+    {
+        websocketpp::lib::error_code ec = con->send(msg);
+        if (ec) { WS_LOG(trace) << SERVER_CLASS_NAME << "::do_queueWrite() failed sending to hdl " << hdl.lock().get() << ": " << ec.message() << endl; }
+        return;
+    }
+
+    con->pendingWrites.push_back(msg);
+    if (con->bFlushScheduled) return;
+    con->bFlushScheduled = true;
+
+    if (m_sendBatchWindow == 0)
+    {
+        m_ws_server.get_io_service().post(websocketpp::lib::bind(&Server::do_flushWrites, this, hdl));
+        return;
+    }
+    if (!con->flushTimer) { con->flushTimer.reset(new boost::asio::deadline_timer(m_ws_server.get_io_service())); }
+    con->flushTimer->expires_from_now(boost::posix_time::milliseconds(m_sendBatchWindow));
+    con->flushTimer->async_wait(websocketpp::lib::bind(&Server::do_flushTimer, this, hdl, websocketpp::lib::placeholders::_1));
+}
+
+#if defined(USE_TLS)
+void ServerTls::do_flushTimer(websocketpp::connection_hdl hdl, const boost::system::error_code& ec)
+#else
+void ServerNoTls::do_flushTimer(websocketpp::connection_hdl hdl, const boost::system::error_code& ec)
+#endif
+{
+    // Cancelled when the connection closes
+    if (ec) return;
+    do_flushWrites(hdl);
+}
+
+#if defined(USE_TLS)
+void ServerTls::do_flushWrites(websocketpp::connection_hdl hdl)
+#else
+void ServerNoTls::do_flushWrites(websocketpp::connection_hdl hdl)
+#endif
+{
+    websocketpp::lib::error_code ec;
+    ws_server_t::connection_ptr con = m_ws_server.get_con_from_hdl(hdl, ec);
+    if (!con) return;
+
+    boost::unique_lock<boost::mutex> lock(con->writeMutex);
+    con->bFlushScheduled = false;
+    if (con->bClosing) return;
+    std::vector<ws_server_t::message_ptr> pending;
+    pending.swap(con->pendingWrites);
+
+    if (pending.empty()) return;
+
+    // The frames are joined into one message so they go out in a single write. Sending under writeMutex keeps
+    // batches in order when several io threads flush the same connection.
+    WS_LOG(trace) << SERVER_CLASS_NAME << "::do_flushWrites() flushing " << pending.size() << " frames to hdl " << hdl.lock().get() << endl;
+    ec = con->send(pending.size() == 1 ? pending.front() : pool::join_prepared(pending, m_msgManager));
+    if (ec) { WS_LOG(trace) << SERVER_CLASS_NAME << "::do_flushWrites() failed sending to hdl " << hdl.lock().get() << ": " << ec.message() << endl; }
+}
+
+#if defined(USE_TLS)
+ServerTls::response_stream_ptr ServerTls::beginResponseStream(websocketpp::connection_hdl hdl, const json_spirit::Value& id)
+#else
+ServerNoTls::response_stream_ptr ServerNoTls::beginResponseStream(websocketpp::connection_hdl hdl, const json_spirit::Value& id)
+#endif
+{
+    if (!m_bRunning) return response_stream_ptr();
+    websocketpp::lib::error_code ec;
+    ws_server_t::connection_ptr con = m_ws_server.get_con_from_hdl(hdl, ec);
+    if (!con) return response_stream_ptr();
+
+    boost::unique_lock<boost::mutex> lock(con->writeMutex);
+    if (con->bClosing || con->bStreaming) return response_stream_ptr();
+
+    // Frames already batched for this connection must go out ahead of the stream
+    if (!con->pendingWrites.empty()) { con->send(pool::join_prepared(con->pendingWrites, m_msgManager)); }
+    con->pendingWrites.clear();
+    con->bStreaming = true;
+
+    WS_LOG(trace) << SERVER_CLASS_NAME << "::beginResponseStream() streaming response to hdl " << hdl.lock().get() << endl;
+    return response_stream_ptr(new ResponseStream(*this, hdl, id));
+}
+
+#if defined(USE_TLS)
+bool ServerTls::do_sendStreamFrame(websocketpp::connection_hdl hdl, const std::string& data, bool bFirst, bool bFin)
+#else
+bool ServerNoTls::do_sendStreamFrame(websocketpp::connection_hdl hdl, const std::string& data, bool bFirst, bool bFin)
+#endif
+{
+    using namespace websocketpp::frame;
+
+    if (!m_bRunning) return false;
+    websocketpp::lib::error_code ec;
+    ws_server_t::connection_ptr con = m_ws_server.get_con_from_hdl(hdl, ec);
+    if (!con) return false;
+
+    opcode::value op = bFirst ? opcode::text : opcode::continuation;
+    ws_server_t::message_ptr msg = m_msgManager->get_message(op, data.size());
+    msg->set_payload(data);
+    msg->set_header(prepare_header(basic_header(op, data.size(), bFin, false), extended_header(data.size())));
+    msg->set_prepared(true);
+
+    boost::unique_lock<boost::mutex> lock(con->writeMutex);
+    if (con->bClosing || !con->bStreaming) return false;
+    con->streamFrames.push_back(msg);
+    con->streamQueuedBytes += data.size();
+    do_drainStream(hdl, con);
+    return true;
+}
+
+#if defined(USE_TLS)
+void ServerTls::do_drainStream(websocketpp::connection_hdl hdl, ws_server_t::connection_ptr con)
+#else
+void ServerNoTls::do_drainStream(websocketpp::connection_hdl hdl, ws_server_t::connection_ptr con)
+#endif
+{
+    // Must be called with con->writeMutex held. websocketpp has no write completion hook, so frames the send
+    // buffer can't take yet are retried from a timer on the io service rather than waited for here.
+    while (!con->streamFrames.empty() && con->get_buffered_amount() <= m_streamBufferLimit)
+    {
+        ws_server_t::message_ptr msg = con->streamFrames.front();
+        con->streamFrames.pop_front();
+        con->streamQueuedBytes -= msg->get_payload().size();
+        websocketpp::lib::error_code ec = con->send(msg);
+        if (ec)
+        {
+            WS_LOG(trace) << SERVER_CLASS_NAME << "::do_drainStream() failed sending to hdl " << hdl.lock().get() << ": " << ec.message() << endl;
+            return;
+        }
+    }
+
+    if (!con->streamFrames.empty())
+    {
+        if (con->bDrainScheduled) return;
+        con->bDrainScheduled = true;
+        if (!con->drainTimer) { con->drainTimer.reset(new boost::asio::deadline_timer(m_ws_server.get_io_service())); }
+        con->drainTimer->expires_from_now(boost::posix_time::milliseconds(STREAM_DRAIN_INTERVAL_MS));
+        con->drainTimer->async_wait(websocketpp::lib::bind(&Server::do_drainTimer, this, hdl, websocketpp::lib::placeholders::_1));
+        return;
+    }
+
+    if (!con->bStreamEnding) return;
+
+    // Every frame is queued, so messages held back by the stream can follow
+    con->bStreaming = false;
+    con->bStreamEnding = false;
+    std::vector<ws_server_t::message_ptr> held;
+    held.swap(con->heldWrites);
+    for (auto& msg: held) { do_queueWrite(hdl, con, msg); }
+}
+
+#if defined(USE_TLS)
+void ServerTls::do_drainTimer(websocketpp::connection_hdl hdl, const boost::system::error_code& ec)
+#else
+void ServerNoTls::do_drainTimer(websocketpp::connection_hdl hdl, const boost::system::error_code& ec)
+#endif
+{
+    // Cancelled when the connection closes
+    if (ec) return;
+    websocketpp::lib::error_code error;
+    ws_server_t::connection_ptr con = m_ws_server.get_con_from_hdl(hdl, error);
+    if (!con) return;
+
+    boost::unique_lock<boost::mutex> lock(con->writeMutex);
+    con->bDrainScheduled = false;
+    if (con->bClosing) return;
+    do_drainStream(hdl, con);
+}
+
+#if defined(USE_TLS)
+void ServerTls::do_endStream(websocketpp::connection_hdl hdl, bool bAbort)
+#else
+void ServerNoTls::do_endStream(websocketpp::connection_hdl hdl, bool bAbort)
+#endif
+{
+    websocketpp::lib::error_code ec;
+    ws_server_t::connection_ptr con = m_ws_server.get_con_from_hdl(hdl, ec);
+    if (!con) return;
+
+    boost::unique_lock<boost::mutex> lock(con->writeMutex);
+    if (con->bClosing || !con->bStreaming) return;
+
+    if (bAbort)
+    {
+        // The client holds part of a message that can never be completed
+        WS_LOG(trace) << SERVER_CLASS_NAME << "::do_endStream() closing hdl " << hdl.lock().get() << " after an unfinished stream" << endl;
+        con->streamFrames.clear();
+        con->streamQueuedBytes = 0;
+        con->bClosing = true;
+        lock.unlock();
+        m_ws_server.close(hdl, websocketpp::close::status::internal_endpoint_error, "Response stream aborted", ec);
+        return;
+    }
+
+    con->bStreamEnding = true;
+    do_drainStream(hdl, con);
+}
+
+#if defined(USE_TLS)
+void ServerTls::do_closeConnectionData(websocketpp::connection_hdl hdl, connection_data_t& data)
+#else
+void ServerNoTls::do_closeConnectionData(websocketpp::connection_hdl hdl, connection_data_t& data)
+#endif
+{
+    // Must be called with m_connectionMutex held, before the connection's entry is erased. Nothing more is
+    // written to the connection after this.
+    if (data.keepAliveTimer) { m_timerWheel.cancel(data.keepAliveTimer); }
+
+    websocketpp::lib::error_code ec;
+    ws_server_t::connection_ptr con = m_ws_server.get_con_from_hdl(hdl, ec);
+    if (!con) return;
+    boost::unique_lock<boost::mutex> lock(con->writeMutex);
+    con->bClosing = true;
+    if (con->flushTimer) { con->flushTimer->cancel(); }
+    if (con->drainTimer) { con->drainTimer->cancel(); }
+    con->pendingWrites.clear();
+    con->heldWrites.clear();
+    con->streamFrames.clear();
+    con->streamQueuedBytes = 0;
+}
+
+#if defined(USE_TLS)
+void ServerTls::do_sendError(websocketpp::connection_hdl hdl, const std::string& json, websocketpp::frame::opcode::value op)
+#else
+void ServerNoTls::do_sendError(websocketpp::connection_hdl hdl, const std::string& json, websocketpp::frame::opcode::value op)
+#endif
+{
+    // Sent straight to the connection, even one not tracked in m_connections, unless it is mid-stream or
+    // being closed
+    websocketpp::lib::error_code ec;
+    ws_server_t::connection_ptr con = m_ws_server.get_con_from_hdl(hdl, ec);
+    if (!con) return;
+
+    boost::unique_lock<boost::mutex> lock(con->writeMutex);
+    if (con->bClosing) return;
+    if (con->bStreaming)
+    {
+        con->heldWrites.push_back(do_prepareMessage(json));
+        return;
+    }
+    ec = con->send(json, op);
+    if (ec) { WS_LOG(trace) << SERVER_CLASS_NAME << "::do_sendError() failed sending to hdl " << hdl.lock().get() << ": " << ec.message() << endl; }
+}
+
+#if defined(USE_TLS)
+ServerTls::ResponseStream::ResponseStream(Server& server, websocketpp::connection_hdl hdl, const json_spirit::Value& id)
+#else
+ServerNoTls::ResponseStream::ResponseStream(Server& server, websocketpp::connection_hdl hdl, const json_spirit::Value& id)
+#endif
+    : m_server(server), m_hdl(hdl), m_bStarted(false), m_bFinished(false), m_bFailed(false)
+{
+    // Same members as Response::getJson() with the result last so it can be streamed
+    m_buffer = "{\"error\":null,\"id\":" + json_spirit::write_string<json_spirit::Value>(id) + ",\"result\":";
+}
+
+#if defined(USE_TLS)
+ServerTls::ResponseStream::~ResponseStream()
+#else
+ServerNoTls::ResponseStream::~ResponseStream()
+#endif
+{
+    if (!m_bFinished) { m_server.do_endStream(m_hdl, m_bStarted); }
+}
+
+#if defined(USE_TLS)
+bool ServerTls::ResponseStream::write(const std::string& json)
+#else
+bool ServerNoTls::ResponseStream::write(const std::string& json)
+#endif
+{
+    if (m_bFinished || m_bFailed) return false;
+
+    // Refused rather than failed, so the producer can retry once the connection has caught up
+    if (m_bStarted && getQueuedBytes() > m_server.m_streamQueueLimit) return false;
+
+    m_buffer += json;
+    if (m_buffer.size() < m_server.m_streamFrameSize) return true;
+
+    if (!m_server.do_sendStreamFrame(m_hdl, m_buffer, !m_bStarted, false)) { m_bFailed = true; }
+    m_bStarted = true;
+    m_buffer.clear();
+    return !m_bFailed;
+}
+
+#if defined(USE_TLS)
+bool ServerTls::ResponseStream::finish()
+#else
+bool ServerNoTls::ResponseStream::finish()
+#endif
+{
+    if (m_bFinished || m_bFailed) return false;
+    m_buffer += "}";
+    if (!m_server.do_sendStreamFrame(m_hdl, m_buffer, !m_bStarted, true))
+    {
+        // Left unfinished so the destructor closes the connection if frames already went out
+        m_bFailed = true;
+        return false;
+    }
+    m_buffer.clear();
+    m_bFinished = true;
+    m_server.do_endStream(m_hdl, false);
+    return true;
+}
+
+#if defined(USE_TLS)
+std::size_t ServerTls::ResponseStream::getQueuedBytes() const
+#else
+std::size_t ServerNoTls::ResponseStream::getQueuedBytes() const
+#endif
+{
+    websocketpp::lib::error_code ec;
+    ws_server_t::connection_ptr con = m_server.m_ws_server.get_con_from_hdl(m_hdl, ec);
+    if (!con) return 0;
+    boost::unique_lock<boost::mutex> lock(con->writeMutex);
+    return con->streamQueuedBytes;
+}
+
+#if defined(USE_TLS)
+void ServerTls::setChannelDeltaMode(const std::string& channel, bool bEnabled)
+#else
+void ServerNoTls::setChannelDeltaMode(const std::string& channel, bool bEnabled)
+#endif
+{
+    boost::unique_lock<boost::mutex> lock(m_connectionMutex);
+    if (bEnabled)   { m_deltaChannels[channel]; }
+    else            { m_deltaChannels.erase(channel); }
+}
+
+#if defined(USE_TLS)
+void ServerTls::sendChannelDocument(const std::string& channel, const std::string& event, const json_spirit::Value& doc)
+#else
+void ServerNoTls::sendChannelDocument(const std::string& channel, const std::string& event, const json_spirit::Value& doc)
+#endif
+{
+    using namespace json_spirit;
+
+    if (!m_channelInvalidations.empty()) { do_invalidateChannel(channel); }
+    if (!m_bRunning) return;
+    boost::unique_lock<boost::mutex> lock(m_connectionMutex);
+    if (!m_bRunning) return;
+
+    auto range = m_channels.equal_range(channel);
+
+    auto deltaIt = m_deltaChannels.find(channel);
+    if (deltaIt == m_deltaChannels.end())
+    {
+        Object msg;
+        msg.push_back(Pair(m_eventField, event));
+        msg.push_back(Pair(m_dataField, doc));
+        string json(write_string<Value>(msg));
+        WS_LOG(trace) << SERVER_CLASS_NAME << "::sendChannelDocument() sending document to channel " << channel << ": " << json << endl;
+        for (channels_t::iterator it = range.first; it != range.second; ++it) { do_write(it->second, json); }
+        return;
+    }
+
+    delta_channel_t& deltaChannel = deltaIt->second;
+    Array patch;
+    if (deltaChannel.version > 0)
+    {
+        patch = JsonRpc::diff(deltaChannel.doc, doc);
+        if (patch.empty() && deltaChannel.event == event) return;
+    }
+
+    uint64_t base = deltaChannel.version++;
+    deltaChannel.event = event;
+    deltaChannel.doc = doc;
+
+    string deltaJson;
+    for (channels_t::iterator it = range.first; it != range.second; ++it)
+    {
+        auto versionIt = deltaChannel.versions.find(it->second);
+        if (base == 0 || versionIt == deltaChannel.versions.end() || versionIt->second != base)
+        {
+            do_sendSnapshot(channel, deltaChannel, it->second);
+            continue;
+        }
+
+        if (deltaJson.empty())
+        {
+            Object delta;
+            delta.push_back(Pair("channel", channel));
+            delta.push_back(Pair("version", deltaChannel.version));
+            delta.push_back(Pair("base", base));
+            delta.push_back(Pair("patch", patch));
+
+            Object msg;
+            msg.push_back(Pair(m_eventField, event));
+            msg.push_back(Pair(JsonRpc::DELTA_FIELD, delta));
+            deltaJson = write_string<Value>(msg);
+            WS_LOG(trace) << SERVER_CLASS_NAME << "::sendChannelDocument() sending delta to channel " << channel << ": " << deltaJson << endl;
+        }
+        do_write(it->second, deltaJson);
+        versionIt->second = deltaChannel.version;
+    }
+}
+
+#if defined(USE_TLS)
+void ServerTls::do_sendSnapshot(const std::string& channel, delta_channel_t& deltaChannel, websocketpp::connection_hdl hdl)
+#else
+void ServerNoTls::do_sendSnapshot(const std::string& channel, delta_channel_t& deltaChannel, websocketpp::connection_hdl hdl)
+#endif
+{
+    using namespace json_spirit;
+
+    Object delta;
+    delta.push_back(Pair("channel", channel));
+    delta.push_back(Pair("version", deltaChannel.version));
+    delta.push_back(Pair("data", deltaChannel.doc));
+
+    Object msg;
+    msg.push_back(Pair(m_eventField, deltaChannel.event));
+    msg.push_back(Pair(JsonRpc::DELTA_FIELD, delta));
+
+    string json(write_string<Value>(msg));
+    WS_LOG(trace) << SERVER_CLASS_NAME << "::do_sendSnapshot() sending snapshot to hdl " << hdl.lock().get() << ": " << json << endl;
+    do_write(hdl, json);
+    deltaChannel.versions[hdl] = deltaChannel.version;
+}
+
+#if defined(USE_TLS)
+bool ServerTls::do_resync(websocketpp::connection_hdl hdl, const JsonRpc::Request& request)
+#else
+bool ServerNoTls::do_resync(websocketpp::connection_hdl hdl, const JsonRpc::Request& request)
+#endif
+{
+    // Requests for anything other than a delta channel this connection is subscribed to go to the request queue.
+    // The caller answers the request once the snapshot is sent.
+    const json_spirit::Array& params = request.getParams();
+    if (params.size() != 1 || params[0].type() != json_spirit::str_type) return false;
+
+    const std::string& channel = params[0].get_str();
+    boost::unique_lock<boost::mutex> lock(m_connectionMutex);
+    auto deltaIt = m_deltaChannels.find(channel);
+    if (deltaIt == m_deltaChannels.end() || !deltaIt->second.versions.count(hdl)) return false;
+
+    WS_LOG(trace) << SERVER_CLASS_NAME << "::do_resync() resyncing hdl " << hdl.lock().get() << " on channel " << channel << endl;
+    do_sendSnapshot(channel, deltaIt->second, hdl);
+    return true;
+}
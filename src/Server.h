@@ -9,6 +9,12 @@
 #pragma once
 
 #include "JsonRpc.h"
+#include "IpFilter.h"
+#include "LruCache.h"
+#include "MessagePool.h"
+#include "RateLimiter.h"
+#include "RequestScheduler.h"
+#include "TimerWheel.h"
 
 #if defined(USE_TLS)
     #include <websocketpp/config/asio.hpp>
@@ -20,24 +26,83 @@
 #include <boost/thread.hpp>
 #include <boost/regex.hpp>
 
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <deque>
+#include <map>
 #include <memory>
-#include <queue>
 #include <set>
+#include <vector>
 
 namespace WebSocket
 {
 
 const std::string DEFAULT_ALLOWED_IPS = "^\\[(::1|::ffff:127\\.0\\.0\\.1)\\].*";
 
+const unsigned int TIMER_WHEEL_TICK_MS = 100;
+const std::size_t DEFAULT_RESULT_CACHE_BUDGET = 64 * 1024 * 1024;   // bytes
+const std::size_t DEFAULT_STREAM_FRAME_SIZE = 64 * 1024;            // bytes
+const std::size_t DEFAULT_STREAM_BUFFER_LIMIT = 1024 * 1024;        // bytes
+const std::size_t DEFAULT_STREAM_QUEUE_LIMIT = 8 * 1024 * 1024;     // bytes
+const unsigned int STREAM_DRAIN_INTERVAL_MS = 5;                    // how often queued stream frames are retried
+const unsigned int DEFAULT_FLIGHT_TIMEOUT = 60000;                  // ms a coalesced call with no request timeout may run
+const unsigned int DEFAULT_BATCH_TIMEOUT = 60000;                   // ms a batch with a call with no request timeout may wait
+
+#if defined(USE_TLS)
+const long DEFAULT_TLS_SESSION_CACHE_SIZE = 20480;
+const long DEFAULT_TLS_SESSION_TIMEOUT = 3600;      // seconds
+const time_t TLS_FILES_CHECK_INTERVAL = 5;          // seconds
+#endif
+
+// Keep-alive timestamps live on the websocketpp connection itself, so onMessage() can touch them without
+// looking the connection up under the server's connection mutex. Times are in ms since the server's epoch.
+struct connection_activity_t
+{
+    connection_activity_t() : lastActivity(0), lastMessage(0), bClosing(false) { }
+    std::atomic<uint64_t> lastActivity;     // last message or pong
+    std::atomic<uint64_t> lastMessage;
+    std::atomic<bool> bClosing;             // set under writeMutex once the server closes it or it closes
+};
+
+// Outbound messages wait on the connection too, behind its own writeMutex, so sends and broadcasts never take
+// the server's connection mutex. Sends are made holding writeMutex, which keeps other messages from landing
+// between a stream's frames. Lock order: the server's connection mutex, then writeMutex.
+template <typename message_ptr>
+struct connection_state_t : public connection_activity_t
+{
+    connection_state_t() : bFlushScheduled(false), bStreaming(false), bStreamEnding(false), streamQueuedBytes(0), bDrainScheduled(false) { }
+    boost::mutex writeMutex;
+
+    std::vector<message_ptr> pendingWrites;
+    bool bFlushScheduled;
+    std::shared_ptr<boost::asio::deadline_timer> flushTimer;   // created on the first batched write
+
+    bool bStreaming;
+    bool bStreamEnding;                         // finished, ends once its frames are sent
+    std::vector<message_ptr> heldWrites;        // data frames can't interleave with a stream
+    std::deque<message_ptr> streamFrames;       // waiting for the send buffer to drain
+    std::size_t streamQueuedBytes;
+    bool bDrainScheduled;
+    std::shared_ptr<boost::asio::deadline_timer> drainTimer;
+};
+
+template <typename base>
+struct ServerConfig : public PooledConfig<base>
+{
+    typedef ServerConfig<base> type;
+    typedef connection_state_t<typename PooledConfig<base>::message_type::ptr> connection_base;
+};
+
 #if defined(USE_TLS)
     class ServerTls;
     typedef ServerTls Server;
-    typedef websocketpp::server<websocketpp::config::asio_tls> ws_server_t;
+    typedef websocketpp::server<ServerConfig<websocketpp::config::asio_tls>> ws_server_t;
     const std::string SERVER_CLASS_NAME = "ServerTls";
 #else
     class ServerNoTls;
     typedef ServerNoTls Server;
-    typedef websocketpp::server<websocketpp::config::asio> ws_server_t;
+    typedef websocketpp::server<ServerConfig<websocketpp::config::asio>> ws_server_t;
     const std::string SERVER_CLASS_NAME = "ServerNoTls";
 #endif
 
@@ -55,16 +120,47 @@ public:
     typedef std::function<void(Server&, websocketpp::connection_hdl)> close_callback_t;
     typedef std::function<void(Server&, websocketpp::connection_hdl)> fail_callback_t;
     typedef std::function<void(Server&, const client_request_t&)> request_callback_t;
+    typedef ws_server_t::message_ptr payload_ptr;
+
+    // Writes one response as a fragmented websocket message. The first frame carries the response envelope,
+    // written JSON text follows in continuation frames and finish() closes the result and the message.
+    // Destroying an unfinished stream that already sent frames closes the connection.
+    class ResponseStream
+    {
+    public:
+        ~ResponseStream();
+
+        // Raw JSON text of the result, in order. Never blocks: frames the connection can't take yet wait in
+        // the server, and once more than the server's queue limit is waiting write() refuses the text and
+        // returns false, leaving the stream usable. Producers retry once getQueuedBytes() has dropped. Both
+        // return false for good once the stream has failed, e.g. because the connection closed.
+        bool write(const std::string& json);
+        bool finish();
+        std::size_t getQueuedBytes() const;
+        bool isFailed() const { return m_bFailed; }
+
+    private:
+        friend Server;
+        ResponseStream(Server& server, websocketpp::connection_hdl hdl, const json_spirit::Value& id);
+
+        Server& m_server;
+        websocketpp::connection_hdl m_hdl;
+        std::string m_buffer;
+        bool m_bStarted;
+        bool m_bFinished;
+        bool m_bFailed;
+    };
+    typedef std::shared_ptr<ResponseStream> response_stream_ptr;
 
 #if defined(USE_TLS)
     typedef websocketpp::lib::shared_ptr<boost::asio::ssl::context> context_ptr;
     typedef std::function<context_ptr(Server&, websocketpp::connection_hdl)> tls_init_callback_t;
 
-    ServerTls(int port, const std::string& allow_ips = DEFAULT_ALLOWED_IPS) { init(port, allow_ips); }
-    ServerTls(const std::string& port, const std::string& allow_ips = DEFAULT_ALLOWED_IPS) { init(strtoul(port.c_str(), NULL, 10), allow_ips); }
+    ServerTls(int port, const std::string& allow_ips = DEFAULT_ALLOWED_IPS) : m_resultCache(DEFAULT_RESULT_CACHE_BUDGET) { init(port, allow_ips); }
+    ServerTls(const std::string& port, const std::string& allow_ips = DEFAULT_ALLOWED_IPS) : m_resultCache(DEFAULT_RESULT_CACHE_BUDGET) { init(strtoul(port.c_str(), NULL, 10), allow_ips); }
 #else
-    ServerNoTls(int port, const std::string& allow_ips = DEFAULT_ALLOWED_IPS) { init(port, allow_ips); }
-    ServerNoTls(const std::string& port, const std::string& allow_ips = DEFAULT_ALLOWED_IPS) { init(strtoul(port.c_str(), NULL, 10), allow_ips); }
+    ServerNoTls(int port, const std::string& allow_ips = DEFAULT_ALLOWED_IPS) : m_resultCache(DEFAULT_RESULT_CACHE_BUDGET) { init(port, allow_ips); }
+    ServerNoTls(const std::string& port, const std::string& allow_ips = DEFAULT_ALLOWED_IPS) : m_resultCache(DEFAULT_RESULT_CACHE_BUDGET) { init(strtoul(port.c_str(), NULL, 10), allow_ips); }
 #endif
 
     void start();
@@ -92,36 +188,279 @@ public:
     void sendAll(const std::string& data);
     void sendChannel(const std::string& channel, const std::string& data);
 
+    // Queue a broadcast and return immediately - fan-out runs on the io threads
+    void publishAll(const JsonRpc::Response& res);
+    void publishChannel(const std::string& channel, const JsonRpc::Response& res);
+    void publishAll(const std::string& data);
+    void publishChannel(const std::string& channel, const std::string& data);
+
+    // Send a shared immutable payload. preparePayload() frames it once into a websocketpp message that every
+    // recipient of every send queues as is, instead of copying it per connection or per call. Text payloads
+    // are not UTF-8 validated.
+    payload_ptr preparePayload(const std::string& data) { return do_prepareMessage(data); }
+    void send(websocketpp::connection_hdl hdl, const payload_ptr& data);
+    void sendAll(const payload_ptr& data);
+    void sendChannel(const std::string& channel, const payload_ptr& data);
+    void publishAll(const payload_ptr& data);
+    void publishChannel(const std::string& channel, const payload_ptr& data);
+
+    // Start streaming the response to request id. Other messages to the connection are held until the stream
+    // ends. Returns null if the connection is gone or already streaming. Streamed methods must not be
+    // coalesced or cached. Frames are cut at frameSize bytes and are passed to the connection while its send
+    // buffer holds no more than bufferLimit bytes. Frames beyond that wait in the server, and
+    // ResponseStream::write() refuses more text while over queueLimit bytes are waiting.
+    response_stream_ptr beginResponseStream(websocketpp::connection_hdl hdl, const json_spirit::Value& id);
+    void setResponseStreamLimits(std::size_t frameSize, std::size_t bufferLimit, std::size_t queueLimit = DEFAULT_STREAM_QUEUE_LIMIT) { m_streamFrameSize = frameSize; m_streamBufferLimit = bufferLimit; m_streamQueueLimit = queueLimit; }
+
+    // Delta-encoded channels. Documents published on a delta channel go out as JSON Patch updates against the
+    // version each subscriber was last sent, with full snapshots on join or when the client asks to resync.
+    void setChannelDeltaMode(const std::string& channel, bool bEnabled = true);
+    void sendChannelDocument(const std::string& channel, const std::string& event, const json_spirit::Value& doc);
+    void setEventFields(const std::string& event_field, const std::string& data_field) { m_eventField = event_field; m_dataField = data_field; }
+
+    // Must be called before start()
+    void setIoThreadCount(unsigned int count) { m_ioThreadCount = count ? count : 1; }
+
+    // Connections sending a larger message are closed with status 1009 (message too big). Request params are
+    // only scanned on arrival; handlers can parse large ones an element at a time with Request::forEachParam().
+    void setMaxMessageSize(std::size_t size) { m_ws_server.set_max_message_size(size); }
+
+    // Frames sent to a connection are held for window ms, then copied into one buffer and written at once, so
+    // with TLS they also share records. 0 flushes at the end of the current event loop pass and -1 (the
+    // default) writes each frame immediately. Must be called before start().
+    void setSendBatchWindow(int window) { m_sendBatchWindow = window; }
+
+    // Replace the CIDR allow/deny lists at runtime. Throws std::invalid_argument and keeps the current lists
+    // if either list is invalid.
+    void setIpFilter(const std::string& allow, const std::string& deny = "");
+
+    // Token-bucket limits per remote address: rate is in events per second and burst the bucket size.
+    // A per-method request limit replaces the default one for that method. A rate of 0 removes the limit.
+    // Must be called before start().
+    void setConnectionRateLimit(double rate, double burst);
+    void setRequestRateLimit(double rate, double burst);
+    void setRequestRateLimit(const std::string& method, double rate, double burst);
+
+    // Connections with no inbound traffic for pingInterval ms are pinged and closed if no pong arrives within
+    // pongTimeout ms. Connections that send no messages for idleTimeout ms are closed. 0 disables each check.
+    // Closed connections are removed from all channels immediately, and messages still arriving on them are
+    // dropped without a reply. Must be called before start().
+    void setKeepAlive(unsigned int pingInterval, unsigned int pongTimeout, unsigned int idleTimeout = 0);
+
+    // Queued requests still waiting after their timeout are answered with a RequestTimeoutException error
+    // instead of reaching the request callback. The smaller of the client's timeout and the method default
+    // applies. 0 means no default. Must be called before start().
+    void setRequestTimeout(unsigned int timeout) { m_requestTimeout = timeout; }
+    void setRequestTimeout(const std::string& method, unsigned int timeout) { m_methodTimeouts[method] = timeout; }
+
+    // Requests are scheduled by weighted round-robin across priority classes and round-robin across
+    // connections within a class. Methods not assigned a class go to DEFAULT_PRIORITY_CLASS (weight 1).
+    // Must be called before start().
+    void setPriorityClass(const std::string& priorityClass, unsigned int weight) { m_requests.setClassWeight(priorityClass, weight); }
+    void setMethodPriorityClass(const std::string& method, const std::string& priorityClass) { m_requests.setMethodClass(method, priorityClass); }
+
+    // Concurrent calls to a coalesced method with identical params run the request callback once. The
+    // response is serialized once and sent to every caller with its own id. The callback sees a server
+    // generated id and must echo it in its response. Each caller gets a RequestTimeoutException error if no
+    // response arrives by its own request's deadline, or DEFAULT_FLIGHT_TIMEOUT ms after it called if it has
+    // none, and the call goes on while any caller still waits. Notifications are never coalesced. Must be
+    // called before start().
+    void setCoalescedMethod(const std::string& method, bool bEnabled = true);
+
+    // Successful results of a cached method are stored serialized for ttl ms, keyed like coalesced calls,
+    // and cache hits are answered on the io thread without queueing. Cached methods are also coalesced.
+    // Publishing on any of invalidatingChannels drops the method's entries. Least recently used entries are
+    // evicted once the cache exceeds its budget in bytes. Must be called before start().
+    void setCachedMethod(const std::string& method, unsigned int ttl, const std::vector<std::string>& invalidatingChannels = std::vector<std::string>());
+    void setResultCacheBudget(std::size_t budget) { m_resultCache.setBudget(budget); }
+    void invalidateCache(const std::string& method);
+
     void setValidateCallback(validate_callback_t callback) { m_validateCallback = callback; }
     void setOpenCallback(open_callback_t callback) { m_openCallback = callback; }
     void setCloseCallback(close_callback_t callback) { m_closeCallback = callback; }
     void setRequestCallback(request_callback_t callback) { m_requestCallback = callback; }
 
 #if defined(USE_TLS)
-    void setTlsInitCallback(tls_init_callback_t callback) { m_tlsInitCallback = callback; }
+    // By default the context returned by the callback is built once and shared by all connections so
+    // TLS sessions can be resumed. Pass bCache = false to call it for every connection instead.
+    void setTlsInitCallback(tls_init_callback_t callback, bool bCache = true);
+
+    // Builds the shared context from PEM files and rebuilds it when any of the files change
+    void setTlsFiles(const std::string& certChainFile, const std::string& privateKeyFile, const std::string& dhFile = "");
+
+    // Server-side session cache and session tickets for abbreviated handshakes
+    void setTlsSessionCache(long size, long timeoutSecs) { m_tlsSessionCacheSize = size; m_tlsSessionTimeout = timeoutSecs; }
 #endif
 
 private:
     ws_server_t m_ws_server;
 
-    typedef std::set<websocketpp::connection_hdl> connections_t;
+    struct connection_data_t
+    {
+        connection_data_t() : pingSent(0), bPingPending(false), keepAliveTimer(0) { }
+        boost::asio::ip::address address;
+
+        uint64_t pingSent;          // ms since m_epoch
+        bool bPingPending;
+        TimerWheel::timer_id_t keepAliveTimer;
+    };
+    typedef std::map<websocketpp::connection_hdl, connection_data_t> connections_t;
     connections_t m_connections;
 
     typedef std::multimap<std::string, websocketpp::connection_hdl> channels_t;
     channels_t m_channels;
 
+    struct delta_channel_t
+    {
+        delta_channel_t() : version(0) { }
+        std::string event;
+        json_spirit::Value doc;
+        uint64_t version;
+        std::map<websocketpp::connection_hdl, uint64_t> versions; // last version sent to each subscriber
+    };
+    typedef std::map<std::string, delta_channel_t> delta_channels_t;
+    delta_channels_t m_deltaChannels;
+
+    std::string m_eventField;
+    std::string m_dataField;
+
     int m_port;
+
+    // Connections are checked against the CIDR filter. Constructor arguments that are not CIDR lists
+    // are treated as legacy regexes over the remote endpoint string.
+    std::shared_ptr<const IpFilter> m_ipFilter;
+    boost::mutex m_ipFilterMutex;
     boost::regex m_allow_ips_regex;
 
-    typedef std::queue<client_request_t> request_queue_t;
+    std::shared_ptr<RateLimiter> m_connectionLimiter;
+    std::shared_ptr<RateLimiter> m_requestLimiter;
+    typedef std::map<std::string, std::shared_ptr<RateLimiter>> method_limiters_t;
+    method_limiters_t m_methodLimiters;
+
+    bool do_allowRequest(websocketpp::connection_hdl hdl, const std::string& method);
+
+    // One timer wheel, driven by a single asio timer, runs the keepalive checks for every connection and
+    // expires coalesced flights and batches
+    unsigned int m_pingInterval;
+    unsigned int m_pongTimeout;
+    unsigned int m_idleTimeout;
+    std::chrono::steady_clock::time_point m_epoch;
+    TimerWheel m_timerWheel;
+    std::shared_ptr<boost::asio::deadline_timer> m_wheelTimer;
+
+    uint64_t do_now() const { return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_epoch).count(); }
+    bool do_isKeepAliveEnabled() const { return m_pingInterval || m_idleTimeout; }
+    void onWheelTick(const boost::system::error_code& ec);
+    void onPong(websocketpp::connection_hdl hdl, std::string payload);
+    void do_checkKeepAlive(websocketpp::connection_hdl hdl);
+
+    struct queued_request_t
+    {
+        client_request_t request;
+        std::chrono::steady_clock::time_point arrival;
+        std::chrono::steady_clock::time_point deadline;     // time_point::max() if none
+    };
+
+    typedef RequestScheduler<queued_request_t, void*> request_queue_t;
     request_queue_t m_requests;
 
+    // In-flight coalesced calls, by request key and by the token that replaced the leading call's id. Each
+    // caller times out at its own deadline, and the flight goes on while any caller still waits.
+    struct waiter_t
+    {
+        websocketpp::connection_hdl hdl;
+        json_spirit::Value id;
+        std::chrono::steady_clock::time_point deadline;
+    };
+    struct flight_t
+    {
+        std::string key;
+        std::string token;
+        std::string method;
+        uint64_t generation;    // cache generation of the method when the call started
+        websocketpp::connection_hdl leader;
+        TimerWheel::timer_id_t expiryTimer;
+        std::chrono::steady_clock::time_point expiry;   // the earliest waiter deadline, when expiryTimer fires
+        std::vector<waiter_t> waiters;
+    };
+    std::set<std::string> m_coalescedMethods;
+    std::map<std::string, std::shared_ptr<flight_t>> m_flights;
+    std::map<std::string, std::string> m_flightLeaders;
+    uint64_t m_nextFlightToken;
+    boost::mutex m_flightMutex;
+
+    bool do_isTrackingFlights() const { return !m_coalescedMethods.empty() || !m_cachedMethods.empty(); }
+    bool do_isFlightToken(const json_spirit::Value& id) const;
+    bool do_joinFlight(websocketpp::connection_hdl hdl, JsonRpc::Request& request, const std::string& key, std::chrono::steady_clock::time_point deadline);
+    bool do_completeFlight(websocketpp::connection_hdl hdl, const JsonRpc::Response& res);
+    bool do_completeFlight(websocketpp::connection_hdl hdl, const std::string& data);
+    void do_scheduleFlightExpiry(flight_t& flight);
+    bool do_expireFlight(const std::string& token);
+
+    // A message holding a JSON-RPC batch array is answered with one array once every call in it is answered.
+    // Notifications in it get no reply. The request callback sees each call on its own, with a server
+    // generated id it must echo as for coalesced calls, so batched calls can't be streamed. Calls unanswered
+    // by the latest deadline among them, or after DEFAULT_BATCH_TIMEOUT ms if one has none, are answered
+    // with RequestTimeoutException errors. Batches waiting for replies are kept by number, and a call's token
+    // is BATCH_TOKEN_PREFIX, the number, '-', its index.
+    struct batch_t
+    {
+        websocketpp::connection_hdl hdl;
+        std::vector<json_spirit::Value> ids;    // the callers' ids
+        std::vector<std::string> replies;       // empty for notifications
+        std::vector<bool> pending;
+        std::size_t remaining;                  // pending replies, plus one while calls are being dispatched
+        TimerWheel::timer_id_t expiryTimer;
+    };
+    std::map<uint64_t, std::shared_ptr<batch_t>> m_batches;
+    uint64_t m_nextBatch;
+    std::atomic<unsigned int> m_batchCount;
+    boost::mutex m_batchMutex;
+
+    std::chrono::steady_clock::time_point do_dispatchRequest(websocketpp::connection_hdl hdl, JsonRpc::Request& request, websocketpp::frame::opcode::value op);
+    void do_dispatchBatch(websocketpp::connection_hdl hdl, ws_server_t::message_ptr msg);
+    bool do_completeBatch(websocketpp::connection_hdl hdl, const JsonRpc::Response& res);
+    bool do_completeBatch(websocketpp::connection_hdl hdl, const std::string& data);
+    void do_setBatchReply(uint64_t number, std::size_t index, const std::string& json);
+    void do_expireBatch(uint64_t number);
+
+    struct cached_method_t
+    {
+        cached_method_t() : ttl(0), generation(0) { }
+        unsigned int ttl;
+        uint64_t generation;    // bumped on invalidation so results computed before it are not stored
+    };
+    std::map<std::string, cached_method_t> m_cachedMethods;
+    std::multimap<std::string, std::string> m_channelInvalidations;
+    LruCache<std::string> m_resultCache;    // serialized response up to the id, by request key
+
+    bool do_sendCachedResult(websocketpp::connection_hdl hdl, const JsonRpc::Request& request, const std::string& key);
+    void do_invalidateChannel(const std::string& channel);
+
+    unsigned int m_requestTimeout;
+    std::map<std::string, unsigned int> m_methodTimeouts;
+
     validate_callback_t m_validateCallback;
     open_callback_t m_openCallback;
     close_callback_t m_closeCallback;
     request_callback_t m_requestCallback;
 #if defined(USE_TLS)
     tls_init_callback_t m_tlsInitCallback;
+    bool m_bCacheTlsContext;
+
+    boost::mutex m_tlsMutex;
+    context_ptr m_tlsContext;
+    std::string m_certChainFile;
+    std::string m_privateKeyFile;
+    std::string m_dhFile;
+    time_t m_tlsFilesMTime;
+    time_t m_tlsLastCheck;
+    long m_tlsSessionCacheSize;
+    long m_tlsSessionTimeout;
+
+    time_t do_getTlsFilesMTime() const;
+    context_ptr do_newTlsContext();
+    void do_initTlsSessionCache(context_ptr ctx, context_ptr previous);
 #endif
 
     boost::mutex m_requestMutex;
@@ -145,11 +484,40 @@ private:
     boost::mutex m_startMutex;
 
     boost::thread m_request_loop_thread;
-    boost::thread m_io_service_thread;
+    boost::thread_group m_io_service_threads;
+    unsigned int m_ioThreadCount;
+    int m_sendBatchWindow;
 
     void init(int port, const std::string& allow_ips);
 
     void do_removeFromAllChannels(websocketpp::connection_hdl hdl);
+
+    bool do_resync(websocketpp::connection_hdl hdl, const JsonRpc::Request& request);
+    void do_sendSnapshot(const std::string& channel, delta_channel_t& deltaChannel, websocketpp::connection_hdl hdl);
+
+    typedef std::shared_ptr<std::vector<websocketpp::connection_hdl>> hdl_list_ptr;
+    void do_publish(const std::string& channel, bool bAll, ws_server_t::message_ptr msg);
+    void do_fanout(hdl_list_ptr hdls, std::size_t begin, std::size_t end, ws_server_t::message_ptr msg);
+
+    typedef ws_server_t::connection_type::con_msg_manager_type msg_manager_t;
+    std::shared_ptr<msg_manager_t> m_msgManager;
+    ws_server_t::message_ptr do_prepareMessage(const std::string& data);
+
+    void do_write(websocketpp::connection_hdl hdl, const std::string& data);
+    void do_write(websocketpp::connection_hdl hdl, const ws_server_t::message_ptr& msg);
+    void do_queueWrite(websocketpp::connection_hdl hdl, ws_server_t::connection_ptr con, const ws_server_t::message_ptr& msg);
+    void do_flushTimer(websocketpp::connection_hdl hdl, const boost::system::error_code& ec);
+    void do_flushWrites(websocketpp::connection_hdl hdl);
+
+    std::size_t m_streamFrameSize;
+    std::size_t m_streamBufferLimit;
+    std::size_t m_streamQueueLimit;
+    bool do_sendStreamFrame(websocketpp::connection_hdl hdl, const std::string& data, bool bFirst, bool bFin);
+    void do_endStream(websocketpp::connection_hdl hdl, bool bAbort);
+    void do_drainStream(websocketpp::connection_hdl hdl, ws_server_t::connection_ptr con);
+    void do_drainTimer(websocketpp::connection_hdl hdl, const boost::system::error_code& ec);
+    void do_closeConnectionData(websocketpp::connection_hdl hdl, connection_data_t& data);
+    void do_sendError(websocketpp::connection_hdl hdl, const std::string& json, websocketpp::frame::opcode::value op);
 };
 
 }
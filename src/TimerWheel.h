@@ -0,0 +1,142 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// TimerWheel.h
+//
+// Copyright (c) 2014 Eric Lombrozo
+//
+// All Rights Reserved.
+
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+namespace WebSocket
+{
+
+// Hierarchical timing wheel with four levels of 64 slots. Timers due within 2^24 ticks sit in a slot and are
+// cascaded to finer levels as time advances; later ones wait in an overflow list. Scheduling and cancelling
+// are O(1) and a single external clock drives every timer through advance().
+class TimerWheel
+{
+public:
+    typedef uint64_t timer_id_t;
+    typedef std::function<void()> callback_t;
+
+    explicit TimerWheel(uint64_t now = 0) : m_now(now), m_nextId(1) { }
+
+    // Fires callback once delay ticks from the current time (at least one tick)
+    timer_id_t schedule(uint64_t delay, callback_t callback)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        timer_id_t id = m_nextId++;
+        entry_t& entry = m_timers[id];
+        entry.expiry = m_now + (delay ? delay : 1);
+        entry.callback = callback;
+        place(id, entry.expiry);
+        return id;
+    }
+
+    bool cancel(timer_id_t id)
+    {
+        // Slots keep the stale id until they are next visited
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_timers.erase(id) > 0;
+    }
+
+    // Fires every timer due up to and including now. Callbacks run without the lock held, so they may
+    // schedule or cancel timers.
+    void advance(uint64_t now)
+    {
+        std::vector<callback_t> due;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_timers.empty() && now > m_now)
+            {
+                clearSlots();
+                m_now = now;
+            }
+            while (m_now < now)
+            {
+                m_now++;
+                for (int level = LEVELS; level > 0; level--)
+                {
+                    if (m_now & ((1ULL << (level * SLOT_BITS)) - 1)) continue;
+                    if (level == LEVELS)    { cascade(m_overflow); }
+                    else                    { cascade(m_slots[level][(m_now >> (level * SLOT_BITS)) & SLOT_MASK]); }
+                }
+
+                std::vector<timer_id_t>& slot = m_slots[0][m_now & SLOT_MASK];
+                for (auto id: slot)
+                {
+                    auto it = m_timers.find(id);
+                    if (it == m_timers.end()) continue;
+                    due.push_back(it->second.callback);
+                    m_timers.erase(it);
+                }
+                slot.clear();
+            }
+        }
+
+        for (auto& callback: due) { callback(); }
+    }
+
+    std::size_t size()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_timers.size();
+    }
+
+private:
+    enum { LEVELS = 4, SLOT_BITS = 6, SLOTS = 1 << SLOT_BITS, SLOT_MASK = SLOTS - 1 };
+
+    struct entry_t
+    {
+        uint64_t expiry;
+        callback_t callback;
+    };
+
+    std::unordered_map<timer_id_t, entry_t> m_timers;
+    std::vector<timer_id_t> m_slots[LEVELS][SLOTS];
+    std::vector<timer_id_t> m_overflow;
+    uint64_t m_now;
+    timer_id_t m_nextId;
+    std::mutex m_mutex;
+
+    // A timer goes in the finest level whose higher-order bits it shares with the current time
+    void place(timer_id_t id, uint64_t expiry)
+    {
+        for (int level = 0; level < LEVELS; level++)
+        {
+            int shift = (level + 1) * SLOT_BITS;
+            if ((expiry >> shift) == (m_now >> shift))
+            {
+                m_slots[level][(expiry >> (level * SLOT_BITS)) & SLOT_MASK].push_back(id);
+                return;
+            }
+        }
+        m_overflow.push_back(id);
+    }
+
+    void cascade(std::vector<timer_id_t>& slot)
+    {
+        std::vector<timer_id_t> ids;
+        ids.swap(slot);
+        for (auto id: ids)
+        {
+            auto it = m_timers.find(id);
+            if (it != m_timers.end()) { place(id, it->second.expiry); }
+        }
+    }
+
+    void clearSlots()
+    {
+        for (auto& level: m_slots) { for (auto& slot: level) { slot.clear(); } }
+        m_overflow.clear();
+    }
+};
+
+}
@@ -0,0 +1,142 @@
+#include <Server.h>
+
+#include "Loopback.h"
+#include "UnitTest.h"
+
+#include <atomic>
+#include <future>
+#include <thread>
+
+using namespace WebSocket;
+using namespace json_spirit;
+using namespace std;
+
+const int SERVER_PORT = 12421;
+const int REJECTING_PORT = 12422;
+
+atomic<int> g_notifications(0);
+
+// Echoes "echo" calls, counts "note" notifications and never answers "slow"
+void requestCallback(Server& server, const Server::client_request_t& req)
+{
+    const string& method = req.second.getMethod();
+    if (method == "note") { g_notifications++; }
+    if (method != "echo") return;
+
+    JsonRpc::Response res;
+    res.setResult(req.second.getParams()[0], req.second.getId());
+    server.send(req.first, res);
+}
+
+Array readReplies(Loopback::RawConnection& connection)
+{
+    string message;
+    Value replies;
+    if (!connection.readMessage(message) || !read_string(message, replies) || replies.type() != array_type) return Array();
+    return replies.get_array();
+}
+
+void testBatchReplies()
+{
+    Loopback::RawConnection connection;
+    CHECK(connection.connect(SERVER_PORT));
+
+    // One array answers the calls in order, with nothing for the notification
+    connection.send("[{\"method\": \"echo\", \"params\": [1], \"id\": 1}, {\"method\": \"note\", \"params\": []}, {\"method\": \"echo\", \"params\": [2], \"id\": 2}]");
+    Array replies = readReplies(connection);
+    CHECK(replies.size() == 2);
+    if (replies.size() != 2) return;
+    CHECK(find_value(replies[0].get_obj(), "id") == Value(1));
+    CHECK(find_value(replies[0].get_obj(), "result") == Value(1));
+    CHECK(find_value(replies[1].get_obj(), "id") == Value(2));
+    CHECK(find_value(replies[1].get_obj(), "result") == Value(2));
+    CHECK(g_notifications == 1);
+}
+
+void testBatchExpiry()
+{
+    Loopback::RawConnection connection;
+    CHECK(connection.connect(SERVER_PORT));
+
+    // The array waits for the unanswered call until its deadline, then times it out
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    connection.send("[{\"method\": \"echo\", \"params\": [3], \"id\": 3}, {\"method\": \"slow\", \"params\": [], \"id\": 4}]");
+    Array replies = readReplies(connection);
+    CHECK(chrono::steady_clock::now() - start >= chrono::milliseconds(200));
+    CHECK(replies.size() == 2);
+    if (replies.size() != 2) return;
+    CHECK(find_value(replies[0].get_obj(), "result") == Value(3));
+    CHECK(find_value(replies[1].get_obj(), "id") == Value(4));
+    const Value& error = find_value(replies[1].get_obj(), "error");
+    CHECK(error.type() == obj_type && find_value(error.get_obj(), "message") == Value("Request timed out."));
+}
+
+// Stands in for a server that can't read batches. Once a second array arrives it rejects the first with an
+// error without an id, and it answers nothing else.
+struct RejectingServer
+{
+    typedef websocketpp::server<websocketpp::config::asio> server_t;
+
+    RejectingServer() : arrays(0)
+    {
+        server.clear_access_channels(websocketpp::log::alevel::all);
+        server.clear_error_channels(websocketpp::log::elevel::all);
+        server.init_asio();
+        server.set_message_handler([this](websocketpp::connection_hdl hdl, server_t::message_ptr msg)
+        {
+            if (msg->get_payload()[0] != '[') return;
+            if (++arrays == 2) { server.send(hdl, "{\"error\": {\"message\": \"Invalid request.\", \"code\": null}, \"id\": null}", websocketpp::frame::opcode::text); }
+        });
+        server.listen(REJECTING_PORT);
+        server.start_accept();
+        thread = std::thread([this]() { server.run(); });
+    }
+
+    ~RejectingServer()
+    {
+        server.stop();
+        thread.join();
+    }
+
+    server_t server;
+    atomic<int> arrays;
+    std::thread thread;
+};
+
+void testRejectedBatch()
+{
+    RejectingServer server;
+    Loopback::TestClient testClient;
+    testClient.client.setBatching(1000, 2);
+    CHECK(testClient.connect(REJECTING_PORT));
+
+    // Two calls fill an array, so these go out as two arrays
+    future<Value> first = testClient.client.call("echo", Array(1, 1));
+    future<Value> second = testClient.client.call("echo", Array(1, 2));
+    future<Value> third = testClient.client.call("echo", Array(1, 3));
+    future<Value> fourth = testClient.client.call("echo", Array(1, 4));
+    CHECK(Loopback::waitFor([&]() { return server.arrays == 2; }));
+
+    // Only the rejected array's calls fail
+    CHECK_THROWS(first.get(), RpcError);
+    CHECK_THROWS(second.get(), RpcError);
+    CHECK(third.wait_for(chrono::milliseconds(200)) == future_status::timeout);
+    CHECK(fourth.wait_for(chrono::milliseconds(0)) == future_status::timeout);
+
+    testClient.client.stop();
+}
+
+int main()
+{
+    Server server(SERVER_PORT);
+    server.setRequestCallback(&requestCallback);
+    server.setRequestTimeout("slow", 200);
+    server.start();
+
+    testBatchReplies();
+    testBatchExpiry();
+    testRejectedBatch();
+
+    server.stop();
+    return UNIT_TEST_RESULT("BatchTest");
+}
@@ -0,0 +1,136 @@
+#include <ClientPool.h>
+#include <Server.h>
+
+#include "Loopback.h"
+#include "UnitTest.h"
+
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <vector>
+
+using namespace WebSocket;
+using namespace json_spirit;
+using namespace std;
+
+const int PORT_A = 12411;
+const int PORT_B = 12412;
+
+const string TICK = "{\"event\": \"tick\", \"data\": 1}";
+
+// One of the pool's servers. It counts what it receives, and leaves "hold" calls unanswered unless the
+// topic's subscription came to it.
+struct Peer
+{
+    explicit Peer(int port) : server(port), opens(0), subscribes(0), echoes(0)
+    {
+        server.setMaxMessageSize(1024);
+        server.setOpenCallback([this](Server&, websocketpp::connection_hdl) { opens++; });
+        server.setRequestCallback([this](Server& server, const Server::client_request_t& req) { onRequest(server, req); });
+        server.start();
+    }
+
+    ~Peer()
+    {
+        release();
+        server.stop();
+    }
+
+    void onRequest(Server& server, const Server::client_request_t& req)
+    {
+        const string& method = req.second.getMethod();
+        if (method == "subscribe")  { subscribes++; }
+        if (method == "echo")       { echoes++; }
+        if (method == "hold" && !subscribes)
+        {
+            lock_guard<mutex> lock(heldMutex);
+            held.push_back(make_pair(req.first, req.second.getId()));
+            return;
+        }
+
+        JsonRpc::Response res;
+        res.setResult(true, req.second.getId());
+        server.send(req.first, res);
+    }
+
+    size_t heldCount()
+    {
+        lock_guard<mutex> lock(heldMutex);
+        return held.size();
+    }
+
+    void release()
+    {
+        lock_guard<mutex> lock(heldMutex);
+        for (auto& call: held)
+        {
+            JsonRpc::Response res;
+            res.setResult(true, call.second);
+            server.send(call.first, res);
+        }
+        held.clear();
+    }
+
+    Server server;
+    atomic<int> opens;
+    atomic<int> subscribes;
+    atomic<int> echoes;
+    mutex heldMutex;
+    vector<pair<websocketpp::connection_hdl, Value>> held;
+};
+
+void testSelectionAndMigration()
+{
+    Peer a(PORT_A);
+    Peer b(PORT_B);
+    ClientPool pool(vector<string>{ Loopback::url(PORT_A), Loopback::url(PORT_B) }, 1, "event", "data", 2);
+    pool.setReconnectDelays(50, 100);
+    pool.start();
+    CHECK(Loopback::waitFor([&]() { return pool.getConnectedCount() == 2; }));
+
+    atomic<int> poolEvents(0);
+    atomic<int> topicEvents(0);
+    pool.on("tick", [&](const Value&) { poolEvents++; });
+    pool.subscribe("tick", JsonRpc::Request("subscribe"), [&](const Value&) { topicEvents++; });
+    CHECK(Loopback::waitFor([&]() { return a.subscribes + b.subscribes == 1; }));
+    Peer& owner = a.subscribes ? a : b;
+    Peer& other = a.subscribes ? b : a;
+
+    // The owner answers holds at once, so this stops with a single call outstanding, on the other member
+    for (int i = 0; i < 10 && !other.heldCount(); i++)
+    {
+        future<Value> result = pool.call(JsonRpc::Request("hold"));
+        CHECK(Loopback::waitFor([&]() { return other.heldCount() || result.wait_for(chrono::seconds(0)) == future_status::ready; }));
+    }
+    CHECK(other.heldCount() == 1);
+
+    // Calls go to the member with the fewest outstanding
+    for (int i = 0; i < 5; i++) { pool.call(JsonRpc::Request("echo")).get(); }
+    CHECK(owner.echoes == 5);
+    CHECK(other.echoes == 0);
+
+    // A message over the owner's size limit closes its connection, moving the topic to the other member.
+    // The owner's member reconnects without it.
+    int ownerOpens = owner.opens;
+    pool.send(JsonRpc::Request("echo", Array(1, string(2048, 'x'))));
+    CHECK(Loopback::waitFor([&]() { return other.subscribes == 1; }));
+    CHECK(Loopback::waitFor([&]() { return owner.opens > ownerOpens && pool.getConnectedCount() == 2; }));
+    CHECK(owner.subscribes == 1);
+
+    // Handlers installed with on() stay on the member the topic left; the topic's own handlers don't
+    owner.server.sendAll(TICK);
+    CHECK(Loopback::waitFor([&]() { return poolEvents == 1; }));
+    other.server.sendAll(TICK);
+    CHECK(Loopback::waitFor([&]() { return poolEvents == 2 && topicEvents == 1; }));
+    this_thread::sleep_for(chrono::milliseconds(100));
+    CHECK(poolEvents == 2);
+    CHECK(topicEvents == 1);
+
+    other.release();
+}
+
+int main()
+{
+    testSelectionAndMigration();
+    return UNIT_TEST_RESULT("ClientPoolTest");
+}
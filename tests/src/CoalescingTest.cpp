@@ -0,0 +1,106 @@
+#include <Server.h>
+
+#include "Loopback.h"
+#include "UnitTest.h"
+
+#include <atomic>
+#include <mutex>
+
+using namespace WebSocket;
+using namespace json_spirit;
+using namespace std;
+
+const int SERVER_PORT = 12441;
+
+// "quote" calls are held until the test answers them
+atomic<int> g_calls(0);
+mutex g_heldMutex;
+vector<pair<websocketpp::connection_hdl, Value>> g_held;
+
+void requestCallback(Server& server, const Server::client_request_t& req)
+{
+    g_calls++;
+    lock_guard<mutex> lock(g_heldMutex);
+    g_held.push_back(make_pair(req.first, req.second.getId()));
+}
+
+void answerHeld(Server& server)
+{
+    lock_guard<mutex> lock(g_heldMutex);
+    for (auto& call: g_held)
+    {
+        JsonRpc::Response res;
+        res.setResult(42, call.second);
+        server.send(call.first, res);
+    }
+    g_held.clear();
+}
+
+Object readReply(Loopback::RawConnection& connection, unsigned int timeout = 5000)
+{
+    string message;
+    Value reply;
+    if (!connection.readMessage(message, timeout) || !read_string(message, reply) || reply.type() != obj_type) return Object();
+    return reply.get_obj();
+}
+
+void testCoalescedCalls(Server& server)
+{
+    Loopback::RawConnection first;
+    Loopback::RawConnection second;
+    CHECK(first.connect(SERVER_PORT));
+    CHECK(second.connect(SERVER_PORT));
+
+    first.send("{\"method\": \"quote\", \"params\": [\"a\"], \"id\": 1}");
+    CHECK(Loopback::waitFor([]() { return g_calls == 1; }));
+    second.send("{\"method\": \"quote\", \"params\": [\"a\"], \"id\": 2}");
+    this_thread::sleep_for(chrono::milliseconds(100));
+    CHECK(g_calls == 1);
+
+    // One answer reaches both callers, each with its own id
+    answerHeld(server);
+    Object reply = readReply(first);
+    CHECK(find_value(reply, "id") == Value(1));
+    CHECK(find_value(reply, "result") == Value(42));
+    reply = readReply(second);
+    CHECK(find_value(reply, "id") == Value(2));
+    CHECK(find_value(reply, "result") == Value(42));
+}
+
+void testCallerDeadlines(Server& server)
+{
+    Loopback::RawConnection impatient;
+    Loopback::RawConnection patient;
+    CHECK(impatient.connect(SERVER_PORT));
+    CHECK(patient.connect(SERVER_PORT));
+
+    impatient.send("{\"method\": \"quote\", \"params\": [\"b\"], \"id\": 1, \"timeout\": 100}");
+    CHECK(Loopback::waitFor([]() { return g_calls == 2; }));
+    patient.send("{\"method\": \"quote\", \"params\": [\"b\"], \"id\": 2, \"timeout\": 5000}");
+
+    // The leading caller's deadline only times out that caller
+    Object reply = readReply(impatient);
+    CHECK(find_value(reply, "id") == Value(1));
+    CHECK(find_value(reply, "error").type() == obj_type);
+    CHECK(readReply(patient, 200).empty());
+
+    answerHeld(server);
+    reply = readReply(patient);
+    CHECK(find_value(reply, "id") == Value(2));
+    CHECK(find_value(reply, "result") == Value(42));
+    CHECK(g_calls == 2);
+}
+
+int main()
+{
+    Server server(SERVER_PORT);
+    server.setRequestCallback(&requestCallback);
+    server.setCoalescedMethod("quote");
+    server.start();
+
+    testCoalescedCalls(server);
+    testCallerDeadlines(server);
+
+    server.stop();
+    return UNIT_TEST_RESULT("CoalescingTest");
+}
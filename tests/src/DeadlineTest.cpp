@@ -0,0 +1,100 @@
+#include <Server.h>
+
+#include "Loopback.h"
+#include "UnitTest.h"
+
+#include <atomic>
+#include <map>
+#include <thread>
+
+using namespace WebSocket;
+using namespace json_spirit;
+using namespace std;
+
+const int SERVER_PORT = 12491;
+const int BLOCK_MS = 300;
+
+atomic<int> g_handled(0);
+
+// "block" holds up the request loop for BLOCK_MS. Everything else is answered at once and counted.
+void requestCallback(Server& server, const Server::client_request_t& req)
+{
+    if (req.second.getMethod() == "block")  { this_thread::sleep_for(chrono::milliseconds(BLOCK_MS)); }
+    else                                    { g_handled++; }
+
+    JsonRpc::Response res;
+    res.setResult(true, req.second.getId());
+    server.send(req.first, res);
+}
+
+// Replies by id
+map<int, Object> readReplies(Loopback::RawConnection& connection, int count)
+{
+    map<int, Object> replies;
+    string message;
+    Value reply;
+    for (int i = 0; i < count && connection.readMessage(message); i++)
+    {
+        if (!read_string(message, reply) || reply.type() != obj_type) continue;
+        const Value& id = find_value(reply.get_obj(), "id");
+        if (id.type() == int_type) { replies[id.get_int()] = reply.get_obj(); }
+    }
+    return replies;
+}
+
+bool isTimeout(const Object& reply)
+{
+    const Value& error = find_value(reply, "error");
+    return error.type() == obj_type && find_value(error.get_obj(), "message") == Value("Request timed out.");
+}
+
+// A request still queued past the client's timeout is answered with an error and never handled
+void testClientTimeout()
+{
+    Loopback::RawConnection connection;
+    CHECK(connection.connect(SERVER_PORT));
+    int handled = g_handled;
+
+    connection.send("{\"method\": \"block\", \"params\": [], \"id\": 1}");
+    connection.send("{\"method\": \"echo\", \"params\": [], \"id\": 2, \"timeout\": 100}");
+    connection.send("{\"method\": \"echo\", \"params\": [], \"id\": 3}");
+    map<int, Object> replies = readReplies(connection, 3);
+    CHECK(replies.size() == 3);
+    CHECK(find_value(replies[1], "result") == Value(true));
+    CHECK(isTimeout(replies[2]));
+    CHECK(find_value(replies[3], "result") == Value(true));
+    CHECK(g_handled == handled + 1);
+}
+
+// The server's per-method timeout applies when the client gives none
+void testMethodTimeout()
+{
+    Loopback::RawConnection connection;
+    CHECK(connection.connect(SERVER_PORT));
+    int handled = g_handled;
+
+    connection.send("{\"method\": \"block\", \"params\": [], \"id\": 1}");
+    connection.send("{\"method\": \"quick\", \"params\": [], \"id\": 2}");
+    map<int, Object> replies = readReplies(connection, 2);
+    CHECK(isTimeout(replies[2]));
+    CHECK(g_handled == handled);
+
+    connection.send("{\"method\": \"quick\", \"params\": [], \"id\": 3}");
+    replies = readReplies(connection, 1);
+    CHECK(find_value(replies[3], "result") == Value(true));
+    CHECK(g_handled == handled + 1);
+}
+
+int main()
+{
+    Server server(SERVER_PORT);
+    server.setRequestCallback(&requestCallback);
+    server.setRequestTimeout("quick", 100);
+    server.start();
+
+    testClientTimeout();
+    testMethodTimeout();
+
+    server.stop();
+    return UNIT_TEST_RESULT("DeadlineTest");
+}
@@ -0,0 +1,66 @@
+#include <Server.h>
+
+#include "Loopback.h"
+#include "UnitTest.h"
+
+#include <future>
+
+using namespace WebSocket;
+using namespace json_spirit;
+using namespace std;
+
+const int SERVER_PORT = 12521;
+const int CALLS = 200;
+
+// Echoes "echo" calls and fails everything else
+void requestCallback(Server& server, const Server::client_request_t& req)
+{
+    JsonRpc::Response res;
+    if (req.second.getMethod() == "echo")   { res.setResult(req.second.getParams()[0], req.second.getId()); }
+    else                                    { res.setError(Value("no such method"), req.second.getId()); }
+    server.send(req.first, res);
+}
+
+void testCall(Client& client)
+{
+    CHECK(client.call("echo", Array(1, 7)).get() == Value(7));
+    CHECK_THROWS(client.call("missing").get(), RpcError);
+}
+
+// Hundreds of calls in flight at once each complete with their own result
+void testManyCalls(Client& client)
+{
+    vector<future<Value>> results;
+    for (int i = 0; i < CALLS; i++) { results.push_back(client.call("echo", Array(1, i))); }
+    for (int i = 0; i < CALLS; i++) { CHECK(results[i].get() == Value(i)); }
+}
+
+// callAll() keeps the requests' order, and fails if any call does
+void testCallAll(Client& client)
+{
+    vector<JsonRpc::Request> requests;
+    for (int i = 0; i < 5; i++) { requests.push_back(JsonRpc::Request("echo", Array(1, i))); }
+    Array results = client.callAll(requests).get();
+    CHECK(results.size() == 5);
+    for (size_t i = 0; i < results.size(); i++) { CHECK(results[i] == Value(int(i))); }
+
+    requests.push_back(JsonRpc::Request("missing"));
+    CHECK_THROWS(client.callAll(requests).get(), RpcError);
+}
+
+int main()
+{
+    Server server(SERVER_PORT);
+    server.setRequestCallback(&requestCallback);
+    server.start();
+
+    Loopback::TestClient testClient;
+    CHECK(testClient.connect(SERVER_PORT));
+    testCall(testClient.client);
+    testManyCalls(testClient.client);
+    testCallAll(testClient.client);
+    testClient.client.stop();
+
+    server.stop();
+    return UNIT_TEST_RESULT("FutureCallTest");
+}
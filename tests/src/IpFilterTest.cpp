@@ -0,0 +1,67 @@
+#include <IpFilter.h>
+
+#include "UnitTest.h"
+
+#include <stdexcept>
+
+using namespace WebSocket;
+using namespace std;
+
+bool allowed(const IpFilter& filter, const string& address)
+{
+    return filter.isAllowed(boost::asio::ip::address::from_string(address));
+}
+
+void testDefaultCidrs()
+{
+    IpFilter filter(DEFAULT_ALLOWED_CIDRS);
+    CHECK(allowed(filter, "127.0.0.1"));
+    CHECK(allowed(filter, "::1"));
+    CHECK(allowed(filter, "::ffff:127.0.0.1"));
+    CHECK(!allowed(filter, "127.0.0.2"));
+    CHECK(!allowed(filter, "10.0.0.1"));
+    CHECK(!allowed(filter, "::2"));
+}
+
+void testLongestPrefixWins()
+{
+    IpFilter filter("10.0.0.0/8, 10.1.2.3", "10.1.0.0/16");
+    CHECK(allowed(filter, "10.2.0.1"));
+    CHECK(!allowed(filter, "10.1.0.1"));
+    CHECK(allowed(filter, "10.1.2.3"));
+    CHECK(!allowed(filter, "11.0.0.1"));
+
+    // Deny wins when the prefixes are equally long
+    IpFilter tie("192.168.0.0/16", "192.168.0.0/16");
+    CHECK(!allowed(tie, "192.168.1.1"));
+}
+
+void testIpv6()
+{
+    IpFilter filter("2001:db8::/32 fe80::/10", "2001:db8:dead::/48");
+    CHECK(allowed(filter, "2001:db8::1"));
+    CHECK(!allowed(filter, "2001:db8:dead::1"));
+    CHECK(allowed(filter, "fe80::1234"));
+    CHECK(!allowed(filter, "2001:db9::1"));
+
+    IpFilter all("0.0.0.0/0, ::/0");
+    CHECK(allowed(all, "8.8.8.8"));
+    CHECK(allowed(all, "2607:f8b0::1"));
+}
+
+void testInvalidEntries()
+{
+    CHECK_THROWS(IpFilter("10.0.0.0/33"), invalid_argument);
+    CHECK_THROWS(IpFilter("::/129"), invalid_argument);
+    CHECK_THROWS(IpFilter("not-an-address"), invalid_argument);
+    CHECK_THROWS(IpFilter("127.0.0.1", "10.0.0.0/x"), invalid_argument);
+}
+
+int main()
+{
+    testDefaultCidrs();
+    testLongestPrefixWins();
+    testIpv6();
+    testInvalidEntries();
+    return UNIT_TEST_RESULT("IpFilterTest");
+}
@@ -0,0 +1,94 @@
+#include <JsonDelta.h>
+#include <JsonExceptions.h>
+
+#include "UnitTest.h"
+
+using namespace JsonRpc;
+using namespace json_spirit;
+using namespace std;
+
+Value parse(const string& json)
+{
+    Value value;
+    read_string(json, value);
+    return value;
+}
+
+// Patches from with diff(from, to) and checks the result is to
+bool roundTrips(const string& fromJson, const string& toJson)
+{
+    Value from = parse(fromJson);
+    Value to = parse(toJson);
+    Array patch = diff(from, to);
+    applyPatch(from, patch);
+    return write_string(from) == write_string(to);
+}
+
+void testIdenticalDocuments()
+{
+    Value doc = parse("{\"a\": [1, 2, {\"b\": null}], \"c\": \"d\"}");
+    CHECK(diff(doc, doc).empty());
+}
+
+void testObjects()
+{
+    CHECK(roundTrips("{\"a\": 1, \"b\": 2}", "{\"a\": 3, \"c\": 4}"));
+    CHECK(roundTrips("{\"a\": {\"b\": {\"c\": 1}}}", "{\"a\": {\"b\": {\"c\": 2, \"d\": [1]}}}"));
+    CHECK(roundTrips("{\"a\": 1}", "{}"));
+
+    // Names containing pointer syntax are escaped
+    CHECK(roundTrips("{\"a/b\": 1, \"c~d\": 2}", "{\"a/b\": 3, \"c~d\": 4, \"~/\": 5}"));
+
+    Array patch = diff(parse("{\"a\": 1}"), parse("{\"a\": 2}"));
+    CHECK(patch.size() == 1);
+    CHECK(write_string(patch[0]) == "{\"op\":\"replace\",\"path\":\"/a\",\"value\":2}");
+}
+
+void testArrays()
+{
+    CHECK(roundTrips("[1, 2, 3]", "[1, 5, 3, 4, 5]"));
+    CHECK(roundTrips("[1, 2, 3, 4]", "[1]"));
+    CHECK(roundTrips("[[1, 2], {\"a\": []}]", "[[1], {\"a\": [true]}]"));
+    CHECK(roundTrips("[]", "[{\"a\": 1}]"));
+}
+
+void testTypeChanges()
+{
+    CHECK(roundTrips("{\"a\": [1]}", "{\"a\": {\"b\": 1}}"));
+    CHECK(roundTrips("{\"a\": 1}", "{\"a\": \"1\"}"));
+    CHECK(roundTrips("[1]", "{\"a\": 1}"));
+}
+
+void testInvalidPatches()
+{
+    Value doc = parse("{\"a\": [1, 2]}");
+    CHECK_THROWS(applyPatch(doc, parse("[{\"op\": \"remove\", \"path\": \"/missing\"}]").get_array()), JsonInvalidPatchException);
+    CHECK_THROWS(applyPatch(doc, parse("[{\"op\": \"replace\", \"path\": \"/a/5\", \"value\": 1}]").get_array()), JsonInvalidPatchException);
+    CHECK_THROWS(applyPatch(doc, parse("[{\"op\": \"move\", \"path\": \"/a\"}]").get_array()), JsonInvalidPatchException);
+    CHECK_THROWS(applyPatch(doc, parse("[{\"op\": \"add\", \"path\": \"a\", \"value\": 1}]").get_array()), JsonInvalidPatchException);
+    CHECK_THROWS(applyPatch(doc, parse("[\"remove\"]").get_array()), JsonInvalidPatchException);
+}
+
+// A resolved snapshot or update has the shape of the full message a channel without delta encoding sends
+void testExpandDelta()
+{
+    Value doc = parse("{\"a\": [1, 2]}");
+    string full = write_string(parse("{\"event\": \"prices\", \"data\": {\"a\": [1, 2]}}"));
+
+    Object snapshot = parse("{\"event\": \"prices\", \"delta\": {\"channel\": \"c\", \"version\": 1, \"data\": {\"a\": [1, 2]}}}").get_obj();
+    CHECK(write_string<Value>(expandDelta(snapshot, doc)) == full);
+
+    Object update = parse("{\"event\": \"prices\", \"delta\": {\"channel\": \"c\", \"version\": 2, \"base\": 1, \"patch\": []}}").get_obj();
+    CHECK(write_string<Value>(expandDelta(update, doc)) == full);
+}
+
+int main()
+{
+    testIdenticalDocuments();
+    testObjects();
+    testArrays();
+    testTypeChanges();
+    testInvalidPatches();
+    testExpandDelta();
+    return UNIT_TEST_RESULT("JsonDeltaTest");
+}
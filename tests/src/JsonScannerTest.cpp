@@ -0,0 +1,88 @@
+#include <JsonScanner.h>
+#include <JsonExceptions.h>
+
+#include "UnitTest.h"
+
+using namespace JsonRpc;
+using namespace std;
+
+void testMembers()
+{
+    string json = " {\"method\": \"echo\", \"params\": [1, {\"a\": [true, null]}, \"x\"], \"id\": 7} ";
+    JsonScanner scanner(json);
+    JsonScanner::slice_t root = scanner.root();
+    CHECK(scanner.type(root) == '{');
+
+    JsonScanner::members_t members = scanner.members(root);
+    CHECK(members.size() == 3);
+    CHECK(members[0].first == "method" && scanner.text(members[0].second) == "\"echo\"");
+    CHECK(members[1].first == "params" && scanner.type(members[1].second) == '[');
+    CHECK(members[2].first == "id" && scanner.text(members[2].second) == "7");
+
+    vector<JsonScanner::slice_t> elements = scanner.elements(members[1].second);
+    CHECK(elements.size() == 3);
+    CHECK(scanner.text(elements[0]) == "1");
+    CHECK(scanner.text(elements[1]) == "{\"a\": [true, null]}");
+    CHECK(scanner.text(elements[2]) == "\"x\"");
+}
+
+void testEmptyContainers()
+{
+    string json = "{\"a\": [], \"b\": {}}";
+    JsonScanner scanner(json);
+    JsonScanner::members_t members = scanner.members(scanner.root());
+    CHECK(members.size() == 2);
+    CHECK(scanner.elements(members[0].second).empty());
+    CHECK(scanner.members(members[1].second).empty());
+}
+
+void testEscapes()
+{
+    // Member names are unescaped, including surrogate pairs; values are left as text
+    string json = "{\"a\\u0062\\n\": 1, \"\\ud83d\\ude00\": \"\\\"q\\\"\"}";
+    JsonScanner scanner(json);
+    JsonScanner::members_t members = scanner.members(scanner.root());
+    CHECK(members.size() == 2);
+    CHECK(members[0].first == "ab\n");
+    CHECK(members[1].first == "\xf0\x9f\x98\x80");
+    CHECK(scanner.text(members[1].second) == "\"\\\"q\\\"\"");
+}
+
+void testNumbersAndLiterals()
+{
+    string json = "[-0, 12.5e-3, 1E+2, true, false, null]";
+    JsonScanner scanner(json);
+    vector<JsonScanner::slice_t> elements = scanner.elements(scanner.root());
+    CHECK(elements.size() == 6);
+    CHECK(scanner.text(elements[1]) == "12.5e-3");
+    CHECK(scanner.type(elements[3]) == 't' && scanner.type(elements[5]) == 'n');
+}
+
+void testMalformed()
+{
+    const char* invalid[] = {
+        "", "{", "[1,]", "{\"a\" 1}", "{\"a\": 1,}", "[1 2]", "{\"a\": tru}", "[01]", "[1.]", "[-]",
+        "\"unterminated", "[\"\\x\"]", "[\"\\u12g4\"]", "{} {}", "[\"a\nb\"]"
+    };
+    for (auto text: invalid)
+    {
+        string json(text);
+        JsonScanner scanner(json);
+        CHECK_THROWS(scanner.elements(scanner.root()), JsonInvalidException);
+    }
+
+    // Nested values are checked even when they are skipped
+    string json = "{\"skipped\": [1, {\"deep\": [}], \"b\": 2}";
+    JsonScanner scanner(json);
+    CHECK_THROWS(scanner.root(), JsonInvalidException);
+}
+
+int main()
+{
+    testMembers();
+    testEmptyContainers();
+    testEscapes();
+    testNumbersAndLiterals();
+    testMalformed();
+    return UNIT_TEST_RESULT("JsonScannerTest");
+}
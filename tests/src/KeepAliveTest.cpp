@@ -0,0 +1,70 @@
+#include <Server.h>
+
+#include "Loopback.h"
+#include "UnitTest.h"
+
+#include <atomic>
+
+using namespace WebSocket;
+using namespace json_spirit;
+using namespace std;
+
+const int SERVER_PORT = 12431;
+
+atomic<int> g_requests(0);
+
+void requestCallback(Server& server, const Server::client_request_t& req)
+{
+    g_requests++;
+    JsonRpc::Response res;
+    res.setResult(true, req.second.getId());
+    server.send(req.first, res);
+}
+
+// A connection that never answers pings is closed, and what it sends afterwards gets no reply of any kind
+void testEvictedConnection()
+{
+    Loopback::RawConnection connection;
+    CHECK(connection.connect(SERVER_PORT));
+
+    connection.send("{\"method\": \"echo\", \"params\": [], \"id\": 1}");
+    string reply;
+    CHECK(connection.readMessage(reply));
+    CHECK(g_requests == 1);
+
+    Loopback::RawConnection::frame_t frame;
+    bool bClosed = false;
+    while (!bClosed && connection.readFrame(frame)) { bClosed = frame.opcode == Loopback::RawConnection::CLOSE; }
+    CHECK(bClosed);
+
+    // The close is left unanswered so the connection stays half open while these arrive
+    for (int i = 2; i < 5; i++) { connection.send("{\"method\": \"echo\", \"params\": [], \"id\": " + to_string(i) + "}"); }
+    CHECK(!connection.readMessage(reply, 500));
+    CHECK(g_requests == 1);
+}
+
+// A connection that answers pings stays open
+void testLiveConnection()
+{
+    Loopback::TestClient testClient;
+    CHECK(testClient.connect(SERVER_PORT));
+    this_thread::sleep_for(chrono::milliseconds(500));
+    CHECK(testClient.client.isConnected());
+    CHECK(testClient.client.call("echo").get() == Value(true));
+    testClient.client.stop();
+}
+
+int main()
+{
+    Server server(SERVER_PORT);
+    server.setRequestCallback(&requestCallback);
+    server.setRequestRateLimit(1000, 1000);
+    server.setKeepAlive(100, 100);
+    server.start();
+
+    testEvictedConnection();
+    testLiveConnection();
+
+    server.stop();
+    return UNIT_TEST_RESULT("KeepAliveTest");
+}
@@ -0,0 +1,95 @@
+#include <Log.h>
+
+#include "UnitTest.h"
+
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+using namespace WebSocket;
+using namespace std;
+
+mutex g_outputMutex;
+vector<string> g_output;
+string g_logger;
+
+void collect(const string& message)
+{
+    lock_guard<mutex> lock(g_outputMutex);
+    g_output.push_back(message);
+}
+
+// Stands in for the server's LOGGER
+void WebSocket::log::writeLogger(level_t level, const string& message)
+{
+    g_logger = string(log::levelName(level)) + ": " + message;
+}
+
+void testWithoutSink()
+{
+    int* pointer = NULL;
+    WS_LOG(trace) << "a " << 1 << ' ' << 2.5 << ' ' << (size_t)3 << ' ' << pointer << ' ' << string("b") << endl;
+    CHECK(g_logger == "trace: a 1 2.5 3 0 b");
+
+    log::setLevel(log::error);
+    g_logger.clear();
+    WS_LOG(trace) << "dropped";
+    CHECK(g_logger.empty());
+    WS_LOG(error) << "kept";
+    CHECK(g_logger == "error: kept");
+    log::setLevel(log::trace);
+}
+
+void testSink()
+{
+    g_output.clear();
+    g_logger.clear();
+    {
+        log::AsyncSink sink(collect);
+        log::setSink(&sink);
+        WS_LOG(trace) << "value " << 42;
+        WS_LOG(error) << "failed";
+        sink.push("plain");
+        sink.defer([]() { return string("deferred"); });
+    }
+    CHECK(log::installedSink().load() == NULL);
+    CHECK(g_logger.empty());
+    CHECK(g_output.size() == 4);
+    if (g_output.size() != 4) return;
+    CHECK(g_output[0] == "[trace] value 42");
+    CHECK(g_output[1] == "[error] failed");
+    CHECK(g_output[2] == "plain");
+    CHECK(g_output[3] == "deferred");
+}
+
+void testDropped()
+{
+    // The writer may run between pushes, so only the totals are certain
+    g_output.clear();
+    size_t dropped;
+    {
+        log::AsyncSink sink(collect, 2);
+        for (int i = 0; i < 100; i++) { sink.push("message"); }
+        sink.defer([]() -> string { throw runtime_error("bad"); });
+        dropped = sink.dropped();
+    }
+    CHECK(dropped > 0);
+
+    size_t written = 0;
+    size_t reported = 0;
+    for (auto& line: g_output)
+    {
+        if (line == "message" || line == "Log formatter failed: bad")  { written++; }
+        else                                                            { reported += strtoul(line.c_str(), NULL, 10); }
+    }
+    CHECK(written + dropped == 101);
+    CHECK(reported == dropped);
+}
+
+int main()
+{
+    testWithoutSink();
+    testSink();
+    testDropped();
+    return UNIT_TEST_RESULT("LogTest");
+}
@@ -0,0 +1,195 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Loopback.h
+//
+// Copyright (c) 2014 Eric Lombrozo
+//
+// All Rights Reserved.
+
+#pragma once
+
+#include <Client.h>
+#include <IoServicePool.h>
+
+#include <boost/asio.hpp>
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+
+// Helpers for tests that run a Server and clients against it on localhost. Each test program uses its own
+// ports so the programs can run side by side.
+namespace Loopback
+{
+
+inline std::string url(int port) { return "ws://localhost:" + std::to_string(port); }
+
+// Polls cond until it holds or timeout ms pass
+inline bool waitFor(std::function<bool()> cond, unsigned int timeout = 5000)
+{
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+    while (!cond())
+    {
+        if (std::chrono::steady_clock::now() > deadline) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return true;
+}
+
+// A client on its own io thread. The thread outlives the client, which needs it to close.
+struct TestClient
+{
+    TestClient(const std::string& event_field = "event", const std::string& data_field = "data")
+        : ioServicePool(1), client(ioServicePool.next(), event_field, data_field) { }
+
+    bool connect(int port)
+    {
+        client.connect(url(port));
+        return waitFor([this]() { return client.isConnected(); });
+    }
+
+    WebSocket::IoServicePool ioServicePool;
+    WebSocket::Client client;
+};
+
+// A websocket connection driven by hand on the calling thread. It sends exactly the frames it is given,
+// shows frames as they arrive and never answers pings.
+class RawConnection
+{
+public:
+    enum { CONTINUATION = 0x0, TEXT = 0x1, CLOSE = 0x8, PING = 0x9, PONG = 0xa };
+
+    struct frame_t
+    {
+        unsigned int opcode;
+        bool bFin;
+        std::string payload;
+    };
+
+    RawConnection() : m_socket(m_ioService), m_timer(m_ioService) { }
+
+    bool connect(int port, unsigned int timeout = 5000)
+    {
+        boost::system::error_code ec;
+        boost::asio::ip::tcp::resolver resolver(m_ioService);
+        boost::asio::connect(m_socket, resolver.resolve(boost::asio::ip::tcp::resolver::query("localhost", std::to_string(port))), ec);
+        if (ec) return false;
+
+        std::string request =
+            "GET / HTTP/1.1\r\n"
+            "Host: localhost:" + std::to_string(port) + "\r\n"
+            "Upgrade: websocket\r\n"
+            "Connection: Upgrade\r\n"
+            "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+            "Sec-WebSocket-Version: 13\r\n\r\n";
+        boost::asio::write(m_socket, boost::asio::buffer(request), ec);
+        if (ec) return false;
+
+        std::size_t end;
+        while ((end = buffered().find("\r\n\r\n")) == std::string::npos)
+        {
+            if (!fill(m_input.size() + 1, timeout)) return false;
+        }
+        return take(end + 4).compare(0, 12, "HTTP/1.1 101") == 0;
+    }
+
+    // Sends one masked frame
+    bool send(const std::string& payload, unsigned int opcode = TEXT, bool bFin = true)
+    {
+        std::string frame(1, char((bFin ? 0x80 : 0) | opcode));
+        uint64_t size = payload.size();
+        if (size < 126)
+        {
+            frame += char(0x80 | size);
+        }
+        else
+        {
+            int bytes = (size < 65536) ? 2 : 8;
+            frame += char(0x80 | ((bytes == 2) ? 126 : 127));
+            for (int i = bytes - 1; i >= 0; i--) { frame += char((size >> (8 * i)) & 0xff); }
+        }
+
+        const char mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+        frame.append(mask, 4);
+        for (std::size_t i = 0; i < payload.size(); i++) { frame += char(payload[i] ^ mask[i % 4]); }
+
+        boost::system::error_code ec;
+        boost::asio::write(m_socket, boost::asio::buffer(frame), ec);
+        return !ec;
+    }
+
+    // False once the connection is gone or nothing arrives within timeout ms
+    bool readFrame(frame_t& frame, unsigned int timeout = 5000)
+    {
+        if (!fill(2, timeout)) return false;
+        std::size_t headerSize = 2;
+        uint64_t size = buffered()[1] & 0x7f;
+        if (size == 126)        { headerSize = 4; }
+        else if (size == 127)   { headerSize = 10; }
+        if (!fill(headerSize, timeout)) return false;
+
+        std::string header = take(headerSize);
+        if (headerSize > 2)
+        {
+            size = 0;
+            for (std::size_t i = 2; i < headerSize; i++) { size = (size << 8) | (unsigned char)header[i]; }
+        }
+        if (!fill(size, timeout)) return false;
+
+        frame.opcode = header[0] & 0x0f;
+        frame.bFin = (header[0] & 0x80) != 0;
+        frame.payload = take(size);
+        return true;
+    }
+
+    // Reads up to the end of the next data message, skipping pings and pongs. False on close or timeout.
+    bool readMessage(std::string& message, unsigned int timeout = 5000)
+    {
+        message.clear();
+        frame_t frame;
+        while (readFrame(frame, timeout))
+        {
+            if (frame.opcode == CLOSE) return false;
+            if (frame.opcode == PING || frame.opcode == PONG) continue;
+            message += frame.payload;
+            if (frame.bFin) return true;
+        }
+        return false;
+    }
+
+private:
+    std::string buffered() const
+    {
+        return std::string(boost::asio::buffers_begin(m_input.data()), boost::asio::buffers_end(m_input.data()));
+    }
+
+    std::string take(std::size_t size)
+    {
+        std::string data = buffered().substr(0, size);
+        m_input.consume(size);
+        return data;
+    }
+
+    // Reads until size bytes are buffered or timeout ms pass
+    bool fill(std::size_t size, unsigned int timeout)
+    {
+        if (m_input.size() >= size) return true;
+
+        boost::system::error_code result = boost::asio::error::would_block;
+        boost::asio::async_read(m_socket, m_input, boost::asio::transfer_at_least(size - m_input.size()),
+            [&](const boost::system::error_code& ec, std::size_t) { result = ec; m_timer.cancel(); });
+        m_timer.expires_from_now(boost::posix_time::milliseconds(timeout));
+        m_timer.async_wait([&](const boost::system::error_code& ec) { if (!ec) m_socket.cancel(); });
+        m_ioService.reset();
+        m_ioService.run();
+        return !result;
+    }
+
+    boost::asio::io_service m_ioService;
+    boost::asio::ip::tcp::socket m_socket;
+    boost::asio::deadline_timer m_timer;
+    boost::asio::streambuf m_input;
+};
+
+}
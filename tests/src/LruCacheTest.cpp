@@ -0,0 +1,93 @@
+#include <LruCache.h>
+
+#include "UnitTest.h"
+
+#include <thread>
+
+using namespace WebSocket;
+using namespace std;
+
+void testPutGet()
+{
+    LruCache<string> cache(100);
+    string value;
+    CHECK(!cache.get("a", value));
+
+    cache.put("a", "1", 10, 60000);
+    CHECK(cache.get("a", value) && value == "1");
+
+    cache.put("a", "2", 10, 60000);
+    CHECK(cache.get("a", value) && value == "2");
+    CHECK(cache.size() == 1);
+
+    cache.erase("a");
+    CHECK(!cache.get("a", value));
+}
+
+void testEvictsLeastRecentlyUsed()
+{
+    LruCache<int> cache(30);
+    cache.put("a", 1, 10, 60000);
+    cache.put("b", 2, 10, 60000);
+    cache.put("c", 3, 10, 60000);
+
+    int value;
+    CHECK(cache.get("a", value));     // b is now the least recently used
+    cache.put("d", 4, 10, 60000);
+    CHECK(!cache.get("b", value));
+    CHECK(cache.get("a", value) && cache.get("c", value) && cache.get("d", value));
+
+    // An entry over the whole budget is never stored
+    cache.put("huge", 5, 31, 60000);
+    CHECK(!cache.get("huge", value));
+    CHECK(cache.size() == 3);
+
+    cache.setBudget(10);
+    CHECK(cache.size() == 1);
+    CHECK(cache.get("d", value) && value == 4);
+}
+
+void testExpiry()
+{
+    LruCache<int> cache(100);
+    cache.put("short", 1, 1, 1);
+    cache.put("long", 2, 1, 60000);
+    this_thread::sleep_for(chrono::milliseconds(5));
+
+    int value;
+    CHECK(!cache.get("short", value));
+    CHECK(cache.get("long", value));
+    CHECK(cache.size() == 1);
+}
+
+void testTags()
+{
+    LruCache<int> cache(100);
+    cache.put("a1", 1, 1, 60000, "a");
+    cache.put("a2", 2, 1, 60000, "a");
+    cache.put("b1", 3, 1, 60000, "b");
+    cache.put("none", 4, 1, 60000);
+
+    cache.eraseTag("a");
+    int value;
+    CHECK(!cache.get("a1", value) && !cache.get("a2", value));
+    CHECK(cache.get("b1", value) && cache.get("none", value));
+
+    // Replacing an entry moves it to its new tag
+    cache.put("b1", 5, 1, 60000, "c");
+    cache.eraseTag("b");
+    CHECK(cache.get("b1", value) && value == 5);
+
+    cache.clear();
+    CHECK(cache.size() == 0);
+    CHECK(!cache.get("none", value));
+}
+
+int main()
+{
+    testPutGet();
+    testEvictsLeastRecentlyUsed();
+    testExpiry();
+    testTags();
+    return UNIT_TEST_RESULT("LruCacheTest");
+}
@@ -0,0 +1,75 @@
+#include <MpscQueue.h>
+
+#include "UnitTest.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace WebSocket;
+using namespace std;
+
+void testFifo()
+{
+    MpscQueue<string> queue;
+    string value;
+    CHECK(!queue.pop(value));
+
+    queue.push("a");
+    queue.push("b");
+    CHECK(queue.pop(value) && value == "a");
+    queue.push("c");
+    CHECK(queue.pop(value) && value == "b");
+    CHECK(queue.pop(value) && value == "c");
+    CHECK(!queue.pop(value));
+}
+
+void testProducersKeepTheirOrder()
+{
+    MpscQueue<uint64_t> queue;
+    const uint64_t PRODUCERS = 4;
+    const uint64_t PER_PRODUCER = 100000;
+
+    vector<thread> producers;
+    for (uint64_t p = 0; p < PRODUCERS; p++)
+    {
+        producers.push_back(thread([&queue, p, PER_PRODUCER]() {
+            for (uint64_t i = 0; i < PER_PRODUCER; i++) { queue.push(p * PER_PRODUCER + i); }
+        }));
+    }
+
+    // Values carry their producer and sequence, so each producer's values must arrive in order
+    vector<uint64_t> next(PRODUCERS, 0);
+    uint64_t received = 0;
+    bool bOrdered = true;
+    while (received < PRODUCERS * PER_PRODUCER)
+    {
+        uint64_t value;
+        if (!queue.pop(value)) { this_thread::yield(); continue; }
+        uint64_t producer = value / PER_PRODUCER;
+        if (value % PER_PRODUCER != next[producer]) { bOrdered = false; }
+        next[producer]++;
+        received++;
+    }
+    for (auto& t: producers) { t.join(); }
+
+    CHECK(bOrdered);
+    uint64_t value;
+    CHECK(!queue.pop(value));
+}
+
+void testDestroyWithQueuedValues()
+{
+    MpscQueue<vector<int>>* queue = new MpscQueue<vector<int>>();
+    queue->push(vector<int>(100));
+    queue->push(vector<int>(100));
+    delete queue;
+}
+
+int main()
+{
+    testFifo();
+    testProducersKeepTheirOrder();
+    testDestroyWithQueuedValues();
+    return UNIT_TEST_RESULT("MpscQueueTest");
+}
@@ -0,0 +1,91 @@
+#include <PendingCallTable.h>
+
+#include "UnitTest.h"
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace WebSocket;
+using namespace std;
+
+void testInsertTake()
+{
+    PendingCallTable<string> table(4);
+    table.insert(1, "one");
+    table.insert(2, "two");
+    CHECK(table.size() == 2);
+
+    string value;
+    CHECK(table.take(1, value) && value == "one");
+    CHECK(!table.take(1, value));
+    CHECK(table.take(2, value) && value == "two");
+    CHECK(table.size() == 0);
+
+    // Inserting under a pending id replaces the call
+    table.insert(3, "three");
+    table.insert(3, "tres");
+    CHECK(table.size() == 1);
+    CHECK(table.take(3, value) && value == "tres");
+}
+
+void testGrowAndProbeRuns()
+{
+    // Ids 16 apart share a shard and collide once the shard wraps, so this exercises probing, growth and
+    // the backward shift on removal
+    PendingCallTable<uint64_t> table(2);
+    const uint64_t COUNT = 1000;
+    for (uint64_t i = 0; i < COUNT; i++) { table.insert(i * 16, i); }
+    CHECK(table.size() == COUNT);
+
+    uint64_t value;
+    for (uint64_t i = 0; i < COUNT; i += 2) { CHECK(table.take(i * 16, value) && value == i); }
+    for (uint64_t i = 1; i < COUNT; i += 2) { CHECK(table.take(i * 16, value) && value == i); }
+    CHECK(table.size() == 0);
+}
+
+void testTakeAll()
+{
+    PendingCallTable<int> table;
+    for (int i = 0; i < 100; i++) { table.insert(i, i); }
+
+    vector<pair<uint64_t, int>> calls = table.takeAll();
+    CHECK(calls.size() == 100);
+    sort(calls.begin(), calls.end());
+    for (int i = 0; i < 100; i++) { CHECK(calls[i].first == (uint64_t)i && calls[i].second == i); }
+    CHECK(table.size() == 0);
+
+    int value;
+    CHECK(!table.take(5, value));
+}
+
+void testConcurrentCallers()
+{
+    PendingCallTable<uint64_t> table;
+    const uint64_t PER_THREAD = 10000;
+    vector<thread> threads;
+    for (uint64_t t = 0; t < 4; t++)
+    {
+        threads.push_back(thread([&table, t, PER_THREAD]() {
+            for (uint64_t i = 0; i < PER_THREAD; i++)
+            {
+                uint64_t id = t * PER_THREAD + i;
+                table.insert(id, id);
+                uint64_t value;
+                if (i % 2 && (!table.take(id, value) || value != id)) { table.insert(~0ULL, 0); }
+            }
+        }));
+    }
+    for (auto& t: threads) { t.join(); }
+    CHECK(table.size() == 4 * PER_THREAD / 2);
+}
+
+int main()
+{
+    testInsertTake();
+    testGrowAndProbeRuns();
+    testTakeAll();
+    testConcurrentCallers();
+    return UNIT_TEST_RESULT("PendingCallTableTest");
+}
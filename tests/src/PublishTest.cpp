@@ -0,0 +1,91 @@
+#include <Server.h>
+
+#include "Loopback.h"
+#include "UnitTest.h"
+
+#include <atomic>
+#include <memory>
+
+using namespace WebSocket;
+using namespace json_spirit;
+using namespace std;
+
+const int SERVER_PORT = 12471;
+const int CONNECTIONS = 5;
+
+const string NEWS = "{\"event\": \"news\", \"data\": 1}";
+const string ALERT = "{\"event\": \"alert\", \"data\": 2}";
+
+atomic<int> g_opens(0);
+
+// "join" adds the caller to the channel named by its first param
+void requestCallback(Server& server, const Server::client_request_t& req)
+{
+    if (req.second.getMethod() == "join") { server.addToChannel(req.second.getParams()[0].get_str(), req.first); }
+    JsonRpc::Response res;
+    res.setResult(true, req.second.getId());
+    server.send(req.first, res);
+}
+
+typedef vector<unique_ptr<Loopback::RawConnection>> connections_t;
+
+bool connectAll(connections_t& connections)
+{
+    int opens = g_opens;
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        connections.emplace_back(new Loopback::RawConnection());
+        if (!connections.back()->connect(SERVER_PORT)) return false;
+    }
+    return Loopback::waitFor([&]() { return g_opens == opens + CONNECTIONS; });
+}
+
+// Every connection gets the message, with the fan-out split over the io threads
+void testPublishAll(Server& server)
+{
+    connections_t connections;
+    CHECK(connectAll(connections));
+
+    server.publishAll(ALERT);
+    for (auto& connection: connections)
+    {
+        string message;
+        CHECK(connection->readMessage(message) && message == ALERT);
+    }
+}
+
+// Only the channel's members get the message
+void testPublishChannel(Server& server)
+{
+    connections_t connections;
+    CHECK(connectAll(connections));
+
+    string message;
+    for (int i = 0; i < CONNECTIONS; i += 2)
+    {
+        connections[i]->send("{\"method\": \"join\", \"params\": [\"news\"], \"id\": 1}");
+        CHECK(connections[i]->readMessage(message));
+    }
+
+    server.publishChannel("news", NEWS);
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        if (i % 2 == 0)     { CHECK(connections[i]->readMessage(message) && message == NEWS); }
+        else                { CHECK(!connections[i]->readMessage(message, 200)); }
+    }
+}
+
+int main()
+{
+    Server server(SERVER_PORT);
+    server.setIoThreadCount(2);
+    server.setOpenCallback([](Server&, websocketpp::connection_hdl) { g_opens++; });
+    server.setRequestCallback(&requestCallback);
+    server.start();
+
+    testPublishAll(server);
+    testPublishChannel(server);
+
+    server.stop();
+    return UNIT_TEST_RESULT("PublishTest");
+}
@@ -0,0 +1,52 @@
+#include <RateLimiter.h>
+
+#include "UnitTest.h"
+
+#include <thread>
+
+using namespace WebSocket;
+using namespace std;
+
+boost::asio::ip::address address(const string& text) { return boost::asio::ip::address::from_string(text); }
+
+void testBurstThenRefill()
+{
+    RateLimiter limiter(100.0, 5.0);
+    for (int i = 0; i < 5; i++) { CHECK(limiter.allow(address("10.0.0.1"))); }
+    CHECK(!limiter.allow(address("10.0.0.1")));
+
+    // 100 tokens per second: a token is back after 10 ms
+    this_thread::sleep_for(chrono::milliseconds(30));
+    CHECK(limiter.allow(address("10.0.0.1")));
+}
+
+void testBucketsPerAddress()
+{
+    RateLimiter limiter(1.0, 2.0);
+    CHECK(limiter.allow(address("10.0.0.1")));
+    CHECK(limiter.allow(address("10.0.0.1")));
+    CHECK(!limiter.allow(address("10.0.0.1")));
+    CHECK(limiter.allow(address("10.0.0.2")));
+    CHECK(limiter.allow(address("2001:db8::1")));
+    CHECK(limiter.size() == 3);
+
+    // IPv4 and IPv4-mapped IPv6 share a bucket
+    CHECK(!limiter.allow(address("::ffff:10.0.0.1")));
+    CHECK(limiter.size() == 3);
+}
+
+void testCost()
+{
+    RateLimiter limiter(1.0, 10.0);
+    CHECK(limiter.allow(address("10.0.0.1"), 8.0));
+    CHECK(!limiter.allow(address("10.0.0.1"), 3.0));
+    CHECK(limiter.allow(address("10.0.0.1"), 2.0));
+}
+
+int main()
+{
+    testBurstThenRefill();
+    testBucketsPerAddress();
+    testCost();
+    return UNIT_TEST_RESULT("RateLimiterTest");
+}
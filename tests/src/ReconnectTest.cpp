@@ -0,0 +1,98 @@
+#include <Server.h>
+
+#include "Loopback.h"
+#include "UnitTest.h"
+
+#include <atomic>
+#include <future>
+#include <mutex>
+
+using namespace WebSocket;
+using namespace json_spirit;
+using namespace std;
+
+const int SERVER_PORT = 12531;
+
+atomic<int> g_opens(0);
+atomic<int> g_subscribes(0);
+atomic<int> g_slowCalls(0);
+
+// "slow" and "other" calls are held until the test answers them
+mutex g_heldMutex;
+vector<pair<websocketpp::connection_hdl, Value>> g_held;
+
+void requestCallback(Server& server, const Server::client_request_t& req)
+{
+    const string& method = req.second.getMethod();
+    if (method == "slow") { g_slowCalls++; }
+    if (method == "slow" || method == "other")
+    {
+        lock_guard<mutex> lock(g_heldMutex);
+        g_held.push_back(make_pair(req.first, req.second.getId()));
+        return;
+    }
+
+    if (method == "subscribe") { g_subscribes++; }
+    JsonRpc::Response res;
+    res.setResult(true, req.second.getId());
+    server.send(req.first, res);
+}
+
+// Answers go only to connections that are still open
+void answerHeld(Server& server)
+{
+    lock_guard<mutex> lock(g_heldMutex);
+    for (auto& call: g_held)
+    {
+        JsonRpc::Response res;
+        res.setResult(true, call.second);
+        server.send(call.first, res);
+    }
+    g_held.clear();
+}
+
+size_t heldCount()
+{
+    lock_guard<mutex> lock(g_heldMutex);
+    return g_held.size();
+}
+
+// After the server drops the connection the client reconnects, subscribes again and sends its idempotent
+// in-flight call again. The other in-flight call fails.
+void testReconnect(Server& server)
+{
+    Loopback::TestClient testClient;
+    testClient.client.setAutoReconnect(true, 50, 100);
+    testClient.client.addSubscription("subscribe");
+    testClient.client.setIdempotentMethod("slow");
+    CHECK(testClient.connect(SERVER_PORT));
+    CHECK(Loopback::waitFor([]() { return g_subscribes == 1; }));
+
+    future<Value> slow = testClient.client.call("slow");
+    future<Value> other = testClient.client.call("other");
+    CHECK(Loopback::waitFor([]() { return heldCount() == 2; }));
+
+    // A message over the server's size limit gets the connection closed
+    testClient.client.send(JsonRpc::Request("echo", Array(1, string(2048, 'x'))));
+    CHECK_THROWS(other.get(), RpcError);
+    CHECK(Loopback::waitFor([]() { return g_opens == 2 && g_subscribes == 2 && g_slowCalls == 2; }));
+    CHECK(slow.wait_for(chrono::milliseconds(0)) == future_status::timeout);
+
+    answerHeld(server);
+    CHECK(slow.get() == Value(true));
+    testClient.client.stop();
+}
+
+int main()
+{
+    Server server(SERVER_PORT);
+    server.setMaxMessageSize(1024);
+    server.setOpenCallback([](Server&, websocketpp::connection_hdl) { g_opens++; });
+    server.setRequestCallback(&requestCallback);
+    server.start();
+
+    testReconnect(server);
+
+    server.stop();
+    return UNIT_TEST_RESULT("ReconnectTest");
+}
@@ -0,0 +1,78 @@
+#include <RequestScheduler.h>
+
+#include "UnitTest.h"
+
+#include <vector>
+
+using namespace WebSocket;
+using namespace std;
+
+typedef RequestScheduler<int, int> scheduler_t;
+
+vector<int> drain(scheduler_t& scheduler)
+{
+    vector<int> items;
+    while (!scheduler.empty()) { items.push_back(scheduler.pop()); }
+    return items;
+}
+
+void testSourceOrder()
+{
+    scheduler_t scheduler;
+    scheduler.push("a", 1, 1);
+    scheduler.push("b", 1, 2);
+    scheduler.push("c", 1, 3);
+    CHECK(scheduler.size() == 3);
+    CHECK(drain(scheduler) == vector<int>({ 1, 2, 3 }));
+}
+
+// One source's burst only delays its own requests
+void testSourcesTakeTurns()
+{
+    scheduler_t scheduler;
+    scheduler.push("heavy", 1, 1);
+    scheduler.push("heavy", 1, 2);
+    scheduler.push("heavy", 1, 3);
+    scheduler.push("heavy", 2, 10);
+    scheduler.push("heavy", 3, 20);
+    CHECK(drain(scheduler) == vector<int>({ 1, 10, 20, 2, 3 }));
+}
+
+// A class with weight 3 is served three times for each turn of a class with weight 1
+void testWeightedClasses()
+{
+    scheduler_t scheduler;
+    scheduler.setClassWeight("fast", 3);
+    scheduler.setMethodClass("ping", "fast");
+    for (int i = 0; i < 6; i++)
+    {
+        scheduler.push("heavy", 1, 100 + i);
+        scheduler.push("ping", 1, i);
+    }
+    CHECK(drain(scheduler) == vector<int>({ 100, 0, 1, 2, 101, 3, 4, 5, 102, 103, 104, 105 }));
+}
+
+// However heavily another class is weighted, a class with work is served once per round
+void testNoStarvation()
+{
+    scheduler_t scheduler;
+    scheduler.setClassWeight("fast", 100);
+    scheduler.setMethodClass("ping", "fast");
+    for (int i = 0; i < 300; i++) { scheduler.push("ping", 1, i); }
+    CHECK(scheduler.pop() == 0);
+
+    // Arrives during the fast class's turn, and waits for that turn only
+    scheduler.push("heavy", 2, -1);
+    vector<int> items = drain(scheduler);
+    CHECK(items.size() == 300);
+    CHECK(items[99] == -1);
+}
+
+int main()
+{
+    testSourceOrder();
+    testSourcesTakeTurns();
+    testWeightedClasses();
+    testNoStarvation();
+    return UNIT_TEST_RESULT("RequestSchedulerTest");
+}
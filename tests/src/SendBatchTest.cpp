@@ -0,0 +1,75 @@
+#include <Server.h>
+
+#include "Loopback.h"
+#include "UnitTest.h"
+
+using namespace WebSocket;
+using namespace json_spirit;
+using namespace std;
+
+const int SERVER_PORT = 12461;
+const int BATCH_WINDOW = 50;
+
+// Answers every call three times, so the batch window has several frames to flush together
+void requestCallback(Server& server, const Server::client_request_t& req)
+{
+    for (int i = 1; i <= 3; i++)
+    {
+        JsonRpc::Response res;
+        res.setResult(i, req.second.getId());
+        server.send(req.first, res);
+    }
+}
+
+// A batch is written from one buffer holding each frame as it would have been written alone
+void testJoinedFrames(Server& server)
+{
+    typedef ws_server_t::connection_type::con_msg_manager_type manager_t;
+    std::shared_ptr<manager_t> manager(new manager_t());
+
+    vector<Server::payload_ptr> frames;
+    string expected;
+    for (const string& data: vector<string>{ "one", "two", string(300, 'x') })
+    {
+        frames.push_back(server.preparePayload(data));
+        expected += frames.back()->get_header() + frames.back()->get_payload();
+    }
+
+    Server::payload_ptr joined = pool::join_prepared(frames, manager);
+    CHECK(joined->get_prepared());
+    CHECK(joined->get_header().empty());
+    CHECK(joined->get_payload() == expected);
+}
+
+// The joined frames still arrive as separate messages, in order, once the window has passed
+void testBatchedDelivery()
+{
+    Loopback::RawConnection connection;
+    CHECK(connection.connect(SERVER_PORT));
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    connection.send("{\"method\": \"burst\", \"params\": [], \"id\": 1}");
+    for (int i = 1; i <= 3; i++)
+    {
+        string message;
+        Value reply;
+        CHECK(connection.readMessage(message) && read_string(message, reply) && reply.type() == obj_type);
+        if (reply.type() != obj_type) return;
+        CHECK(find_value(reply.get_obj(), "result") == Value(i));
+    }
+    CHECK(chrono::steady_clock::now() - start >= chrono::milliseconds(BATCH_WINDOW));
+}
+
+int main()
+{
+    Server server(SERVER_PORT);
+    server.setRequestCallback(&requestCallback);
+    server.setSendBatchWindow(BATCH_WINDOW);
+    server.start();
+
+    testJoinedFrames(server);
+    testBatchedDelivery();
+
+    server.stop();
+    return UNIT_TEST_RESULT("SendBatchTest");
+}
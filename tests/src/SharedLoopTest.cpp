@@ -0,0 +1,59 @@
+#include <Server.h>
+
+#include "Loopback.h"
+#include "UnitTest.h"
+
+#include <atomic>
+#include <future>
+#include <memory>
+
+using namespace WebSocket;
+using namespace json_spirit;
+using namespace std;
+
+const int SERVER_PORT = 12511;
+const int CLIENTS = 20;
+
+void requestCallback(Server& server, const Server::client_request_t& req)
+{
+    JsonRpc::Response res;
+    res.setResult(req.second.getParams()[0], req.second.getId());
+    server.send(req.first, res);
+}
+
+// Many clients run on one io thread. connect() returns at once and on_open reports each connection.
+void testClientsShareOneThread()
+{
+    IoServicePool ioServicePool(1);
+    atomic<int> opens(0);
+    vector<unique_ptr<Client>> clients;
+    for (int i = 0; i < CLIENTS; i++)
+    {
+        clients.emplace_back(new Client(ioServicePool.next(), "event"));
+        clients.back()->connect(Loopback::url(SERVER_PORT), [&]() { opens++; });
+    }
+    CHECK(Loopback::waitFor([&]() { return opens == CLIENTS; }));
+
+    vector<future<Value>> results;
+    for (int i = 0; i < CLIENTS; i++) { results.push_back(clients[i]->call("echo", Array(1, i))); }
+    for (int i = 0; i < CLIENTS; i++) { CHECK(results[i].get() == Value(i)); }
+
+    // Clients can come and go while the others keep running on the thread
+    clients.resize(CLIENTS / 2);
+    for (int i = 0; i < CLIENTS / 2; i++) { CHECK(clients[i]->call("echo", Array(1, i)).get() == Value(i)); }
+
+    for (auto& client: clients) { client->stop(); }
+    clients.clear();
+}
+
+int main()
+{
+    Server server(SERVER_PORT);
+    server.setRequestCallback(&requestCallback);
+    server.start();
+
+    testClientsShareOneThread();
+
+    server.stop();
+    return UNIT_TEST_RESULT("SharedLoopTest");
+}
@@ -0,0 +1,80 @@
+#include <Server.h>
+
+#include "Loopback.h"
+#include "UnitTest.h"
+
+#include <memory>
+#include <mutex>
+
+using namespace WebSocket;
+using namespace json_spirit;
+using namespace std;
+
+const int SERVER_PORT = 12501;
+const int CONNECTIONS = 3;
+
+const string DATA = "{\"event\": \"book\", \"data\": \"" + string(1000, 'x') + "\"}";
+
+mutex g_hdlMutex;
+vector<websocketpp::connection_hdl> g_hdls;
+
+void openCallback(Server&, websocketpp::connection_hdl hdl)
+{
+    lock_guard<mutex> lock(g_hdlMutex);
+    g_hdls.push_back(hdl);
+}
+
+// The payload is framed once, up front
+void testPreparedPayload(Server& server)
+{
+    Server::payload_ptr payload = server.preparePayload(DATA);
+    CHECK(payload->get_prepared());
+    CHECK(!payload->get_header().empty());
+    CHECK(payload->get_payload() == DATA);
+}
+
+// One payload goes out unchanged through every kind of send, any number of times
+void testSharedSends(Server& server)
+{
+    vector<unique_ptr<Loopback::RawConnection>> connections;
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        connections.emplace_back(new Loopback::RawConnection());
+        CHECK(connections.back()->connect(SERVER_PORT));
+    }
+    CHECK(Loopback::waitFor([]() { lock_guard<mutex> lock(g_hdlMutex); return g_hdls.size() == size_t(CONNECTIONS); }));
+
+    Server::payload_ptr payload = server.preparePayload(DATA);
+    const char* bytes = payload->get_payload().data();
+    {
+        lock_guard<mutex> lock(g_hdlMutex);
+        server.send(g_hdls[0], payload);
+        server.addToChannel("book", g_hdls[1]);
+    }
+    server.sendChannel("book", payload);
+    server.sendAll(payload);
+    server.publishAll(payload);
+
+    // First connection: send, sendAll, publishAll. Second: sendChannel, sendAll, publishAll. Third: the broadcasts.
+    int expected[CONNECTIONS] = { 3, 3, 2 };
+    for (int i = 0; i < CONNECTIONS; i++)
+    {
+        string message;
+        for (int j = 0; j < expected[i]; j++) { CHECK(connections[i]->readMessage(message) && message == DATA); }
+        CHECK(!connections[i]->readMessage(message, 100));
+    }
+    CHECK(payload->get_payload().data() == bytes);
+}
+
+int main()
+{
+    Server server(SERVER_PORT);
+    server.setOpenCallback(&openCallback);
+    server.start();
+
+    testPreparedPayload(server);
+    testSharedSends(server);
+
+    server.stop();
+    return UNIT_TEST_RESULT("SharedPayloadTest");
+}
@@ -0,0 +1,142 @@
+#include <Server.h>
+
+#include "Loopback.h"
+#include "UnitTest.h"
+
+#include <mutex>
+#include <thread>
+
+using namespace WebSocket;
+using namespace json_spirit;
+using namespace std;
+
+const int SERVER_PORT = 12451;
+const size_t FRAME_SIZE = 1024;
+const size_t QUEUE_LIMIT = 64 * 1024;
+const int COUNT = 1000;
+const size_t MAX_BYTES = 256 * 1024 * 1024;
+
+// "count" streams the numbers below COUNT. "hold" hands its stream to the test.
+mutex g_streamMutex;
+Server::response_stream_ptr g_stream;
+
+void requestCallback(Server& server, const Server::client_request_t& req)
+{
+    Server::response_stream_ptr stream = server.beginResponseStream(req.first, req.second.getId());
+    if (!stream) return;
+    if (req.second.getMethod() == "hold")
+    {
+        lock_guard<mutex> lock(g_streamMutex);
+        g_stream = stream;
+        return;
+    }
+
+    stream->write("[");
+    for (int i = 0; i < COUNT; i++) { stream->write((i ? "," : "") + to_string(i)); }
+    stream->write("]");
+    stream->finish();
+}
+
+// The response goes out as one fragmented message: a text frame, then continuation frames, the last final
+void testContinuationFrames()
+{
+    Loopback::RawConnection connection;
+    CHECK(connection.connect(SERVER_PORT));
+    connection.send("{\"method\": \"count\", \"params\": [], \"id\": 1}");
+
+    vector<Loopback::RawConnection::frame_t> frames;
+    Loopback::RawConnection::frame_t frame;
+    while (connection.readFrame(frame))
+    {
+        frames.push_back(frame);
+        if (frame.bFin) break;
+    }
+    CHECK(frames.size() > 2);
+    if (frames.empty()) return;
+
+    string message;
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        CHECK(frames[i].opcode == (i == 0 ? Loopback::RawConnection::TEXT : Loopback::RawConnection::CONTINUATION));
+        CHECK(frames[i].bFin == (i + 1 == frames.size()));
+        message += frames[i].payload;
+    }
+
+    Value reply;
+    CHECK(read_string(message, reply) && reply.type() == obj_type);
+    if (reply.type() != obj_type) return;
+    CHECK(find_value(reply.get_obj(), "id") == Value(1));
+    const Value& result = find_value(reply.get_obj(), "result");
+    CHECK(result.type() == array_type && result.get_array().size() == size_t(COUNT));
+}
+
+// The client puts the frames back together into an ordinary result
+void testClientReassembly()
+{
+    Loopback::TestClient testClient;
+    CHECK(testClient.connect(SERVER_PORT));
+    Value result = testClient.client.call("count").get();
+    CHECK(result.type() == array_type);
+    if (result.type() == array_type)
+    {
+        CHECK(result.get_array().size() == size_t(COUNT));
+        CHECK(result.get_array().back() == Value(COUNT - 1));
+    }
+    testClient.client.stop();
+}
+
+// Past the queue limit writes are refused without failing the stream, and are taken again once the
+// connection catches up
+void testQueueLimit()
+{
+    Loopback::RawConnection connection;
+    CHECK(connection.connect(SERVER_PORT));
+    connection.send("{\"method\": \"hold\", \"params\": [], \"id\": 2}");
+    CHECK(Loopback::waitFor([]() { lock_guard<mutex> lock(g_streamMutex); return g_stream != nullptr; }));
+
+    Server::response_stream_ptr stream;
+    {
+        lock_guard<mutex> lock(g_streamMutex);
+        stream.swap(g_stream);
+    }
+    if (!stream) return;
+
+    // Nothing reads the connection yet, so frames soon back up in the server
+    const string chunk = "\"" + string(1000, 'x') + "\",";
+    size_t written = 0;
+    CHECK(stream->write("["));
+    while (written < MAX_BYTES && stream->write(chunk)) { written += chunk.size(); }
+    CHECK(written < MAX_BYTES);
+    CHECK(!stream->isFailed());
+    CHECK(stream->getQueuedBytes() > QUEUE_LIMIT);
+    CHECK(stream->getQueuedBytes() <= QUEUE_LIMIT + FRAME_SIZE + chunk.size());
+
+    string message;
+    bool bRead = false;
+    thread reader([&]() { bRead = connection.readMessage(message, 10000); });
+    CHECK(Loopback::waitFor([&]() { return stream->write("\"end\"]"); }, 10000));
+    CHECK(stream->finish());
+    reader.join();
+
+    CHECK(bRead);
+    Value reply;
+    CHECK(read_string(message, reply) && reply.type() == obj_type);
+    if (reply.type() != obj_type) return;
+    const Value& result = find_value(reply.get_obj(), "result");
+    CHECK(result.type() == array_type && result.get_array().size() == written / chunk.size() + 1);
+}
+
+int main()
+{
+    Server server(SERVER_PORT);
+    server.setRequestCallback(&requestCallback);
+    server.setResponseStreamLimits(FRAME_SIZE, 0, QUEUE_LIMIT);
+    server.start();
+
+    testContinuationFrames();
+    testClientReassembly();
+    testQueueLimit();
+
+    server.stop();
+    return UNIT_TEST_RESULT("StreamTest");
+}
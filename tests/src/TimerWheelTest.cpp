@@ -0,0 +1,91 @@
+#include <TimerWheel.h>
+
+#include "UnitTest.h"
+
+#include <vector>
+
+using namespace WebSocket;
+using namespace std;
+
+void record(vector<int>* fired, int value) { fired->push_back(value); }
+
+void testFiresInOrder()
+{
+    TimerWheel wheel;
+    vector<int> fired;
+    wheel.schedule(5, bind(&record, &fired, 5));
+    wheel.schedule(1, bind(&record, &fired, 1));
+    wheel.schedule(3, bind(&record, &fired, 3));
+    CHECK(wheel.size() == 3);
+
+    wheel.advance(2);
+    CHECK(fired == vector<int>({ 1 }));
+    wheel.advance(5);
+    CHECK(fired == vector<int>({ 1, 3, 5 }));
+    CHECK(wheel.size() == 0);
+}
+
+void testZeroDelayWaitsOneTick()
+{
+    TimerWheel wheel(10);
+    vector<int> fired;
+    wheel.schedule(0, bind(&record, &fired, 0));
+    wheel.advance(10);
+    CHECK(fired.empty());
+    wheel.advance(11);
+    CHECK(fired.size() == 1);
+}
+
+void testCancel()
+{
+    TimerWheel wheel;
+    vector<int> fired;
+    TimerWheel::timer_id_t id = wheel.schedule(2, bind(&record, &fired, 2));
+    wheel.schedule(4, bind(&record, &fired, 4));
+    CHECK(wheel.cancel(id));
+    CHECK(!wheel.cancel(id));
+    wheel.advance(10);
+    CHECK(fired == vector<int>({ 4 }));
+}
+
+void testCascadesAcrossLevels()
+{
+    // Delays past each level's span are cascaded down and must still fire exactly on time
+    TimerWheel wheel;
+    vector<int> fired;
+    const uint64_t delays[] = { 63, 64, 65, 4095, 4096, 300000, (1ULL << 24) + 5 };
+    for (auto delay: delays) { wheel.schedule(delay, bind(&record, &fired, (int)delay)); }
+
+    for (auto delay: delays)
+    {
+        wheel.advance(delay - 1);
+        CHECK(fired.empty() || fired.back() != (int)delay);
+        wheel.advance(delay);
+        CHECK(!fired.empty() && fired.back() == (int)delay);
+    }
+    CHECK(fired.size() == sizeof(delays) / sizeof(delays[0]));
+}
+
+void rescheduleFrom(TimerWheel* wheel, int* count)
+{
+    if (++*count < 3) { wheel->schedule(1, bind(&rescheduleFrom, wheel, count)); }
+}
+
+void testCallbacksMayReschedule()
+{
+    TimerWheel wheel;
+    int count = 0;
+    wheel.schedule(1, bind(&rescheduleFrom, &wheel, &count));
+    for (uint64_t now = 1; now <= 5; now++) { wheel.advance(now); }
+    CHECK(count == 3);
+}
+
+int main()
+{
+    testFiresInOrder();
+    testZeroDelayWaitsOneTick();
+    testCancel();
+    testCascadesAcrossLevels();
+    testCallbacksMayReschedule();
+    return UNIT_TEST_RESULT("TimerWheelTest");
+}
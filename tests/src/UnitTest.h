@@ -0,0 +1,46 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// UnitTest.h
+//
+// Copyright (c) 2014 Eric Lombrozo
+//
+// All Rights Reserved.
+
+#pragma once
+
+#include <iostream>
+
+// Minimal checks for the unit test programs. Failed checks print their location and are counted, and
+// UNIT_TEST_RESULT() reports the count and becomes the program's exit status.
+namespace UnitTest
+{
+
+inline int& failures()
+{
+    static int count = 0;
+    return count;
+}
+
+}
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" << std::endl; \
+            UnitTest::failures()++; \
+        } \
+    } while (0)
+
+#define CHECK_THROWS(expr, exception) \
+    do { \
+        bool bThrown = false; \
+        try { expr; } \
+        catch (const exception&) { bThrown = true; } \
+        if (!bThrown) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": " #expr " did not throw " #exception << std::endl; \
+            UnitTest::failures()++; \
+        } \
+    } while (0)
+
+#define UNIT_TEST_RESULT(name) \
+    (std::cout << name << ": " << (UnitTest::failures() ? "FAILED" : "passed") << std::endl, UnitTest::failures() ? 1 : 0)
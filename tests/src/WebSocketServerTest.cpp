@@ -83,11 +83,21 @@ void requestCallback(Server& server, const Server::client_request_t& req)
     server.send(req.first, response);
 }
 
-int main()
+int main(int argc, char** argv)
 {
+#if defined(USE_TLS)
+    if (argc != 3) {
+        cout << "Usage: " << argv[0] << " <certificate chain file> <private key file>" << endl;
+        return 1;
+    }
+#endif
+
     signal(SIGINT, &finish);
 
     Server wsServer(WS_PORT);
+#if defined(USE_TLS)
+    wsServer.setTlsFiles(argv[1], argv[2]);
+#endif
     wsServer.setOpenCallback(&openCallback);
     wsServer.setCloseCallback(&closeCallback);
     wsServer.setRequestCallback(&requestCallback);